@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "chainparams.h"
 #include "util.h"
 #include "validation.h"
 #include "checkqueue.h"
@@ -99,5 +100,64 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// This Benchmark hashes a full HEADERS message worth of headers through
+// CHeaderCheck jobs with a given number of verifying threads (master
+// included); headers per second is HEADERS_PER_MESSAGE over the time
+// per iteration.
+static const size_t HEADERS_PER_MESSAGE = 2000;
+static void CCheckQueueHeaders(benchmark::State& state, int nThreads)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    std::vector<CBlockHeader> headers(HEADERS_PER_MESSAGE);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nTime = 1540526903 + i; // proof-of-stake era, hashing only
+        headers[i].nNonce = i;
+    }
+
+    bool fCacheSaved = fBlockHashCache;
+    fBlockHashCache = false;
+    CCheckQueue<CHeaderCheck> queue {16};
+    boost::thread_group tg;
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CHeaderCheck> control(&queue);
+        std::vector<CHeaderCheck> vChecks;
+        for (size_t i = 0; i < headers.size(); i += HEADER_CHECK_BATCH)
+            vChecks.emplace_back(&headers[i], HEADER_CHECK_BATCH, Params().GetConsensus());
+        control.Add(vChecks);
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+    fBlockHashCache = fCacheSaved;
+}
+
+static void CCheckQueueHeaders_1Thread(benchmark::State& state)
+{
+    CCheckQueueHeaders(state, 1);
+}
+
+static void CCheckQueueHeaders_2Threads(benchmark::State& state)
+{
+    CCheckQueueHeaders(state, 2);
+}
+
+static void CCheckQueueHeaders_4Threads(benchmark::State& state)
+{
+    CCheckQueueHeaders(state, 4);
+}
+
+static void CCheckQueueHeaders_8Threads(benchmark::State& state)
+{
+    CCheckQueueHeaders(state, 8);
+}
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueHeaders_1Thread);
+BENCHMARK(CCheckQueueHeaders_2Threads);
+BENCHMARK(CCheckQueueHeaders_4Threads);
+BENCHMARK(CCheckQueueHeaders_8Threads);
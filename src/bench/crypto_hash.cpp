@@ -8,6 +8,7 @@
 #include "bench.h"
 #include "bloom.h"
 #include "hash.h"
+#include "primitives/block.h"
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
@@ -186,12 +187,45 @@ static void HASH_X11_2048b_single(benchmark::State& state)
         hash = HashX11(in.begin(), in.end());
 }
 
+/* NeoScrypt over n distinct headers per iteration through NeoScryptBatch() */
+static void HASH_NeoScrypt_Batch(benchmark::State& state, size_t n)
+{
+    std::vector<CBlockHeader> headers(n);
+    std::vector<uint256> hashes(n);
+    for (size_t i = 0; i < n; i++)
+        headers[i].nNonce = i;
+
+    bool fCacheSaved = fBlockHashCache;
+    fBlockHashCache = false;
+    while (state.KeepRunning())
+        NeoScryptBatch(headers.data(), headers.size(), hashes.data());
+    fBlockHashCache = fCacheSaved;
+}
+
+static void HASH_NeoScrypt_1way(benchmark::State& state)
+{
+    HASH_NeoScrypt_Batch(state, 1);
+}
+
+static void HASH_NeoScrypt_4way(benchmark::State& state)
+{
+    HASH_NeoScrypt_Batch(state, 4);
+}
+
+static void HASH_NeoScrypt_8way(benchmark::State& state)
+{
+    HASH_NeoScrypt_Batch(state, 8);
+}
+
 BENCHMARK(HASH_RIPEMD160);
 BENCHMARK(HASH_SHA1);
 BENCHMARK(HASH_SHA256);
 BENCHMARK(HASH_DSHA256);
 BENCHMARK(HASH_SHA512);
 BENCHMARK(HASH_X11);
+BENCHMARK(HASH_NeoScrypt_1way);
+BENCHMARK(HASH_NeoScrypt_4way);
+BENCHMARK(HASH_NeoScrypt_8way);
 
 BENCHMARK(HASH_SHA256_0032b);
 BENCHMARK(HASH_DSHA256_0032b);
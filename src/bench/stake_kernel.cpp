@@ -0,0 +1,67 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "kernel.h"
+
+#include <vector>
+
+// This Benchmark sweeps a full hash drift window for a wallet's worth of
+// stake kernels with a given number of search threads (caller included).
+// The target is unreachable, so every timestamp of every coin is hashed and
+// kernels per second is STAKE_COINS * STAKE_WINDOW over the time per
+// iteration.
+static const size_t STAKE_COINS = 1000;
+static const unsigned int STAKE_WINDOW = 45;
+static const unsigned int STAKE_TIME = 1560000000;
+static void StakeKernelSearch(benchmark::State& state, int nThreads)
+{
+    // Without a chain only testnet falls back to an empty stake modifier
+    SelectParams(CBaseChainParams::TESTNET);
+    std::vector<CBlockIndex> vBlocks(STAKE_COINS);
+    std::vector<CStakeKernel> vKernels(STAKE_COINS);
+    std::vector<const CStakeKernel*> vpKernels;
+    for (size_t i = 0; i < STAKE_COINS; i++) {
+        vBlocks[i].nHeight = i;
+        vBlocks[i].nTime = STAKE_TIME - 60 * 24 * 60 * 60 + i;
+        COutPoint prevout(ArithToUint256(arith_uint256(i + 1)), i % 4);
+        vKernels[i].Init(&vBlocks[i], STAKE_KERNEL_TX_OFFSET, prevout, 1000 * COIN);
+        vpKernels.push_back(&vKernels[i]);
+    }
+
+    while (state.KeepRunning()) {
+        size_t nIndex;
+        unsigned int nTime;
+        uint64_t nTried;
+        bool fFound = SearchStakeKernels(vpKernels, 0x01010000, STAKE_TIME, STAKE_TIME + STAKE_WINDOW - 1, nThreads, nIndex, nTime, nTried);
+        assert(!fFound && nTried == STAKE_COINS * STAKE_WINDOW);
+    }
+}
+
+static void StakeKernelSearch_1Thread(benchmark::State& state)
+{
+    StakeKernelSearch(state, 1);
+}
+
+static void StakeKernelSearch_2Threads(benchmark::State& state)
+{
+    StakeKernelSearch(state, 2);
+}
+
+static void StakeKernelSearch_4Threads(benchmark::State& state)
+{
+    StakeKernelSearch(state, 4);
+}
+
+static void StakeKernelSearch_8Threads(benchmark::State& state)
+{
+    StakeKernelSearch(state, 8);
+}
+
+BENCHMARK(StakeKernelSearch_1Thread);
+BENCHMARK(StakeKernelSearch_2Threads);
+BENCHMARK(StakeKernelSearch_4Threads);
+BENCHMARK(StakeKernelSearch_8Threads);
@@ -0,0 +1,94 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "hdchain.h"
+#include "key.h"
+#include "util.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+
+#include <vector>
+
+// These Benchmarks sign with HD_KEYS keys of an encrypted and unlocked HD
+// wallet per iteration, like a transaction spending that many inputs. The
+// first decrypts the seed, checks it and derives every key the way
+// CWallet::GetKey did on each call, the second gets them from CWallet::GetKey
+// and its cache of derived keys.
+static const uint32_t HD_KEYS = 100;
+
+static void SetupHDWallet(CWallet& wallet, std::vector<CKeyID>& vKeyIDs)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CHDChain chain;
+    assert(chain.SetSeed(SecureVector(32, 0x5e), true));
+
+    // EncryptWallet tops up the keypool, keep that short
+    ForceSetArg("-keypool", "1");
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+
+    LOCK(wallet.cs_wallet);
+    assert(wallet.SetHDChain(chain, false));
+    for (uint32_t i = 0; i < HD_KEYS; i++) {
+        CExtKey extkey;
+        chain.DeriveChildExtKey(0, false, i, extkey);
+        CHDPubKey hdPubKey;
+        hdPubKey.extPubKey = extkey.Neuter();
+        hdPubKey.hdchainID = chain.GetID();
+        assert(wallet.LoadHDPubKey(hdPubKey));
+        vKeyIDs.push_back(hdPubKey.extPubKey.pubkey.GetID());
+    }
+
+    SecureString strPassphrase("wallet_keys");
+    assert(wallet.EncryptWallet(strPassphrase));
+    assert(wallet.Unlock(strPassphrase));
+}
+
+static void SignHDKeysDerived(benchmark::State& state)
+{
+    if (!bitdb.IsMock())
+        bitdb.MakeMock();
+    CWallet wallet("wallet_keys_derived.dat");
+    std::vector<CKeyID> vKeyIDs;
+    SetupHDWallet(wallet, vKeyIDs);
+    uint256 hash = Hash(vKeyIDs.begin(), vKeyIDs.end());
+    std::vector<unsigned char> vchSig;
+
+    LOCK(wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < HD_KEYS; i++) {
+            CHDChain chain;
+            assert(wallet.GetDecryptedHDChain(chain));
+            CExtKey extkey;
+            chain.DeriveChildExtKey(0, false, i, extkey);
+            assert(extkey.key.Sign(hash, vchSig));
+        }
+    }
+}
+
+static void SignHDKeysCached(benchmark::State& state)
+{
+    if (!bitdb.IsMock())
+        bitdb.MakeMock();
+    CWallet wallet("wallet_keys_cached.dat");
+    std::vector<CKeyID> vKeyIDs;
+    SetupHDWallet(wallet, vKeyIDs);
+    uint256 hash = Hash(vKeyIDs.begin(), vKeyIDs.end());
+    std::vector<unsigned char> vchSig;
+
+    LOCK(wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        for (const CKeyID& keyID : vKeyIDs) {
+            CKey key;
+            assert(wallet.GetKey(keyID, key));
+            assert(key.Sign(hash, vchSig));
+        }
+    }
+}
+
+BENCHMARK(SignHDKeysDerived);
+BENCHMARK(SignHDKeysCached);
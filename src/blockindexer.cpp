@@ -0,0 +1,353 @@
+// Copyright (c) 2014-2017 The SecureTag Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexer.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "init.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+CBlockIndexer* pblockindexer = NULL;
+
+/** Address type and hash of the scripts the address index knows, 0 for the others */
+static int GetAddressType(const CScript& script, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        return 2;
+    }
+    if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        return 1;
+    }
+    if (script.IsPayToPublicKey()) {
+        hashBytes = Hash160(script.begin()+1, script.end()-1);
+        return 1;
+    }
+    hashBytes.SetNull();
+    return 0;
+}
+
+bool GetBlockIndexEntries(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex,
+                          bool fConnect, CBlockIndexEntries& entries)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: block and undo data inconsistent", __func__);
+
+    // transactions of a disconnected block are undone in reverse order,
+    // so that outputs spent within the block end up removed from the unspent index
+    for (size_t n = 0; n < block.vtx.size(); n++) {
+        const size_t i = fConnect ? n : block.vtx.size() - 1 - n;
+        const CTransaction& tx = *(block.vtx[i]);
+        const uint256 txhash = tx.GetHash();
+        uint160 hashBytes;
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i-1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const COutPoint& prevout = tx.vin[j].prevout;
+                const Coin& coin = txundo.vprevout[j];
+                int addressType = GetAddressType(coin.out.scriptPubKey, hashBytes);
+
+                if (fAddressIndex && addressType > 0) {
+                    // spending activity, and the spent output leaves the unspent index
+                    entries.addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), coin.out.nValue * -1));
+                    entries.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, prevout.hash, prevout.n),
+                                                                         fConnect ? CAddressUnspentValue() : CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight)));
+                }
+
+                if (fSpentIndex) {
+                    // the txid and input that spent an output, and the amount and address of the input
+                    entries.spentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n),
+                                                                fConnect ? CSpentIndexValue(txhash, j, pindex->nHeight, coin.out.nValue, addressType, hashBytes) : CSpentIndexValue()));
+                }
+            }
+        }
+
+        if (fAddressIndex) {
+            for (size_t k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                int addressType = GetAddressType(out.scriptPubKey, hashBytes);
+                if (addressType == 0)
+                    continue;
+
+                // receiving activity, and the new output in the unspent index
+                entries.addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                entries.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k),
+                                                                     fConnect ? CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight) : CAddressUnspentValue()));
+            }
+        }
+    }
+
+    if (fTimestampIndex)
+        entries.timestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+
+    return true;
+}
+
+CBlockIndexer::CBlockIndexer() :
+    pindexBest(NULL),
+    fTipChanged(false),
+    fFailed(false)
+{
+}
+
+bool CBlockIndexer::Init()
+{
+    LOCK(cs_main);
+
+    CBlockLocator locator;
+    if (!pblocktree->ReadBestIndexedBlock(locator)) {
+        // indexes from before the indexer were written while connecting blocks
+        locator = chainActive.GetLocator();
+        if (!pblocktree->WriteBestIndexedBlock(locator))
+            return error("%s: failed to write best indexed block", __func__);
+    }
+
+    const CBlockIndex* pindex = NULL;
+    if (!locator.IsNull()) {
+        // the block itself if known, so that leaving a fork it was on gets undone
+        pindex = LookupBlockIndex(locator.vHave.front());
+        if (!pindex || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
+            pindex = FindForkInGlobalIndex(chainActive, locator);
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    pindexBest = pindex;
+    LogPrintf("%s: indexes built up to height %d\n", __func__, pindexBest ? pindexBest->nHeight : -1);
+    return true;
+}
+
+void CBlockIndexer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fTipChanged = true;
+    cond.notify_all();
+}
+
+bool CBlockIndexer::WriteEntries(const CBlockIndexEntries& entries, bool fConnect)
+{
+    if (fAddressIndex) {
+        if (!(fConnect ? pblocktree->WriteAddressIndex(entries.addressIndex) : pblocktree->EraseAddressIndex(entries.addressIndex)))
+            return error("%s: failed to write address index", __func__);
+        if (!pblocktree->UpdateAddressUnspentIndex(entries.addressUnspentIndex))
+            return error("%s: failed to write address unspent index", __func__);
+    }
+
+    if (fSpentIndex && !pblocktree->UpdateSpentIndex(entries.spentIndex))
+        return error("%s: failed to write spent index", __func__);
+
+    if (fTimestampIndex && !(fConnect ? pblocktree->WriteTimestampIndex(entries.timestampIndex) : pblocktree->EraseTimestampIndex(entries.timestampIndex)))
+        return error("%s: failed to write timestamp index", __func__);
+
+    return true;
+}
+
+bool CBlockIndexer::SetBestBlock(const CBlockIndex* pindex)
+{
+    // Written after the entries, being interrupted in between only makes them
+    // get written again, which leaves the indexes as they are
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindex);
+    }
+    if (!pblocktree->WriteBestIndexedBlock(locator))
+        return error("%s: failed to write best indexed block", __func__);
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    pindexBest = pindex;
+    cond.notify_all();
+    return true;
+}
+
+bool CBlockIndexer::ConnectBlocks(const std::vector<const CBlockIndex*>& vBlocks)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlockIndexEntries entries;
+
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex = vBlocks[i];
+        // the transactions of the genesis block are never connected
+        if (pindex->GetBlockHash() != consensusParams.hashGenesisBlock) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockFromDisk(block, pindex, consensusParams))
+                return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+            if (!UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+                return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+            if (!GetBlockIndexEntries(block, blockundo, pindex, true, entries))
+                return false;
+        }
+
+        if (entries.size() >= MAX_BATCH_ENTRIES || i + 1 == vBlocks.size()) {
+            if (!WriteEntries(entries, true) || !SetBestBlock(pindex))
+                return false;
+            entries.clear();
+        }
+    }
+
+    return true;
+}
+
+bool CBlockIndexer::DisconnectBlock(const CBlockIndex* pindex)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlock block;
+    CBlockUndo blockundo;
+    CBlockIndexEntries entries;
+
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+    if (!UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+        return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    if (!GetBlockIndexEntries(block, blockundo, pindex, false, entries))
+        return false;
+
+    return WriteEntries(entries, false) && SetBestBlock(pindex->pprev);
+}
+
+void CBlockIndexer::ThreadSync()
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindexDisconnect = NULL;
+        std::vector<const CBlockIndex*> vConnect;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexTip = chainActive.Tip();
+            const CBlockIndex* pindex;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                pindex = pindexBest;
+                fTipChanged = false;
+            }
+
+            if (pindex && !chainActive.Contains(pindex)) {
+                // Either the chain left the block for another fork, or it is
+                // still being connected up to it, e.g. with -reindex-chainstate
+                if (pindexTip && (pindexTip->nHeight >= pindex->nHeight || pindex->GetAncestor(pindexTip->nHeight) != pindexTip))
+                    pindexDisconnect = pindex;
+            } else {
+                pindex = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+                while (pindex && vConnect.size() < MAX_BATCH_BLOCKS) {
+                    vConnect.push_back(pindex);
+                    pindex = chainActive.Next(pindex);
+                }
+            }
+        }
+
+        bool fSuccess = true;
+        if (pindexDisconnect) {
+            fSuccess = DisconnectBlock(pindexDisconnect);
+        } else if (!vConnect.empty()) {
+            fSuccess = ConnectBlocks(vConnect);
+            if (fSuccess && vConnect.size() == MAX_BATCH_BLOCKS)
+                LogPrintf("%s: indexes built up to height %d\n", __func__, vConnect.back()->nHeight);
+        } else {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fTipChanged)
+                cond.wait(lock);
+            continue;
+        }
+
+        if (!fSuccess) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fFailed = true;
+            cond.notify_all();
+            LogPrintf("*** %s: failed to write block indexes\n", __func__);
+            uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+            return;
+        }
+    }
+}
+
+bool CBlockIndexer::IsSynced(const CBlockIndex* pindexTip) const
+{
+    if (!pindexTip)
+        return true;
+    return pindexBest && pindexBest->GetAncestor(pindexTip->nHeight) == pindexTip;
+}
+
+bool CBlockIndexer::BlockUntilSynced(int64_t nTimeout)
+{
+    boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(nTimeout);
+    while (true) {
+        const CBlockIndex* pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+        }
+
+        // progress of the indexer and tip changes both wake us up, the tip is
+        // looked up again in case the chain moved on in the meantime
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fFailed)
+            return false;
+        if (IsSynced(pindexTip))
+            return true;
+        if (!cond.timed_wait(lock, timeout) && !IsSynced(pindexTip))
+            return false;
+    }
+}
+
+int CBlockIndexer::GetHeight() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return pindexBest ? pindexBest->nHeight : -1;
+}
+
+bool EnableBlockIndexes(std::string& strError)
+{
+    LOCK(cs_main);
+
+    bool fEnableAddressIndex = !fAddressIndex && GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    bool fEnableSpentIndex = !fSpentIndex && GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    bool fEnableTimestampIndex = !fTimestampIndex && GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    if (!fEnableAddressIndex && !fEnableSpentIndex && !fEnableTimestampIndex)
+        return true;
+
+    if (fHavePruned) {
+        strError = _("You need to rebuild the database using -reindex to enable -addressindex, -spentindex or -timestampindex on a pruned node");
+        return false;
+    }
+
+    if (fEnableAddressIndex) {
+        fAddressIndex = true;
+        pblocktree->WriteFlag("addressindex", true);
+        pblocktree->WriteFlag("addressbalanceindex", true);
+    }
+    if (fEnableSpentIndex) {
+        fSpentIndex = true;
+        pblocktree->WriteFlag("spentindex", true);
+    }
+    if (fEnableTimestampIndex) {
+        fTimestampIndex = true;
+        pblocktree->WriteFlag("timestampindex", true);
+    }
+
+    // Indexes that were already there get their entries written again, which
+    // does not change them
+    LogPrintf("%s: building block indexes from the genesis block\n", __func__);
+    if (!pblocktree->WriteBestIndexedBlock(CBlockLocator())) {
+        strError = _("Error writing to the block database");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2014-2017 The SecureTag Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BLOCKINDEXER_H
+#define BLOCKINDEXER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "addressindex.h"
+#include "amount.h"
+#include "spentindex.h"
+#include "sync.h"
+#include "validationinterface.h"
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CBlockIndexer;
+
+extern CBlockIndexer* pblockindexer;
+
+/** Entries of the address, spent and timestamp indexes for a range of blocks */
+struct CBlockIndexEntries
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<CTimestampIndexKey> timestampIndex;
+
+    size_t size() const
+    {
+        return addressIndex.size() + addressUnspentIndex.size() + spentIndex.size() + timestampIndex.size();
+    }
+
+    void clear()
+    {
+        addressIndex.clear();
+        addressUnspentIndex.clear();
+        spentIndex.clear();
+        timestampIndex.clear();
+    }
+};
+
+/**
+ * Append the index entries of a block to entries, for connecting it or, with
+ * fConnect unset, for disconnecting it. The spent outputs come from its undo data.
+ */
+bool GetBlockIndexEntries(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex,
+                          bool fConnect, CBlockIndexEntries& entries);
+
+/**
+ * Keeps the address, spent and timestamp indexes in step with the active chain.
+ *
+ * Blocks are indexed on a thread of their own after they were connected,
+ * reading them and their undo data back from disk, so that connecting
+ * blocks under cs_main does not pay for the index writes. The last indexed
+ * block is kept as a locator in the block tree database, indexes enabled
+ * later on are caught up from there in batches of blocks.
+ */
+class CBlockIndexer final : public CValidationInterface
+{
+private:
+    //! Blocks read per batch and index entries written at once while catching up
+    static const int MAX_BATCH_BLOCKS = 1000;
+    static const size_t MAX_BATCH_ENTRIES = 100000;
+
+    mutable CWaitableCriticalSection cs;
+    CConditionVariable cond;
+
+    //! Last block whose entries are in the indexes, may have left the active chain since
+    const CBlockIndex* pindexBest;
+    bool fTipChanged;
+    bool fFailed;
+
+    bool WriteEntries(const CBlockIndexEntries& entries, bool fConnect);
+    bool SetBestBlock(const CBlockIndex* pindex);
+    bool ConnectBlocks(const std::vector<const CBlockIndex*>& vBlocks);
+    bool DisconnectBlock(const CBlockIndex* pindex);
+    bool IsSynced(const CBlockIndex* pindexTip) const;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+public:
+    CBlockIndexer();
+
+    /** Load the last indexed block, must run before blocks get connected */
+    bool Init();
+    /** Index blocks as the active chain moves, until interrupted */
+    void ThreadSync();
+
+    /** Wait up to nTimeout milliseconds until the indexes cover the active chain */
+    bool BlockUntilSynced(int64_t nTimeout);
+    int GetHeight() const;
+};
+
+/**
+ * Turn on the indexes requested by -addressindex, -spentindex and
+ * -timestampindex which the block tree database does not have yet.
+ */
+bool EnableBlockIndexes(std::string& strError);
+
+#endif // BLOCKINDEXER_H
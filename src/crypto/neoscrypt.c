@@ -2715,7 +2715,7 @@ void neoscrypt(const uchar *password, uchar *output, uint profile) {
 #endif /* !(ASM) */
 
 
-#if defined(ASM) && defined(MINER_4WAY)
+#if defined(MINER_4WAY)
 
 extern void neoscrypt_xor_salsa_4way(uint *X, uint *X0, uint *Y, uint double_rounds);
 extern void neoscrypt_xor_chacha_4way(uint *Z, uint *Z0, uint *Y, uint double_rounds);
@@ -2834,11 +2834,12 @@ static void neoscrypt_xor_4way(void *dstp, const void *srcAp,
 #endif
 
 
-/* 4-way NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20 */
-void neoscrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
+/* 4-way NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20
+ * of 4 independent 80-byte passwords stored back to back */
+void neoscrypt_4way_multi(const uchar *passwords, uchar *output, uchar *scratchpad) {
     const uint N = 128, r = 2, double_rounds = 10;
     uint *X, *Z, *V, *Y, *P;
-    uint i, j0, j1, j2, j3, k;
+    uint i, j0, j1, j2, j3;
 
     /* 2 * BLOCK_SIZE compacted to 128 below */;
 
@@ -2852,11 +2853,8 @@ void neoscrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
     /* P is a set of passwords 80 bytes each */
     P = &X[4 * (N + 3) * 32 * r];
 
-    /* Load the password and increment nonces */
-    for(k = 0; k < 4; k++) {
-        neoscrypt_copy(&P[k * 20], password, 80);
-        P[(k + 1) * 20 - 1] += k;
-    }
+    /* Load the passwords */
+    neoscrypt_copy(&P[0], passwords, 4 * 80);
 
     neoscrypt_fastkdf_4way((uchar *) &P[0], (uchar *) &P[0], (uchar *) &Y[0],
       (uchar *) &scratchpad[0], 0);
@@ -2919,6 +2917,20 @@ void neoscrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
       (uchar *) &scratchpad[0], 1);
 }
 
+/* 4-way NeoScrypt(128, 2, 1) of a password and its 3 nonce increments */
+void neoscrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
+    uint P[4 * 20];
+    uint k;
+
+    /* Load the password and increment nonces */
+    for(k = 0; k < 4; k++) {
+        neoscrypt_copy(&P[k * 20], password, 80);
+        P[(k + 1) * 20 - 1] += k;
+    }
+
+    neoscrypt_4way_multi((uchar *) &P[0], output, scratchpad);
+}
+
 #ifdef SHA256
 /* 4-way Scrypt(1024, 1, 1) with Salsa20/8 */
 void scrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
@@ -3251,9 +3263,9 @@ void neoscrypt_fastkdf_4way(const uchar *password, const uchar *salt,
 
 }
 
-#endif /* (ASM) && (MINER_4WAY) */
+#endif /* (MINER_4WAY) */
 
-#ifndef ASM
+#if !defined(ASM) && !defined(MINER_4WAY)
 uint cpu_vec_exts() {
 
     /* No assembly, no extensions */
@@ -3261,3 +3273,43 @@ uint cpu_vec_exts() {
     return(0);
 }
 #endif
+
+/* Number of passwords neoscrypt_batch() hashes in parallel on this CPU */
+uint neoscrypt_batch_width() {
+
+#if defined(MINER_4WAY)
+    /* SSE2 (bit 5) is all the 4-way kernels need */
+    if(cpu_vec_exts() & 0x20)
+      return(4);
+#endif
+
+    return(1);
+}
+
+/* NeoScrypt(128, 2, 1) of n independent 80-byte passwords stored back to back;
+ * the 32-byte digests are stored back to back in output.
+ * Groups of 4 go through the 4-way kernels if available, the rest
+ * through the single-way code */
+void neoscrypt_batch(const uchar *passwords, uchar *output, uint n) {
+
+#if defined(MINER_4WAY)
+    if((n >= 4) && (neoscrypt_batch_width() == 4)) {
+        const size_t stack_align = 0x40;
+        /* Scratchpad size is 4 * ((N + 3) * r * 128 + 80) bytes */
+        uchar stack[4 * ((128 + 3) * 2 * 128 + 80) + stack_align];
+        uchar *scratchpad = (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+
+        for(; n >= 4; n -= 4) {
+            neoscrypt_4way_multi(passwords, output, scratchpad);
+            passwords += 4 * 80;
+            output += 4 * 32;
+        }
+    }
+#endif
+
+    for(; n; n--) {
+        neoscrypt(passwords, output, 0x0);
+        passwords += 80;
+        output += 32;
+    }
+}
@@ -13,10 +13,13 @@ void neoscrypt_copy(void *dstp, const void *srcp, unsigned int len);
 void neoscrypt_erase(void *dstp, unsigned int len);
 void neoscrypt_xor(void *dstp, const void *srcp, unsigned int len);
 
-#if defined(ASM) && defined(MINER_4WAY)
+#if defined(MINER_4WAY)
 void neoscrypt_4way(const unsigned char *password, unsigned char *output,
   unsigned char *scratchpad);
 
+void neoscrypt_4way_multi(const unsigned char *passwords,
+  unsigned char *output, unsigned char *scratchpad);
+
 #ifdef SHA256
 void scrypt_4way(const unsigned char *password, unsigned char *output,
   unsigned char *scratchpad);
@@ -32,6 +35,11 @@ void neoscrypt_fastkdf_4way(const unsigned char *password,
 
 unsigned int cpu_vec_exts(void);
 
+unsigned int neoscrypt_batch_width(void);
+
+void neoscrypt_batch(const unsigned char *passwords, unsigned char *output,
+  unsigned int n);
+
 #if (__cplusplus)
 }
 #else
@@ -67,5 +67,7 @@ void CDSNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, con
 void CDSNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock)
 {
     instantsend.SyncTransaction(tx, pindex, posInBlock);
+    mnodeman.SyncTransaction(tx, pindex, posInBlock);
+    fnodeman.SyncTransaction(tx, pindex, posInBlock);
     CPrivateSend::SyncTransaction(tx, pindex, posInBlock);
 }
@@ -0,0 +1,363 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flat-database.h"
+
+#include "crypto/common.h"
+
+/** Marks a record log, legacy files start with the length of their magic message instead */
+static const unsigned char FLATDB_LOG_MARKER[4] = {0xff, 'l', 'o', 'g'};
+static const uint32_t FLATDB_LOG_VERSION = 1;
+
+/** Size of the record header: body size and checksum */
+static const uint64_t FLATDB_RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint256);
+/** Only the first bytes of a record body are read to index it without verification */
+static const uint64_t FLATDB_MAX_KEY_PREFIX = 256;
+/** Files smaller than this are never compacted */
+static const uint64_t FLATDB_MIN_COMPACT_SIZE = 1 << 20;
+
+const unsigned char CFlatDBWriter::RECORD_PUT;
+const unsigned char CFlatDBWriter::RECORD_ERASE;
+
+CFlatDBLog::CFlatDBLog(const boost::filesystem::path& pathLogIn, const std::string& strMagicMessageIn) :
+    pathLog(pathLogIn),
+    strMagicMessage(strMagicMessageIn),
+    file(NULL),
+    nHeaderSize(0),
+    nFileSize(0),
+    nLiveSize(0)
+{
+}
+
+CFlatDBLog::~CFlatDBLog()
+{
+    Close();
+}
+
+void CFlatDBLog::Close()
+{
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+    mapRecords.clear();
+    nHeaderSize = nFileSize = nLiveSize = 0;
+}
+
+bool CFlatDBLog::WriteHeader(FILE* fileout)
+{
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << FLATDATA(FLATDB_LOG_MARKER) << FLATDB_LOG_VERSION << strMagicMessage << FLATDATA(Params().MessageStart());
+    if (fwrite(&ssHeader[0], 1, ssHeader.size(), fileout) != ssHeader.size())
+        return false;
+    nHeaderSize = ssHeader.size();
+    return true;
+}
+
+CFlatDBLog::OpenResult CFlatDBLog::Open(bool fVerify)
+{
+    Close();
+
+    file = fopen(pathLog.string().c_str(), "rb+");
+    if (!file)
+        return Missing;
+
+    fseek(file, 0, SEEK_END);
+    uint64_t nEnd = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // The header is small, read the start of the file and parse it from memory
+    std::vector<char> vchHeader(std::min<uint64_t>(nEnd, 4 + 4 + 9 + strMagicMessage.size() + 4 + 64));
+    if (!vchHeader.empty() && fread(&vchHeader[0], 1, vchHeader.size(), file) != vchHeader.size()) {
+        Close();
+        return IncorrectFormat;
+    }
+    CDataStream ssHeader(vchHeader, SER_DISK, CLIENT_VERSION);
+    unsigned char pchMarker[4];
+    uint32_t nVersion = 0;
+    std::string strMagicMessageTmp;
+    unsigned char pchMsgTmp[4];
+    bool fLegacy = false;
+    try {
+        ssHeader >> FLATDATA(pchMarker);
+        if (memcmp(pchMarker, FLATDB_LOG_MARKER, sizeof(pchMarker))) {
+            fLegacy = true;
+            ssHeader.Rewind(sizeof(pchMarker));
+        } else {
+            ssHeader >> nVersion;
+        }
+        ssHeader >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp) {
+            Close();
+            return IncorrectMagicMessage;
+        }
+        ssHeader >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
+            Close();
+            return IncorrectMagicNumber;
+        }
+    }
+    catch (std::exception &e) {
+        Close();
+        return fLegacy ? IncorrectMagicMessage : IncorrectFormat;
+    }
+    if (fLegacy) {
+        Close();
+        return Legacy;
+    }
+    if (nVersion != FLATDB_LOG_VERSION) {
+        error("%s: Unknown log version %d in %s", __func__, nVersion, pathLog.string());
+        Close();
+        return IncorrectFormat;
+    }
+    nHeaderSize = vchHeader.size() - ssHeader.size();
+
+    uint64_t nPos = nHeaderSize;
+    std::vector<char> vchBody;
+    while (nPos + FLATDB_RECORD_HEADER_SIZE <= nEnd) {
+        unsigned char pchRecordHeader[FLATDB_RECORD_HEADER_SIZE];
+        fseek(file, nPos, SEEK_SET);
+        if (fread(pchRecordHeader, 1, sizeof(pchRecordHeader), file) != sizeof(pchRecordHeader))
+            break;
+        uint64_t nBodySize = ReadLE32(pchRecordHeader);
+        if (nPos + FLATDB_RECORD_HEADER_SIZE + nBodySize > nEnd)
+            break;
+
+        vchBody.resize(fVerify ? nBodySize : std::min(nBodySize, FLATDB_MAX_KEY_PREFIX));
+        if (!vchBody.empty() && fread(&vchBody[0], 1, vchBody.size(), file) != vchBody.size())
+            break;
+
+        record_t record;
+        record.nPos = nPos;
+        record.nSize = FLATDB_RECORD_HEADER_SIZE + nBodySize;
+        memcpy(record.hash.begin(), pchRecordHeader + sizeof(uint32_t), sizeof(uint256));
+        if (fVerify && Hash(vchBody.begin(), vchBody.end()) != record.hash) {
+            error("%s: Checksum mismatch in %s at %d", __func__, pathLog.string(), nPos);
+            break;
+        }
+
+        unsigned char nType;
+        key_t vchKey;
+        try {
+            CDataStream ssBody(vchBody, SER_DISK, CLIENT_VERSION);
+            ssBody >> nType >> vchKey;
+            record.nValuePos = nPos + FLATDB_RECORD_HEADER_SIZE + (vchBody.size() - ssBody.size());
+        }
+        catch (std::exception &e) {
+            error("%s: Invalid record in %s at %d", __func__, pathLog.string(), nPos);
+            break;
+        }
+        if (vchKey.empty() || (nType != CFlatDBWriter::RECORD_PUT && nType != CFlatDBWriter::RECORD_ERASE)) {
+            error("%s: Invalid record in %s at %d", __func__, pathLog.string(), nPos);
+            break;
+        }
+
+        record_m_t::iterator it = mapRecords.find(vchKey);
+        if (it != mapRecords.end()) {
+            nLiveSize -= it->second.nSize;
+            mapRecords.erase(it);
+        }
+        if (nType == CFlatDBWriter::RECORD_PUT) {
+            mapRecords.insert(std::make_pair(vchKey, record));
+            nLiveSize += record.nSize;
+        }
+        nPos += record.nSize;
+    }
+
+    // Whatever follows the last intact record was torn by a crash while appending
+    if (nPos < nEnd) {
+        LogPrintf("%s: Discarding %d bytes after the last intact record in %s\n", __func__, nEnd - nPos, pathLog.string());
+        if (!TruncateFile(file, nPos)) {
+            Close();
+            return IncorrectFormat;
+        }
+    }
+    nFileSize = nPos;
+
+    return Ok;
+}
+
+bool CFlatDBLog::ReadValue(const record_t& record, std::vector<char>& vchValueRet)
+{
+    if (!file)
+        return false;
+    vchValueRet.resize(record.nPos + record.nSize - record.nValuePos);
+    if (fseek(file, record.nValuePos, SEEK_SET))
+        return false;
+    return vchValueRet.empty() || fread(&vchValueRet[0], 1, vchValueRet.size(), file) == vchValueRet.size();
+}
+
+bool CFlatDBLog::AppendRecord(FILE* fileout, uint64_t& nPos, const uint256& hash, const std::vector<unsigned char>& vchBody, record_t* pRecordRet)
+{
+    unsigned char pchRecordHeader[FLATDB_RECORD_HEADER_SIZE];
+    WriteLE32(pchRecordHeader, vchBody.size());
+    memcpy(pchRecordHeader + sizeof(uint32_t), hash.begin(), sizeof(uint256));
+    if (fwrite(pchRecordHeader, 1, sizeof(pchRecordHeader), fileout) != sizeof(pchRecordHeader) ||
+        fwrite(&vchBody[0], 1, vchBody.size(), fileout) != vchBody.size())
+        return false;
+
+    if (pRecordRet) {
+        // the body of a put starts with its type and key
+        CDataStream ssBody((const char*)&vchBody[0], (const char*)&vchBody[0] + vchBody.size(), SER_DISK, CLIENT_VERSION);
+        unsigned char nType;
+        key_t vchKey;
+        ssBody >> nType >> vchKey;
+        pRecordRet->nPos = nPos;
+        pRecordRet->nSize = FLATDB_RECORD_HEADER_SIZE + vchBody.size();
+        pRecordRet->nValuePos = nPos + FLATDB_RECORD_HEADER_SIZE + (vchBody.size() - ssBody.size());
+        pRecordRet->hash = hash;
+    }
+    nPos += FLATDB_RECORD_HEADER_SIZE + vchBody.size();
+    return true;
+}
+
+bool CFlatDBLog::Rewrite(const CFlatDBWriter& writer)
+{
+    boost::filesystem::path pathTmp = pathLog;
+    pathTmp += ".new";
+    FILE* fileout = fopen(pathTmp.string().c_str(), "wb");
+    if (!fileout)
+        return error("%s: Failed to open file %s", __func__, pathTmp.string());
+
+    if (!WriteHeader(fileout)) {
+        fclose(fileout);
+        return error("%s: Failed to write %s", __func__, pathTmp.string());
+    }
+
+    // Copy the live records that did not change as they are, then add the pending ones
+    std::set<key_t> setPending;
+    for (const auto& pending : writer.GetPending())
+        setPending.insert(pending.vchKey);
+
+    uint64_t nPos = nHeaderSize;
+    record_m_t mapRecordsNew;
+    std::vector<unsigned char> vchRecord;
+    for (record_m_t::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+        const record_t& record = it->second;
+        if (!writer.IsLive(it->first) || setPending.count(it->first))
+            continue;
+        vchRecord.resize(record.nSize);
+        if (fseek(file, record.nPos, SEEK_SET) || fread(&vchRecord[0], 1, vchRecord.size(), file) != vchRecord.size() ||
+            fwrite(&vchRecord[0], 1, vchRecord.size(), fileout) != vchRecord.size()) {
+            fclose(fileout);
+            return error("%s: Failed to copy records to %s", __func__, pathTmp.string());
+        }
+        record_t recordNew = record;
+        recordNew.nPos = nPos;
+        recordNew.nValuePos = nPos + (record.nValuePos - record.nPos);
+        mapRecordsNew.insert(std::make_pair(it->first, recordNew));
+        nPos += record.nSize;
+    }
+    for (const auto& pending : writer.GetPending()) {
+        record_t record;
+        if (!AppendRecord(fileout, nPos, pending.hash, pending.vchBody, &record)) {
+            fclose(fileout);
+            return error("%s: Failed to write %s", __func__, pathTmp.string());
+        }
+        mapRecordsNew[pending.vchKey] = record;
+    }
+
+    fflush(fileout);
+    FileCommit(fileout);
+    fclose(fileout);
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+    if (!RenameOver(pathTmp, pathLog))
+        return error("%s: Failed to rename %s", __func__, pathTmp.string());
+
+    file = fopen(pathLog.string().c_str(), "rb+");
+    if (!file)
+        return error("%s: Failed to reopen %s", __func__, pathLog.string());
+
+    mapRecords.swap(mapRecordsNew);
+    nFileSize = nLiveSize = nPos;
+    nLiveSize -= nHeaderSize;
+    return true;
+}
+
+void CFlatDBWriter::Finish()
+{
+    for (auto& record : vRecords) {
+        record.hash = Hash(record.vchBody.begin(), record.vchBody.end());
+        setLive.insert(record.vchKey);
+        CFlatDBLog::record_m_t::const_iterator it = mapRecords.find(record.vchKey);
+        if (it != mapRecords.end() && it->second.hash == record.hash)
+            continue;
+        vPending.push_back(pending_t());
+        vPending.back().vchKey.swap(record.vchKey);
+        vPending.back().hash = record.hash;
+        vPending.back().vchBody.swap(record.vchBody);
+    }
+    vRecords.clear();
+}
+
+bool CFlatDBLog::Commit(const CFlatDBWriter& writer, int& nWrittenRet, int& nErasedRet)
+{
+    // Live size and file size once the changes are appended
+    uint64_t nLiveSizeNew = nLiveSize;
+    uint64_t nFileSizeNew = nFileSize;
+    nWrittenRet = writer.GetPending().size();
+    nErasedRet = 0;
+    for (record_m_t::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+        if (!writer.IsLive(it->first)) {
+            nErasedRet++;
+            nLiveSizeNew -= it->second.nSize;
+            nFileSizeNew += FLATDB_RECORD_HEADER_SIZE + 1 + GetSerializeSize(it->first, SER_DISK, CLIENT_VERSION);
+        }
+    }
+    for (const auto& pending : writer.GetPending()) {
+        record_m_t::const_iterator it = mapRecords.find(pending.vchKey);
+        if (it != mapRecords.end())
+            nLiveSizeNew -= it->second.nSize;
+        nLiveSizeNew += FLATDB_RECORD_HEADER_SIZE + pending.vchBody.size();
+        nFileSizeNew += FLATDB_RECORD_HEADER_SIZE + pending.vchBody.size();
+    }
+
+    // A new, converted or mostly superseded file is written from scratch
+    if (!file || (nFileSizeNew >= FLATDB_MIN_COMPACT_SIZE && nFileSizeNew - nHeaderSize > 2 * nLiveSizeNew))
+        return Rewrite(writer);
+
+    if (nWrittenRet == 0 && nErasedRet == 0)
+        return true;
+
+    if (fseek(file, nFileSize, SEEK_SET))
+        return error("%s: Failed to seek in %s", __func__, pathLog.string());
+
+    // The index is only updated once everything is on disk. A failed append
+    // cuts the file back to the last commit, which the index still describes.
+    uint64_t nPos = nFileSize;
+    std::vector<key_t> vErased;
+    record_m_t mapAppended;
+    CDataStream ssBody(SER_DISK, CLIENT_VERSION);
+    bool fOk = true;
+    for (record_m_t::const_iterator it = mapRecords.begin(); fOk && it != mapRecords.end(); ++it) {
+        if (writer.IsLive(it->first))
+            continue;
+        ssBody.clear();
+        ssBody << CFlatDBWriter::RECORD_ERASE << it->first;
+        std::vector<unsigned char> vchBody(ssBody.begin(), ssBody.end());
+        fOk = AppendRecord(file, nPos, Hash(vchBody.begin(), vchBody.end()), vchBody, NULL);
+        vErased.push_back(it->first);
+    }
+    for (std::vector<CFlatDBWriter::pending_t>::const_iterator it = writer.GetPending().begin(); fOk && it != writer.GetPending().end(); ++it) {
+        record_t record;
+        fOk = AppendRecord(file, nPos, it->hash, it->vchBody, &record);
+        mapAppended[it->vchKey] = record;
+    }
+    if (!fOk || fflush(file) != 0) {
+        TruncateFile(file, nFileSize);
+        return error("%s: Failed to write %s", __func__, pathLog.string());
+    }
+    FileCommit(file);
+
+    for (const auto& vchKey : vErased)
+        mapRecords.erase(vchKey);
+    for (const auto& appended : mapAppended)
+        mapRecords[appended.first] = appended.second;
+    nFileSize = nPos;
+    nLiveSize = nLiveSizeNew;
+    return true;
+}
@@ -11,9 +11,214 @@
 #include "streams.h"
 #include "util.h"
 
+#include <map>
+#include <set>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 
-/** 
+/** Key of the single record holding an object that is not split into records */
+static const char FLATDB_OBJECT = 'o';
+
+class CFlatDBWriter;
+
+/**
+*   Record log backing a flat database file
+*   ---------------------------------------
+*
+*   The file starts with a header (log marker, format version, magic message
+*   and network magic number) followed by records:
+*
+*     uint32 body size | uint256 SHA256d of body | body
+*
+*   where the body is a record type, the serialized key and, for a put, the
+*   serialized value. Records are only ever appended: a put supersedes the
+*   previous record with the same key and an erase removes it. Once superseded
+*   records make up most of the file it is rewritten with the live ones only.
+*/
+class CFlatDBLog
+{
+public:
+    enum OpenResult {
+        Ok,
+        Missing,
+        Legacy,
+        IncorrectMagicMessage,
+        IncorrectMagicNumber,
+        IncorrectFormat
+    };
+
+    typedef std::vector<unsigned char> key_t;
+
+    struct record_t {
+        uint64_t nPos;      // start of the record in the file
+        uint64_t nSize;     // size of the record on disk, header included
+        uint64_t nValuePos; // start of the serialized value
+        uint256 hash;
+    };
+
+    typedef std::map<key_t, record_t> record_m_t;
+
+private:
+    boost::filesystem::path pathLog;
+    std::string strMagicMessage;
+    FILE* file;
+    uint64_t nHeaderSize;
+    uint64_t nFileSize;
+    uint64_t nLiveSize;
+    record_m_t mapRecords;
+
+    bool WriteHeader(FILE* fileout);
+    bool AppendRecord(FILE* fileout, uint64_t& nPos, const uint256& hash, const std::vector<unsigned char>& vchBody, record_t* pRecordRet);
+    bool Rewrite(const CFlatDBWriter& writer);
+
+public:
+    CFlatDBLog(const boost::filesystem::path& pathLogIn, const std::string& strMagicMessageIn);
+    ~CFlatDBLog();
+
+    /**
+     * Open the file and index its records. With fVerify the checksum of every
+     * record is checked, otherwise only the record headers are read. The file
+     * is cut off after the last intact record.
+     */
+    OpenResult Open(bool fVerify);
+    bool IsOpen() const { return file != NULL; }
+    void Close();
+
+    const record_m_t& GetRecords() const { return mapRecords; }
+    bool ReadValue(const record_t& record, std::vector<char>& vchValueRet);
+
+    /** Append the changes collected by the writer, rewrite the file if needed */
+    bool Commit(const CFlatDBWriter& writer, int& nWrittenRet, int& nErasedRet);
+
+    uint64_t GetFileSize() const { return nFileSize; }
+    uint64_t GetLiveSize() const { return nLiveSize; }
+};
+
+/**
+*   Collects the records of an object being dumped. Write() is called while
+*   the object holds its locks and only serializes the record. Hashing the
+*   records and comparing them with the log is left to Finish(), which runs
+*   after the locks are released. A record whose content is the same as the
+*   live one in the log is not written again.
+*/
+class CFlatDBWriter
+{
+    friend class CFlatDBLog;
+
+public:
+    struct pending_t {
+        CFlatDBLog::key_t vchKey;
+        uint256 hash;
+        std::vector<unsigned char> vchBody;
+    };
+
+private:
+    const CFlatDBLog::record_m_t& mapRecords;
+    std::set<CFlatDBLog::key_t> setLive;
+    std::vector<pending_t> vRecords;
+    std::vector<pending_t> vPending;
+    CDataStream ssKey;
+    CDataStream ssBody;
+
+public:
+    static const unsigned char RECORD_PUT = 1;
+    static const unsigned char RECORD_ERASE = 2;
+
+    CFlatDBWriter(const CFlatDBLog& log) :
+        mapRecords(log.GetRecords()),
+        ssKey(SER_DISK, CLIENT_VERSION),
+        ssBody(SER_DISK, CLIENT_VERSION)
+        {}
+
+    template<typename K, typename V>
+    void Write(const K& key, const V& value)
+    {
+        ssKey.clear();
+        ssKey << key;
+        CFlatDBLog::key_t vchKey(ssKey.begin(), ssKey.end());
+
+        ssBody.clear();
+        ssBody << RECORD_PUT << vchKey << value;
+
+        vRecords.push_back(pending_t());
+        vRecords.back().vchKey.swap(vchKey);
+        vRecords.back().vchBody.assign(ssBody.begin(), ssBody.end());
+    }
+
+    /** Hash the written records and keep the ones that differ from the log */
+    void Finish();
+
+    bool IsLive(const CFlatDBLog::key_t& vchKey) const { return setLive.count(vchKey); }
+    const std::vector<pending_t>& GetPending() const { return vPending; }
+};
+
+/**
+*   Gives an object being loaded access to the records of the log
+*/
+class CFlatDBReader
+{
+private:
+    CFlatDBLog& log;
+    std::vector<char> vchValue;
+
+public:
+    CFlatDBReader(CFlatDBLog& logIn) : log(logIn) {}
+
+    /** Read one record, returns false if there is none with this key */
+    template<typename K, typename V>
+    bool Read(const K& key, V& value)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        CFlatDBLog::record_m_t::const_iterator it = log.GetRecords().find(CFlatDBLog::key_t(ssKey.begin(), ssKey.end()));
+        if (it == log.GetRecords().end())
+            return false;
+        if (!log.ReadValue(it->second, vchValue))
+            throw std::ios_base::failure("CFlatDBReader::Read: failed to read record");
+        CDataStream ssValue(vchValue, SER_DISK, CLIENT_VERSION);
+        ssValue >> value;
+        return true;
+    }
+
+    /** Read all records whose key starts with chPrefix one by one, in key order */
+    template<typename K, typename V, typename Callback>
+    void ReadAll(char chPrefix, Callback callback)
+    {
+        const CFlatDBLog::record_m_t& mapRecords = log.GetRecords();
+        CFlatDBLog::record_m_t::const_iterator it = mapRecords.lower_bound(CFlatDBLog::key_t(1, (unsigned char)chPrefix));
+        for (; it != mapRecords.end() && it->first[0] == (unsigned char)chPrefix; ++it) {
+            if (!log.ReadValue(it->second, vchValue))
+                throw std::ios_base::failure("CFlatDBReader::ReadAll: failed to read record");
+            CDataStream ssKey(it->first, SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(vchValue, SER_DISK, CLIENT_VERSION);
+            K key;
+            V value;
+            ssKey >> key;
+            ssValue >> value;
+            callback(key, value);
+        }
+    }
+};
+
+/**
+*   Objects are stored as a single record by default. Managers of large
+*   collections overload these to store every element as a record of its own,
+*   so that a dump only appends what changed since the last one.
+*/
+template<typename T>
+void WriteFlatDBRecords(const T& obj, CFlatDBWriter& writer)
+{
+    writer.Write(FLATDB_OBJECT, obj);
+}
+
+template<typename T>
+bool ReadFlatDBRecords(T& obj, CFlatDBReader& reader)
+{
+    return reader.Read(FLATDB_OBJECT, obj);
+}
+
+/**
 *   Generic Dumping and Loading
 *   ---------------------------
 */
@@ -36,47 +241,12 @@ private:
     boost::filesystem::path pathDB;
     std::string strFilename;
     std::string strMagicMessage;
+    CFlatDBLog log;
 
-    bool Write(const T& objToSave)
+    // Files written before the record log was introduced hold the whole object
+    // in one checksummed blob, they are read once and rewritten on the next dump
+    ReadResult ReadLegacy(T& objToLoad)
     {
-        // LOCK(objToSave.cs);
-
-        int64_t nStart = GetTimeMillis();
-
-        // serialize, checksum data up to that point, then append checksum
-        CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-        ssObj << strMagicMessage; // specific magic message for this type of object
-        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-        ssObj << objToSave;
-        uint256 hash = Hash(ssObj.begin(), ssObj.end());
-        ssObj << hash;
-
-        // open output file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "wb");
-        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-        if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
-
-        // Write and commit header, data
-        try {
-            fileout << ssObj;
-        }
-        catch (std::exception &e) {
-            return error("%s: Serialize or I/O error - %s", __func__, e.what());
-        }
-        fileout.fclose();
-
-        LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
-        LogPrintf("     %s\n", objToSave.ToString());
-
-        return true;
-    }
-
-    ReadResult Read(T& objToLoad, bool fDryRun = false)
-    {
-        //LOCK(objToLoad.cs);
-
-        int64_t nStart = GetTimeMillis();
         // open input file, and associate with CAutoFile
         FILE *file = fopen(pathDB.string().c_str(), "rb");
         CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
@@ -117,31 +287,13 @@ private:
             return IncorrectHash;
         }
 
-
-        unsigned char pchMsgTmp[4];
         std::string strMagicMessageTmp;
+        unsigned char pchMsgTmp[4];
         try {
-            // de-serialize file header (file specific magic message) and ..
+            // the header was already checked when the log was opened
             ssObj >> strMagicMessageTmp;
-
-            // ... verify the message matches predefined one
-            if (strMagicMessage != strMagicMessageTmp)
-            {
-                error("%s: Invalid magic message", __func__);
-                return IncorrectMagicMessage;
-            }
-
-
-            // de-serialize file header (network specific magic number) and ..
             ssObj >> FLATDATA(pchMsgTmp);
 
-            // ... verify the network matches ours
-            if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
-            {
-                error("%s: Invalid network magic number", __func__);
-                return IncorrectMagicNumber;
-            }
-
             // de-serialize data into T object
             ssObj >> objToLoad;
         }
@@ -151,24 +303,68 @@ private:
             return IncorrectFormat;
         }
 
+        return Ok;
+    }
+
+    ReadResult Read(T& objToLoad)
+    {
+        int64_t nStart = GetTimeMillis();
+
+        switch (log.Open(true)) {
+            case CFlatDBLog::Missing:
+                return FileError;
+            case CFlatDBLog::IncorrectMagicMessage:
+                error("%s: Invalid magic message", __func__);
+                return IncorrectMagicMessage;
+            case CFlatDBLog::IncorrectMagicNumber:
+                error("%s: Invalid network magic number", __func__);
+                return IncorrectMagicNumber;
+            case CFlatDBLog::IncorrectFormat:
+                return IncorrectFormat;
+            case CFlatDBLog::Legacy:
+            {
+                ReadResult readResult = ReadLegacy(objToLoad);
+                if (readResult != Ok)
+                    return readResult;
+                break;
+            }
+            case CFlatDBLog::Ok:
+            {
+                // records are read one at a time, the file is never held in memory as a whole
+                CFlatDBReader reader(log);
+                try {
+                    if (!ReadFlatDBRecords(objToLoad, reader)) {
+                        objToLoad.Clear();
+                        error("%s: Missing records in %s", __func__, strFilename);
+                        return IncorrectFormat;
+                    }
+                }
+                catch (std::exception &e) {
+                    objToLoad.Clear();
+                    error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                    return IncorrectFormat;
+                }
+                break;
+            }
+        }
+
         LogPrintf("Loaded info from %s  %dms\n", strFilename, GetTimeMillis() - nStart);
         LogPrintf("     %s\n", objToLoad.ToString());
-        if(!fDryRun) {
-            LogPrintf("%s: Cleaning....\n", __func__);
-            objToLoad.CheckAndRemove();
-            LogPrintf("     %s\n", objToLoad.ToString());
-        }
+        LogPrintf("%s: Cleaning....\n", __func__);
+        objToLoad.CheckAndRemove();
+        LogPrintf("     %s\n", objToLoad.ToString());
 
         return Ok;
     }
 
 
 public:
-    CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn)
+    CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn) :
+        pathDB(GetDataDir() / strFilenameIn),
+        strFilename(strFilenameIn),
+        strMagicMessage(strMagicMessageIn),
+        log(pathDB, strMagicMessageIn)
     {
-        pathDB = GetDataDir() / strFilenameIn;
-        strFilename = strFilenameIn;
-        strMagicMessage = strMagicMessageIn;
     }
 
     bool Load(T& objToLoad)
@@ -193,32 +389,43 @@ public:
         return true;
     }
 
-    bool Dump(T& objToSave)
+    bool Dump(const T& objToSave)
     {
         int64_t nStart = GetTimeMillis();
 
-        LogPrintf("Verifying %s format...\n", strFilename);
-        T tmpObjToLoad;
-        ReadResult readResult = Read(tmpObjToLoad, true);
-
-        // there was an error and it was not an error on file opening => do not proceed
-        if (readResult == FileError)
-            LogPrintf("Missing file %s, will try to recreate\n", strFilename);
-        else if (readResult != Ok)
-        {
-            LogPrintf("Error reading %s: ", strFilename);
-            if(readResult == IncorrectFormat)
-                LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
-            else
+        if (!log.IsOpen()) {
+            // only the record headers are needed to tell what changed
+            CFlatDBLog::OpenResult openResult = log.Open(false);
+            if (openResult == CFlatDBLog::Missing)
+                LogPrintf("Missing file %s, will try to recreate\n", strFilename);
+            else if (openResult == CFlatDBLog::Legacy)
+                LogPrintf("Converting %s to a record log\n", strFilename);
+            else if (openResult != CFlatDBLog::Ok)
             {
-                LogPrintf("%s: File format is unknown or invalid, please fix it manually\n", __func__);
-                return false;
+                LogPrintf("Error reading %s: ", strFilename);
+                if(openResult == CFlatDBLog::IncorrectFormat)
+                    LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
+                else
+                {
+                    LogPrintf("%s: File format is unknown or invalid, please fix it manually\n", __func__);
+                    return false;
+                }
             }
         }
 
-        LogPrintf("Writing info to %s...\n", strFilename);
-        Write(objToSave);
-        LogPrintf("%s dump finished  %dms\n", strFilename, GetTimeMillis() - nStart);
+        // the object holds its own locks while its records are serialized,
+        // they are hashed and nothing is written to disk before they are released
+        CFlatDBWriter writer(log);
+        WriteFlatDBRecords(objToSave, writer);
+        writer.Finish();
+
+        int nWritten, nErased;
+        if (!log.Commit(writer, nWritten, nErased))
+            return error("%s: Failed to write %s", __func__, strFilename);
+
+        LogPrintf("Written info to %s: %d records written, %d erased, %d of %d bytes live  %dms\n",
+                strFilename, nWritten, nErased, log.GetLiveSize(), log.GetFileSize(), GetTimeMillis() - nStart);
+        LogPrintf("     %s\n", objToSave.ToString());
 
         return true;
     }
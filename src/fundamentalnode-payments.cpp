@@ -4,6 +4,7 @@
 
 #include "activefundamentalnode.h"
 #include "consensus/validation.h"
+#include "flat-database.h"
 #include "governance-classes.h"
 #include "fundamentalnode-payments.h"
 #include "fundamentalnode-sync.h"
@@ -1049,6 +1050,37 @@ void CFundamentalnodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnma
     }
 }
 
+static const char DB_PAYMENT_VOTE = 'v';
+static const char DB_PAYMENT_BLOCK = 'b';
+
+void WriteFlatDBRecords(const CFundamentalnodePayments& payments, CFlatDBWriter& writer)
+{
+    LOCK2(cs_mapFundamentalnodeBlocks, cs_mapFundamentalnodePaymentVotes);
+
+    // Votes never change once stored, only the blocks that got new ones are written again
+    for (const auto& votepair : payments.mapFundamentalnodePaymentVotes) {
+        writer.Write(std::make_pair(DB_PAYMENT_VOTE, votepair.first), votepair.second);
+    }
+    for (const auto& blockpair : payments.mapFundamentalnodeBlocks) {
+        writer.Write(std::make_pair(DB_PAYMENT_BLOCK, blockpair.first), blockpair.second);
+    }
+}
+
+bool ReadFlatDBRecords(CFundamentalnodePayments& payments, CFlatDBReader& reader)
+{
+    LOCK2(cs_mapFundamentalnodeBlocks, cs_mapFundamentalnodePaymentVotes);
+
+    reader.ReadAll<std::pair<char, uint256>, CFundamentalnodePaymentVote>(DB_PAYMENT_VOTE,
+        [&payments](const std::pair<char, uint256>& key, const CFundamentalnodePaymentVote& vote) {
+            payments.mapFundamentalnodePaymentVotes.insert(std::make_pair(key.second, vote));
+        });
+    reader.ReadAll<std::pair<char, int>, CFundamentalnodeBlockPayees>(DB_PAYMENT_BLOCK,
+        [&payments](const std::pair<char, int>& key, const CFundamentalnodeBlockPayees& blockPayees) {
+            payments.mapFundamentalnodeBlocks.insert(std::make_pair(key.second, blockPayees));
+        });
+    return true;
+}
+
 std::string CFundamentalnodePayments::ToString() const
 {
     std::ostringstream info;
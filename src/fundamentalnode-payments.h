@@ -15,6 +15,8 @@
 class CFundamentalnodePayments;
 class CFundamentalnodePaymentVote;
 class CFundamentalnodeBlockPayees;
+class CFlatDBReader;
+class CFlatDBWriter;
 
 static const int FNPAYMENTS_SIGNATURES_REQUIRED         = 6;
 static const int FNPAYMENTS_SIGNATURES_TOTAL            = 10;
@@ -235,4 +237,8 @@ public:
 };
 
 
+/** Store every payment vote and payment block as a record of its own in fnpayments.dat */
+void WriteFlatDBRecords(const CFundamentalnodePayments& payments, CFlatDBWriter& writer);
+bool ReadFlatDBRecords(CFundamentalnodePayments& payments, CFlatDBReader& reader);
+
 #endif
@@ -12,6 +12,7 @@
 #include "fundamentalnode-sync.h"
 #include "fundamentalnodeman.h"
 #include "messagesigner.h"
+#include "netmessagemaker.h"
 #include "script/standard.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
@@ -41,7 +42,8 @@ CFundamentalnode::CFundamentalnode(const CFundamentalnode& other) :
     nPoSeBanScore(other.nPoSeBanScore),
     nPoSeBanHeight(other.nPoSeBanHeight),
     fAllowMixingTx(other.fAllowMixingTx),
-    fUnitTest(other.fUnitTest)
+    fUnitTest(other.fUnitTest),
+    relayCache(other.relayCache)
 {}
 
 CFundamentalnode::CFundamentalnode(const CFundamentalnodeBroadcast& fnb) :
@@ -287,6 +289,39 @@ fundamentalnode_info_t CFundamentalnode::GetInfo() const
     return info;
 }
 
+static bool IsSamePing(const CFundamentalnodePing& a, const CFundamentalnodePing& b)
+{
+    return a.fundamentalnodeOutpoint == b.fundamentalnodeOutpoint && a.blockHash == b.blockHash &&
+           a.sigTime == b.sigTime && a.vchSig == b.vchSig && a.fSentinelIsCurrent == b.fSentinelIsCurrent &&
+           a.nSentinelVersion == b.nSentinelVersion && a.nDaemonVersion == b.nDaemonVersion;
+}
+
+std::shared_ptr<const CFundamentalnodeRelayCache> CFundamentalnode::GetRelayCache() const
+{
+    bool fNewSigs = sporkManager.IsSporkActive(SPORK_6_NEW_SIGS);
+
+    LOCK(cs);
+    // A new announcement always comes with a later sigTime and its own signature
+    if (relayCache && relayCache->sigTime == sigTime && relayCache->vchSig == vchSig &&
+            relayCache->fNewSigs == fNewSigs && IsSamePing(relayCache->lastPing, lastPing))
+        return relayCache;
+
+    CFundamentalnodeBroadcast mnb(*this);
+    std::shared_ptr<CFundamentalnodeRelayCache> cache = std::make_shared<CFundamentalnodeRelayCache>();
+    cache->sigTime = sigTime;
+    cache->vchSig = vchSig;
+    cache->lastPing = lastPing;
+    cache->fNewSigs = fNewSigs;
+    cache->hashBroadcast = mnb.GetHash();
+    cache->hashPing = lastPing.GetHash();
+    cache->nSendVersion = PROTOCOL_VERSION;
+    CNetMsgMaker msgMaker(cache->nSendVersion);
+    cache->msgBroadcast = CConnman::ShareMessage(msgMaker.Make(NetMsgType::FNANNOUNCE, mnb));
+    cache->msgPing = CConnman::ShareMessage(msgMaker.Make(NetMsgType::FNPING, lastPing));
+    relayCache = cache;
+    return relayCache;
+}
+
 std::string CFundamentalnode::StateToString(int nStateIn)
 {
     switch(nStateIn) {
@@ -313,46 +348,6 @@ std::string CFundamentalnode::GetStatus() const
     return GetStateString();
 }
 
-void CFundamentalnode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack)
-{
-    if(!pindex) return;
-
-    const CBlockIndex *BlockReading = pindex;
-
-    CScript fnpayee = GetScriptForDestination(pubKeyCollateralAddress.GetID());
-
-    LOCK(cs_mapFundamentalnodeBlocks);
-
-    for (int i = 0; BlockReading && BlockReading->nHeight > nBlockLastPaid && i < nMaxBlocksToScanBack; i++) {
-        if(fnpayments.mapFundamentalnodeBlocks.count(BlockReading->nHeight) &&
-           fnpayments.mapFundamentalnodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(fnpayee, 2))
-        {
-            CBlock block;
-            if(!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
-                continue;
-
-            const auto& coinbaseTransaction = (BlockReading->nHeight > Params().GetConsensus().nLastPoWBlock ? block.vtx[1] : block.vtx[0]);
-
-            CAmount nFundamentalnodePayment = GetFundamentalnodePayment(BlockReading->nHeight, BlockReading->nMint);
-
-            for(const CTxOut &txout : coinbaseTransaction->vout)
-                if(fnpayee == txout.scriptPubKey && nFundamentalnodePayment == txout.nValue) {
-                    nBlockLastPaid = BlockReading->nHeight;
-                    nTimeLastPaid = BlockReading->nTime;
-                    LogPrint("fnpayments", "CFundamentalnode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", outpoint.ToStringShort(), nBlockLastPaid);
-                    return;
-                }
-        }
-
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
-
-    // Last payment for this fundamentalnode wasn't found in latest fnpayments blocks
-    // or it was found in fnpayments blocks but wasn't found in the blockchain.
-    // LogPrint(BCLog::FUNDAMENTALNODE, "CFundamentalnode::UpdateLastPaidBlock -- searching for block with payment to %s -- keeping old %d\n", vin.prevout.ToString(), nBlockLastPaid);
-}
-
 #ifdef ENABLE_WALLET
 bool CFundamentalnodeBroadcast::Create(const std::string& strService, const std::string& strKeyFundamentalnode, const std::string& strTxHash, const std::string& strOutputIndex, std::string& strErrorRet, CFundamentalnodeBroadcast &fnbRet, bool fOffline)
 {
@@ -8,6 +8,7 @@
 #include "key.h"
 #include "validation.h"
 #include "spork.h"
+#include "net.h"
 
 class CFundamentalnode;
 class CFundamentalnodeBroadcast;
@@ -152,6 +153,26 @@ struct fundamentalnode_info_t
     bool fInfoValid = false; //* not in CMN
 };
 
+/** Hashes and network serializations of a fundamentalnode's announcement and last
+ * ping as handed out for list sync. Rebuilt by CFundamentalnode::GetRelayCache()
+ * only once the signed announcement, the ping or the spork deciding the ping
+ * hash changed, so serving the list is inventory emission from this cache. */
+struct CFundamentalnodeRelayCache
+{
+    // what the cache was built from
+    int64_t sigTime;
+    std::vector<unsigned char> vchSig;
+    CFundamentalnodePing lastPing;
+    bool fNewSigs;
+
+    uint256 hashBroadcast;
+    uint256 hashPing;
+    // messages serialized for nSendVersion, peers on other versions are served as before
+    int nSendVersion;
+    CSharedNetMsg msgBroadcast;
+    CSharedNetMsg msgPing;
+};
+
 //
 // The Fundamentalnode Class. For managing the Darksend process. It contains the input of the 1000DRK, signature to prove
 // it's the one who own that ip address and code for calculating the payment election.
@@ -195,6 +216,12 @@ public:
     // KEEP TRACK OF GOVERNANCE ITEMS EACH FUNDAMENTALNODE HAS VOTE UPON FOR RECALCULATION
     std::map<uint256, int> mapGovernanceObjectsVotedOn;
 
+private:
+    // see GetRelayCache(), protected by cs
+    mutable std::shared_ptr<const CFundamentalnodeRelayCache> relayCache;
+
+public:
+
     CFundamentalnode();
     CFundamentalnode(const CFundamentalnode& other);
     CFundamentalnode(const CFundamentalnodeBroadcast& fnb);
@@ -302,13 +329,21 @@ public:
 
     fundamentalnode_info_t GetInfo() const;
 
+    /// Hashes and relay messages of the current announcement and ping
+    std::shared_ptr<const CFundamentalnodeRelayCache> GetRelayCache() const;
+
     static std::string StateToString(int nStateIn);
     std::string GetStateString() const;
     std::string GetStatus() const;
 
     int GetLastPaidTime() const { return nTimeLastPaid; }
     int GetLastPaidBlock() const { return nBlockLastPaid; }
-    void UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack);
+    void UpdateLastPaid(int nBlockLastPaidIn, int64_t nTimeLastPaidIn)
+    {
+        if(nBlockLastPaidIn <= nBlockLastPaid) return;
+        nBlockLastPaid = nBlockLastPaidIn;
+        nTimeLastPaid = nTimeLastPaidIn;
+    }
 
     // KEEP TRACK OF EACH GOVERNANCE ITEM INCASE THIS NODE GOES OFFLINE, SO WE CAN RECALC THEIR STATUS
     void AddGovernanceVote(uint256 nGovernanceObjectHash);
@@ -329,6 +364,7 @@ public:
         fAllowMixingTx = from.fAllowMixingTx;
         fUnitTest = from.fUnitTest;
         mapGovernanceObjectsVotedOn = from.mapGovernanceObjectsVotedOn;
+        relayCache = from.relayCache;
         return *this;
     }
 };
@@ -24,8 +24,7 @@
 /** Fundamentalnode manager */
 CFundamentalnodeMan fnodeman;
 
-const std::string CFundamentalnodeMan::SERIALIZATION_VERSION_STRING = "CFundamentalnodeMan-Version-8";
-const int CFundamentalnodeMan::LAST_PAID_SCAN_BLOCKS = 100;
+const std::string CFundamentalnodeMan::SERIALIZATION_VERSION_STRING = "CFundamentalnodeMan-Version-9";
 
 struct CompareLastPaidBlock
 {
@@ -69,6 +68,9 @@ CFundamentalnodeMan::CFundamentalnodeMan():
     fFundamentalnodesRemoved(false),
     vecDirtyGovernanceObjectHashes(),
     nLastSentinelPingTime(0),
+    mapRankCache(RANK_CACHE_SIZE),
+    nRankCacheHits(0),
+    nRankCacheMisses(0),
     mapSeenFundamentalnodeBroadcast(),
     mapSeenFundamentalnodePing(),
     nDsqCount(0)
@@ -83,6 +85,7 @@ bool CFundamentalnodeMan::Add(CFundamentalnode &fn)
     LogPrint("fundamentalnode", "CFundamentalnodeMan::Add -- Adding new Fundamentalnode: addr=%s, %i now\n", fn.addr.ToString(), size() + 1);
     mapFundamentalnodes[fn.outpoint] = fn;
     fFundamentalnodesAdded = true;
+    InvalidateRankCache();
     return true;
 }
 
@@ -205,6 +208,7 @@ void CFundamentalnodeMan::CheckAndRemove(CConnman& connman)
                 it->second.FlagGovernanceItemsAsDirty();
                 mapFundamentalnodes.erase(it++);
                 fFundamentalnodesRemoved = true;
+                InvalidateRankCache();
             } else {
                 bool fAsk = (nAskForFnbRecovery > 0) &&
                             fundamentalnodeSync.IsSynced() &&
@@ -360,6 +364,8 @@ void CFundamentalnodeMan::Clear()
 {
     LOCK(cs);
     mapFundamentalnodes.clear();
+    mapPayeeLastPaid.clear();
+    InvalidateRankCache();
     mAskedUsForFundamentalnodeList.clear();
     mWeAskedForFundamentalnodeList.clear();
     mWeAskedForFundamentalnodeListEntry.clear();
@@ -653,6 +659,54 @@ bool CFundamentalnodeMan::GetFundamentalnodeScores(const uint256& nBlockHash, CF
     return !vecFundamentalnodeScoresRet.empty();
 }
 
+CFundamentalnodeMan::rank_table_ptr_t CFundamentalnodeMan::GetRankTable(const uint256& nBlockHash, int nMinProtocol)
+{
+    AssertLockHeld(cs);
+
+    const std::pair<uint256, int> key = std::make_pair(nBlockHash, nMinProtocol);
+    rank_table_ptr_t pRankTable;
+    if (mapRankCache.Get(key, pRankTable)) {
+        // re-insert to move it to the front, so the least recently used table is evicted first
+        mapRankCache.Erase(key);
+        mapRankCache.Insert(key, pRankTable);
+        nRankCacheHits++;
+        return pRankTable;
+    }
+    nRankCacheMisses++;
+
+    score_pair_vec_t vecFundamentalnodeScores;
+    if (!GetFundamentalnodeScores(nBlockHash, vecFundamentalnodeScores, nMinProtocol))
+        return nullptr;
+
+    std::shared_ptr<CRankTable> pNewRankTable = std::make_shared<CRankTable>();
+    pNewRankTable->vecOutpoints.reserve(vecFundamentalnodeScores.size());
+    pNewRankTable->mapRanks.reserve(vecFundamentalnodeScores.size());
+    int nRank = 0;
+    for (const auto& scorePair : vecFundamentalnodeScores) {
+        nRank++;
+        pNewRankTable->vecOutpoints.push_back(scorePair.second->outpoint);
+        pNewRankTable->mapRanks.emplace(scorePair.second->outpoint, nRank);
+    }
+
+    pRankTable = pNewRankTable;
+    mapRankCache.Insert(key, pRankTable);
+    return pRankTable;
+}
+
+void CFundamentalnodeMan::InvalidateRankCache()
+{
+    AssertLockHeld(cs);
+    mapRankCache.Clear();
+}
+
+void CFundamentalnodeMan::GetRankCacheStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nSizeRet)
+{
+    LOCK(cs);
+    nHitsRet = nRankCacheHits;
+    nMissesRet = nRankCacheMisses;
+    nSizeRet = mapRankCache.GetSize();
+}
+
 bool CFundamentalnodeMan::GetFundamentalnodeRank(const COutPoint& outpoint, int& nRankRet, int nBlockHeight, int nMinProtocol)
 {
     nRankRet = -1;
@@ -669,20 +723,16 @@ bool CFundamentalnodeMan::GetFundamentalnodeRank(const COutPoint& outpoint, int&
 
     LOCK(cs);
 
-    score_pair_vec_t vecFundamentalnodeScores;
-    if (!GetFundamentalnodeScores(nBlockHash, vecFundamentalnodeScores, nMinProtocol))
+    rank_table_ptr_t pRankTable = GetRankTable(nBlockHash, nMinProtocol);
+    if (!pRankTable)
         return false;
 
-    int nRank = 0;
-    for (const auto& scorePair : vecFundamentalnodeScores) {
-        nRank++;
-        if(scorePair.second->outpoint == outpoint) {
-            nRankRet = nRank;
-            return true;
-        }
-    }
+    auto it = pRankTable->mapRanks.find(outpoint);
+    if (it == pRankTable->mapRanks.end())
+        return false;
 
-    return false;
+    nRankRet = it->second;
+    return true;
 }
 
 bool CFundamentalnodeMan::GetFundamentalnodeRanks(CFundamentalnodeMan::rank_pair_vec_t& vecFundamentalnodeRanksRet, int nBlockHeight, int nMinProtocol)
@@ -701,14 +751,18 @@ bool CFundamentalnodeMan::GetFundamentalnodeRanks(CFundamentalnodeMan::rank_pair
 
     LOCK(cs);
 
-    score_pair_vec_t vecFundamentalnodeScores;
-    if (!GetFundamentalnodeScores(nBlockHash, vecFundamentalnodeScores, nMinProtocol))
+    rank_table_ptr_t pRankTable = GetRankTable(nBlockHash, nMinProtocol);
+    if (!pRankTable)
         return false;
 
+    vecFundamentalnodeRanksRet.reserve(pRankTable->vecOutpoints.size());
     int nRank = 0;
-    for (const auto& scorePair : vecFundamentalnodeScores) {
+    for (const auto& outpoint : pRankTable->vecOutpoints) {
         nRank++;
-        vecFundamentalnodeRanksRet.push_back(std::make_pair(nRank, *scorePair.second));
+        // the cache is invalidated on every list change, so every ranked outpoint is still known
+        auto it = mapFundamentalnodes.find(outpoint);
+        assert(it != mapFundamentalnodes.end());
+        vecFundamentalnodeRanksRet.push_back(std::make_pair(nRank, it->second));
     }
 
     return true;
@@ -981,14 +1035,51 @@ void CFundamentalnodeMan::PushDsegFNInvs(CNode* pnode, const CFundamentalnode& f
 {
     AssertLockHeld(cs);
 
-    CFundamentalnodeBroadcast fnb(fn);
-    CFundamentalnodePing fnp = fnb.lastPing;
-    uint256 hashMNB = fnb.GetHash();
-    uint256 hashMNP = fnp.GetHash();
-    pnode->PushInventory(CInv(MSG_FUNDAMENTALNODE_ANNOUNCE, hashMNB));
-    pnode->PushInventory(CInv(MSG_FUNDAMENTALNODE_PING, hashMNP));
-    mapSeenFundamentalnodeBroadcast.insert(std::make_pair(hashMNB, std::make_pair(GetTime(), fnb)));
-    mapSeenFundamentalnodePing.insert(std::make_pair(hashMNP, fnp));
+    std::shared_ptr<const CFundamentalnodeRelayCache> cache = fn.GetRelayCache();
+    pnode->PushInventory(CInv(MSG_FUNDAMENTALNODE_ANNOUNCE, cache->hashBroadcast));
+    pnode->PushInventory(CInv(MSG_FUNDAMENTALNODE_PING, cache->hashPing));
+    // Keep both answerable by getdata; only copy them in when they are not already
+    if (!mapSeenFundamentalnodeBroadcast.count(cache->hashBroadcast))
+        mapSeenFundamentalnodeBroadcast.insert(std::make_pair(cache->hashBroadcast, std::make_pair(GetTime(), CFundamentalnodeBroadcast(fn))));
+    if (!mapSeenFundamentalnodePing.count(cache->hashPing))
+        mapSeenFundamentalnodePing.insert(std::make_pair(cache->hashPing, fn.lastPing));
+}
+
+bool CFundamentalnodeMan::GetRelayMessage(const CInv& inv, int nSendVersion, CSharedNetMsg& msgRet)
+{
+    LOCK(cs);
+
+    COutPoint outpoint;
+    if (inv.type == MSG_FUNDAMENTALNODE_ANNOUNCE) {
+        auto it = mapSeenFundamentalnodeBroadcast.find(inv.hash);
+        if (it == mapSeenFundamentalnodeBroadcast.end())
+            return false;
+        outpoint = it->second.second.outpoint;
+    } else if (inv.type == MSG_FUNDAMENTALNODE_PING) {
+        auto it = mapSeenFundamentalnodePing.find(inv.hash);
+        if (it == mapSeenFundamentalnodePing.end())
+            return false;
+        outpoint = it->second.fundamentalnodeOutpoint;
+    } else {
+        return false;
+    }
+
+    auto itFn = mapFundamentalnodes.find(outpoint);
+    if (itFn == mapFundamentalnodes.end())
+        return false;
+    // Only the current announcement and ping are cached, older ones are served from the seen maps
+    std::shared_ptr<const CFundamentalnodeRelayCache> cache = itFn->second.GetRelayCache();
+    if (cache->nSendVersion != nSendVersion)
+        return false;
+    if (inv.type == MSG_FUNDAMENTALNODE_ANNOUNCE && cache->hashBroadcast == inv.hash) {
+        msgRet = cache->msgBroadcast;
+        return true;
+    }
+    if (inv.type == MSG_FUNDAMENTALNODE_PING && cache->hashPing == inv.hash) {
+        msgRet = cache->msgPing;
+        return true;
+    }
+    return false;
 }
 
 // Verification of fundamentalnodes via unique direct requests.
@@ -1556,7 +1647,10 @@ bool CFundamentalnodeMan::CheckFnbAndUpdateFundamentalnodeList(CNode* pfrom, CFu
         CFundamentalnode* pfn = Find(fnb.outpoint);
         if(pfn) {
             CFundamentalnodeBroadcast fnbOld = mapSeenFundamentalnodeBroadcast[CFundamentalnodeBroadcast(*pfn).GetHash()].second;
-            if(!fnb.Update(pfn, nDos, connman)) {
+            // a newer broadcast can change the protocol version this fundamentalnode is ranked under
+            bool fUpdated = fnb.Update(pfn, nDos, connman);
+            InvalidateRankCache();
+            if(!fUpdated) {
                 LogPrint("fundamentalnode", "CFundamentalnodeMan::CheckFnbAndUpdateFundamentalnodeList -- Update() failed, fundamentalnode=%s\n", fnb.outpoint.ToStringShort());
                 return false;
             }
@@ -1598,21 +1692,78 @@ void CFundamentalnodeMan::UpdateLastPaid(const CBlockIndex* pindex)
 {
     LOCK(cs);
 
-    if(fLiteMode || !fundamentalnodeSync.IsWinnersListSynced() || mapFundamentalnodes.empty()) return;
+    if(fLiteMode || !pindex || !fundamentalnodeSync.IsWinnersListSynced() || mapFundamentalnodes.empty()) return;
 
-    static int nLastRunBlockHeight = 0;
-    // Scan at least LAST_PAID_SCAN_BLOCKS but no more than fnpayments.GetStorageLimit()
-    int nMaxBlocksToScanBack = std::max(LAST_PAID_SCAN_BLOCKS, nCachedBlockHeight - nLastRunBlockHeight);
-    nMaxBlocksToScanBack = std::min(nMaxBlocksToScanBack, fnpayments.GetStorageLimit());
+    PruneLastPaid(pindex->nHeight);
 
-    LogPrint("fundamentalnode", "CFundamentalnodeMan::UpdateLastPaid -- nCachedBlockHeight=%d, nLastRunBlockHeight=%d, nMaxBlocksToScanBack=%d\n",
-                            nCachedBlockHeight, nLastRunBlockHeight, nMaxBlocksToScanBack);
+    LogPrint("fundamentalnode", "CFundamentalnodeMan::UpdateLastPaid -- nHeight=%d, payees=%d\n", pindex->nHeight, mapPayeeLastPaid.size());
+
+    LOCK(cs_mapFundamentalnodeBlocks);
 
     for (auto& fnpair : mapFundamentalnodes) {
-        fnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+        CScript fnpayee = GetScriptForDestination(fnpair.second.pubKeyCollateralAddress.GetID());
+        auto it = mapPayeeLastPaid.find(fnpayee);
+        if(it == mapPayeeLastPaid.end()) continue;
+        // newest payment that is still part of the chain ending at pindex
+        for (auto itPaid = it->second.rbegin(); itPaid != it->second.rend(); ++itPaid) {
+            if(itPaid->first > pindex->nHeight) continue;
+            const CBlockIndex* pindexPaid = pindex->GetAncestor(itPaid->first);
+            if(!pindexPaid || pindexPaid->GetBlockHash() != itPaid->second) continue;
+            // only count payments to the payee the network voted for at that height
+            if(!fnpayments.mapFundamentalnodeBlocks.count(itPaid->first) ||
+               !fnpayments.mapFundamentalnodeBlocks[itPaid->first].HasPayeeWithVotes(fnpayee, 2)) continue;
+            fnpair.second.UpdateLastPaid(pindexPaid->nHeight, pindexPaid->nTime);
+            break;
+        }
     }
+}
 
-    nLastRunBlockHeight = nCachedBlockHeight;
+void CFundamentalnodeMan::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
+{
+    if(fLiteMode || !pindex || posInBlock == CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK) return;
+
+    // Fundamentalnodes are paid by the coinstake, or by the coinbase during PoW
+    int nPaymentPos = pindex->nHeight > Params().GetConsensus().nLastPoWBlock ? 1 : 0;
+    if(posInBlock != nPaymentPos) return;
+
+    CAmount nFundamentalnodePayment = GetFundamentalnodePayment(pindex->nHeight, pindex->nMint);
+
+    LOCK(cs);
+    // Record every fundamentalnode amount paid to a key, known fundamentalnode or not: the list is
+    // empty during IBD and until it syncs. UpdateLastPaid only reads the entries of
+    // listed fundamentalnodes and checks them against the payment votes.
+    for (const CTxOut& txout : tx.vout) {
+        if(txout.nValue != nFundamentalnodePayment || !txout.scriptPubKey.IsPayToPublicKeyHash()) continue;
+        std::vector<std::pair<int, uint256> >& vecPaid = mapPayeeLastPaid[txout.scriptPubKey];
+        // anything at or above this height belongs to a disconnected block
+        while(!vecPaid.empty() && vecPaid.back().first >= pindex->nHeight) {
+            vecPaid.pop_back();
+        }
+        vecPaid.push_back(std::make_pair(pindex->nHeight, pindex->GetBlockHash()));
+        if(vecPaid.size() > LAST_PAID_HISTORY) {
+            vecPaid.erase(vecPaid.begin());
+        }
+    }
+
+    // keep the index to the payment storage window while nothing calls UpdateLastPaid
+    if(pindex->nHeight % fnpayments.GetStorageLimit() == 0) {
+        PruneLastPaid(pindex->nHeight);
+    }
+}
+
+void CFundamentalnodeMan::PruneLastPaid(int nHeight)
+{
+    AssertLockHeld(cs);
+
+    // Forget payees that were not paid within the payment storage window
+    int nMinHeight = nHeight - fnpayments.GetStorageLimit();
+    for (auto it = mapPayeeLastPaid.begin(); it != mapPayeeLastPaid.end(); ) {
+        if(it->second.back().first < nMinHeight) {
+            mapPayeeLastPaid.erase(it++);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void CFundamentalnodeMan::UpdateLastSentinelPingTime()
@@ -5,6 +5,7 @@
 #ifndef FUNDAMENTALNODEMAN_H
 #define FUNDAMENTALNODEMAN_H
 
+#include "cachemap.h"
 #include "fundamentalnode.h"
 #include "sync.h"
 
@@ -21,12 +22,23 @@ public:
     typedef std::pair<int, const CFundamentalnode> rank_pair_t;
     typedef std::vector<rank_pair_t> rank_pair_vec_t;
 
+    /// Immutable rank order of the fundamentalnode list for one (block hash, min protocol) pair
+    struct CRankTable
+    {
+        // outpoints sorted by score, rank is index + 1
+        std::vector<COutPoint> vecOutpoints;
+        std::unordered_map<COutPoint, int, SaltedOutpointHasher> mapRanks;
+    };
+    typedef std::shared_ptr<const CRankTable> rank_table_ptr_t;
+
 private:
     static const std::string SERIALIZATION_VERSION_STRING;
 
     static const int DSEGFN_UPDATE_SECONDS        = 3 * 60 * 60;
 
-    static const int LAST_PAID_SCAN_BLOCKS;
+    static const size_t LAST_PAID_HISTORY      = 4;
+
+    static const int RANK_CACHE_SIZE            = 16;
 
     static const int MIN_POSE_PROTO_VERSION     = 70203;
     static const int MAX_POSE_CONNECTIONS       = 10;
@@ -48,6 +60,9 @@ private:
 
     // map to hold all MNs
     std::map<COutPoint, CFundamentalnode> mapFundamentalnodes;
+    // payee -> (height, hash) of the last LAST_PAID_HISTORY blocks that paid it, oldest first
+    // (keyed by CScriptBase, the script itself only serializes through its base)
+    std::map<CScriptBase, std::vector<std::pair<int, uint256> > > mapPayeeLastPaid;
     // who's asked for the Fundamentalnode list and the last time
     std::map<CService, int64_t> mAskedUsForFundamentalnodeList;
     // who we asked for the Fundamentalnode list and the last time
@@ -76,11 +91,22 @@ private:
 
     int64_t nLastSentinelPingTime;
 
+    // (block hash, min protocol) -> rank table, dropped whenever the fundamentalnode list changes
+    CacheMap<std::pair<uint256, int>, rank_table_ptr_t> mapRankCache;
+    uint64_t nRankCacheHits;
+    uint64_t nRankCacheMisses;
+
     friend class CFundamentalnodeSync;
     /// Find an entry
     CFundamentalnode* Find(const COutPoint& outpoint);
+    /// Drop payees last paid before the payment storage window ending at nHeight, requires cs
+    void PruneLastPaid(int nHeight);
 
     bool GetFundamentalnodeScores(const uint256& nBlockHash, score_pair_vec_t& vecFundamentalnodeScoresRet, int nMinProtocol = 0);
+    /// Get the cached rank table for a block, building it on a miss. Returns nullptr if there is nothing to rank.
+    rank_table_ptr_t GetRankTable(const uint256& nBlockHash, int nMinProtocol);
+    /// Must be called under cs whenever the set of fundamentalnodes or their protocol versions change
+    void InvalidateRankCache();
 
     void SyncSingle(CNode* pnode, const COutPoint& outpoint, CConnman& connman);
     void SyncAll(CNode* pnode, CConnman& connman);
@@ -123,7 +149,11 @@ public:
 
         READWRITE(mapSeenFundamentalnodeBroadcast);
         READWRITE(mapSeenFundamentalnodePing);
-        if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
+        // Version-8 files only lack the last paid index, keep the rest of their data
+        if(!ser_action.ForRead() || strVersion == SERIALIZATION_VERSION_STRING) {
+            READWRITE(mapPayeeLastPaid);
+        }
+        if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING && strVersion != "CFundamentalnodeMan-Version-8")) {
             Clear();
         }
     }
@@ -168,6 +198,9 @@ public:
     bool Get(const COutPoint& outpoint, CFundamentalnode& fundamentalnodeRet);
     bool Has(const COutPoint& outpoint);
 
+    /// Answer a getdata for an announcement or ping from the relay cache of its fundamentalnode
+    bool GetRelayMessage(const CInv& inv, int nSendVersion, CSharedNetMsg& msgRet);
+
     bool GetFundamentalnodeInfo(const COutPoint& outpoint, fundamentalnode_info_t& fnInfoRet);
     bool GetFundamentalnodeInfo(const CPubKey& pubKeyFundamentalnode, fundamentalnode_info_t& fnInfoRet);
     bool GetFundamentalnodeInfo(const CScript& payee, fundamentalnode_info_t& fnInfoRet);
@@ -184,6 +217,7 @@ public:
 
     bool GetFundamentalnodeRanks(rank_pair_vec_t& vecFundamentalnodeRanksRet, int nBlockHeight = -1, int nMinProtocol = 0);
     bool GetFundamentalnodeRank(const COutPoint &outpoint, int& nRankRet, int nBlockHeight = -1, int nMinProtocol = 0);
+    void GetRankCacheStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nSizeRet);
 
     void ProcessFundamentalnodeConnections(CConnman& connman);
     std::pair<CService, std::set<uint256> > PopScheduledFnbRequestConnection();
@@ -208,7 +242,10 @@ public:
     bool CheckFnbAndUpdateFundamentalnodeList(CNode* pfrom, CFundamentalnodeBroadcast fnb, int& nDos, CConnman& connman);
     bool IsFnbRecoveryRequested(const uint256& hash) { return mFnbRecoveryRequests.count(hash); }
 
+    /// Update last paid block of every fundamentalnode from the payee index, as seen from pindex
     void UpdateLastPaid(const CBlockIndex* pindex);
+    /// Record fundamentalnode payments of a connected block in the payee index
+    void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock);
 
     void AddDirtyGovernanceObjectHash(const uint256& nHash)
     {
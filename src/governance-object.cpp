@@ -16,6 +16,8 @@
 
 #include <univalue.h>
 
+bool fCheckVoteTally = DEFAULT_CHECK_VOTE_TALLY;
+
 CGovernanceObject::CGovernanceObject():
     cs(),
     nObjectType(GOVERNANCE_OBJECT_UNKNOWN),
@@ -37,8 +39,8 @@ CGovernanceObject::CGovernanceObject():
     fExpired(false),
     fUnparsable(false),
     mapCurrentMNVotes(),
-    cmmapOrphanVotes(),
-    fileVotes()
+    tallyCurrentMNVotes(),
+    cmmapOrphanVotes()
 {
     // PARSE JSON DATA STORAGE (VCHDATA)
     LoadData();
@@ -65,8 +67,8 @@ CGovernanceObject::CGovernanceObject(const uint256& nHashParentIn, int nRevision
     fExpired(false),
     fUnparsable(false),
     mapCurrentMNVotes(),
-    cmmapOrphanVotes(),
-    fileVotes()
+    tallyCurrentMNVotes(),
+    cmmapOrphanVotes()
 {
     // PARSE JSON DATA STORAGE (VCHDATA)
     LoadData();
@@ -93,8 +95,8 @@ CGovernanceObject::CGovernanceObject(const CGovernanceObject& other):
     fExpired(other.fExpired),
     fUnparsable(other.fUnparsable),
     mapCurrentMNVotes(other.mapCurrentMNVotes),
-    cmmapOrphanVotes(other.cmmapOrphanVotes),
-    fileVotes(other.fileVotes)
+    tallyCurrentMNVotes(other.tallyCurrentMNVotes),
+    cmmapOrphanVotes(other.cmmapOrphanVotes)
 {}
 
 bool CGovernanceObject::ProcessVote(CNode* pfrom,
@@ -105,7 +107,7 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
     LOCK(cs);
 
     // do not process already known valid votes twice
-    if (fileVotes.HasVote(vote.GetHash())) {
+    if (pgovvotedb->HaveVote(vote.GetHash())) {
         // nothing to do here, not an error
         std::ostringstream ostr;
         ostr << "CGovernanceObject::ProcessVote -- Already known valid vote";
@@ -147,8 +149,11 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
         exception = CGovernanceException(ostr.str(), GOVERNANCE_EXCEPTION_PERMANENT_ERROR, 20);
         return false;
     }
-    vote_instance_m_it it2 = voteRecordRef.mapInstances.emplace(vote_instance_m_t::value_type(int(eSignal), vote_instance_t())).first;
-    vote_instance_t& voteInstanceRef = it2->second;
+    auto instancepair = voteRecordRef.mapInstances.emplace(vote_instance_m_t::value_type(int(eSignal), vote_instance_t()));
+    vote_instance_t& voteInstanceRef = instancepair.first->second;
+    if(instancepair.second) {
+        tallyCurrentMNVotes.Add(eSignal, voteInstanceRef.eOutcome, 1);
+    }
 
     // Reject obsolete votes
     if(vote.GetTimestamp() < voteInstanceRef.nCreationTime) {
@@ -199,8 +204,19 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
         return false;
     }
 
+    if(!pgovvotedb->WriteVote(vote)) {
+        std::ostringstream ostr;
+        ostr << "CGovernanceObject::ProcessVote -- Unable to store vote"
+             << ", governance object hash = " << GetHash().ToString()
+             << ", vote hash = " << vote.GetHash().ToString();
+        LogPrintf("%s\n", ostr.str());
+        exception = CGovernanceException(ostr.str(), GOVERNANCE_EXCEPTION_TEMPORARY_ERROR);
+        return false;
+    }
+
+    tallyCurrentMNVotes.Add(eSignal, voteInstanceRef.eOutcome, -1);
     voteInstanceRef = vote_instance_t(vote.GetOutcome(), nVoteTimeUpdate, vote.GetTimestamp());
-    fileVotes.AddVote(vote);
+    tallyCurrentMNVotes.Add(eSignal, voteInstanceRef.eOutcome, 1);
     fDirtyCache = true;
     return true;
 }
@@ -212,7 +228,8 @@ void CGovernanceObject::ClearMasternodeVotes()
     vote_m_it it = mapCurrentMNVotes.begin();
     while(it != mapCurrentMNVotes.end()) {
         if(!mnodeman.Has(it->first)) {
-            fileVotes.RemoveVotesFromMasternode(it->first);
+            pgovvotedb->EraseVotes(GetHash(), &it->first);
+            tallyCurrentMNVotes.AddRecord(it->second, -1);
             mapCurrentMNVotes.erase(it++);
         }
         else {
@@ -632,10 +649,63 @@ bool CGovernanceObject::IsCollateralValid(std::string& strError, bool& fMissingC
     return true;
 }
 
+void CGovernanceObject::ClearVotes()
+{
+    LOCK(cs);
+
+    mapCurrentMNVotes.clear();
+    tallyCurrentMNVotes.Clear();
+    fDirtyCache = true;
+}
+
+void CGovernanceObject::RebuildVoteTally()
+{
+    LOCK(cs);
+
+    tallyCurrentMNVotes.Clear();
+    for (const auto& votepair : mapCurrentMNVotes) {
+        tallyCurrentMNVotes.AddRecord(votepair.second, 1);
+    }
+}
+
 int CGovernanceObject::CountMatchingVotes(vote_signal_enum_t eVoteSignalIn, vote_outcome_enum_t eVoteOutcomeIn) const
 {
     LOCK(cs);
 
+    if(!vote_tally_t::IsCounted(eVoteSignalIn, eVoteOutcomeIn)) {
+        return RecountMatchingVotes(eVoteSignalIn, eVoteOutcomeIn);
+    }
+
+    int nCount = tallyCurrentMNVotes.nCount[eVoteSignalIn][eVoteOutcomeIn];
+    if(fCheckVoteTally) {
+        int nRecount = RecountMatchingVotes(eVoteSignalIn, eVoteOutcomeIn);
+        if(nCount != nRecount) {
+            LogPrintf("CGovernanceObject::CountMatchingVotes -- tally %d does not match the recount %d, object %s, signal %d, outcome %d\n",
+                      nCount, nRecount, GetHash().ToString(), eVoteSignalIn, eVoteOutcomeIn);
+            assert(nCount == nRecount);
+        }
+    }
+    return nCount;
+}
+
+bool CGovernanceObject::CheckVoteTally() const
+{
+    LOCK(cs);
+
+    for(int nSignal = 0; nSignal <= MAX_SUPPORTED_VOTE_SIGNAL; nSignal++) {
+        for(int nOutcome = 0; nOutcome <= VOTE_OUTCOME_ABSTAIN; nOutcome++) {
+            if(tallyCurrentMNVotes.nCount[nSignal][nOutcome] != RecountMatchingVotes(vote_signal_enum_t(nSignal), vote_outcome_enum_t(nOutcome))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int CGovernanceObject::RecountMatchingVotes(vote_signal_enum_t eVoteSignalIn, vote_outcome_enum_t eVoteOutcomeIn) const
+{
+    LOCK(cs);
+
     int nCount = 0;
     for (const auto& votepair : mapCurrentMNVotes) {
         const vote_rec_t& recVote = votepair.second;
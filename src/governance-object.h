@@ -50,6 +50,12 @@ static const int SEEN_OBJECT_ERROR_IMMATURE = 2;
 static const int SEEN_OBJECT_EXECUTED = 3; //used for triggers
 static const int SEEN_OBJECT_UNKNOWN = 4; // the default
 
+//! Default for -checkvotetally
+static const bool DEFAULT_CHECK_VOTE_TALLY = false;
+
+/** Check every vote tally query against a recount of the vote records */
+extern bool fCheckVoteTally;
+
 typedef std::pair<CGovernanceVote, int64_t> vote_time_pair_t;
 
 inline bool operator<(const vote_time_pair_t& p1, const vote_time_pair_t& p2)
@@ -102,6 +108,49 @@ struct vote_rec_t {
      }
 };
 
+/**
+ * Number of current masternode votes for each signal and outcome of an object,
+ * kept in step with its vote records so that tally queries don't scan them
+ */
+struct vote_tally_t {
+    int nCount[MAX_SUPPORTED_VOTE_SIGNAL + 1][VOTE_OUTCOME_ABSTAIN + 1];
+
+    vote_tally_t()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        memset(nCount, 0, sizeof(nCount));
+    }
+
+    static bool IsCounted(int nSignal, int nOutcome)
+    {
+        return nSignal >= 0 && nSignal <= MAX_SUPPORTED_VOTE_SIGNAL &&
+               nOutcome >= 0 && nOutcome <= VOTE_OUTCOME_ABSTAIN;
+    }
+
+    void Add(int nSignal, int nOutcome, int nDelta)
+    {
+        if(IsCounted(nSignal, nOutcome)) {
+            nCount[nSignal][nOutcome] += nDelta;
+        }
+    }
+
+    void AddRecord(const vote_rec_t& recVote, int nDelta)
+    {
+        for (const auto& instancepair : recVote.mapInstances) {
+            Add(instancepair.first, instancepair.second.eOutcome, nDelta);
+        }
+    }
+};
+
+namespace governance_tally_tests
+{
+    class TestGovernanceObject;
+}
+
 /**
 * Governance Object
 *
@@ -112,6 +161,7 @@ class CGovernanceObject
     friend class CGovernanceManager;
     friend class CGovernanceTriggerManager;
     friend class CSuperblock;
+    friend class governance_tally_tests::TestGovernanceObject; // for test access to the vote handling
 
 public: // Types
     typedef std::map<COutPoint, vote_rec_t> vote_m_t;
@@ -182,11 +232,12 @@ private:
 
     vote_m_t mapCurrentMNVotes;
 
+    /// Tally of mapCurrentMNVotes, memory only
+    vote_tally_t tallyCurrentMNVotes;
+
     /// Limited map of votes orphaned by MN
     vote_cmm_t cmmapOrphanVotes;
 
-    CGovernanceObjectVoteFile fileVotes;
-
 public:
     CGovernanceObject();
 
@@ -246,10 +297,6 @@ public:
         fDirtyCache = true;
     }
 
-    const CGovernanceObjectVoteFile& GetVoteFile() const {
-        return fileVotes;
-    }
-
     // Signature related functions
 
     void SetMasternodeOutpoint(const COutPoint& outpoint);
@@ -344,12 +391,14 @@ public:
         }
         if(s.GetType() & SER_DISK) {
             // Only include these for the disk file format
-            LogPrint("gobject", "CGovernanceObject::SerializationOp Reading/writing votes from/to disk\n");
+            LogPrint("gobject", "CGovernanceObject::SerializationOp Reading/writing vote records from/to disk\n");
             READWRITE(nDeletionTime);
             READWRITE(fExpired);
+            // the votes themselves are kept in pgovvotedb
             READWRITE(mapCurrentMNVotes);
-            READWRITE(fileVotes);
-            LogPrint("gobject", "CGovernanceObject::SerializationOp hash = %s, vote count = %d\n", GetHash().ToString(), fileVotes.GetVoteCount());
+            if(ser_action.ForRead()) {
+                RebuildVoteTally();
+            }
         }
 
         // AFTER DESERIALIZATION OCCURS, CACHED VARIABLES MUST BE CALCULATED MANUALLY
@@ -366,6 +415,14 @@ private:
     void LoadData();
     void GetData(UniValue& objResult);
 
+    /// Forget all masternode votes, they are going to be received again
+    void ClearVotes();
+
+    void RebuildVoteTally();
+
+    /// Count by walking mapCurrentMNVotes, the tally must always match this
+    int RecountMatchingVotes(vote_signal_enum_t eVoteSignalIn, vote_outcome_enum_t eVoteOutcomeIn) const;
+
     bool ProcessVote(CNode* pfrom,
                      const CGovernanceVote& vote,
                      CGovernanceException& exception,
@@ -374,6 +431,9 @@ private:
     /// Called when MN's which have voted on this object have been removed
     void ClearMasternodeVotes();
 
+    /// Whether the tally of every signal and outcome matches a recount
+    bool CheckVoteTally() const;
+
     void CheckOrphanVotes(CConnman& connman);
 
 };
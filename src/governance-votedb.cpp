@@ -4,85 +4,180 @@
 
 #include "governance-votedb.h"
 
-CGovernanceObjectVoteFile::CGovernanceObjectVoteFile()
-    : nMemoryVotes(0),
-      listVotes(),
-      mapVoteIndex()
-{}
-
-CGovernanceObjectVoteFile::CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other)
-    : nMemoryVotes(other.nMemoryVotes),
-      listVotes(other.listVotes),
-      mapVoteIndex()
+#include "util.h"
+
+CGovernanceVoteDB* pgovvotedb = NULL;
+
+const char CGovernanceVoteDB::DB_VOTE;
+const char CGovernanceVoteDB::DB_OBJECT_VOTE;
+const char CGovernanceVoteDB::DB_SEQUENCE;
+const char CGovernanceVoteDB::DB_LAST_SEQUENCE;
+const char CGovernanceVoteDB::DB_VOTE_COUNT;
+
+CGovernanceVoteDB::CGovernanceVoteDB(size_t nCacheSize, bool fMemory, bool fWipe)
+    : CDBWrapper(GetDataDir() / "governance" / "votes", nCacheSize, fMemory, fWipe),
+      nLastSequence(0),
+      nVoteCount(0)
 {
-    RebuildIndex();
+    Read(DB_LAST_SEQUENCE, nLastSequence);
+    Read(DB_VOTE_COUNT, nVoteCount);
 }
 
-void CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
+bool CGovernanceVoteDB::WriteVote(const CGovernanceVote& vote)
 {
+    LOCK(cs);
+
     uint256 nHash = vote.GetHash();
     // make sure to never add/update already known votes
-    if (HasVote(nHash))
-        return;
-    listVotes.push_front(vote);
-    mapVoteIndex.emplace(nHash, listVotes.begin());
-    ++nMemoryVotes;
+    if(Exists(std::make_pair(DB_VOTE, nHash))) {
+        return true;
+    }
+
+    CGovernanceVoteKey key(vote.GetParentHash(), vote.GetMasternodeOutpoint(), nHash);
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_VOTE, nHash), key);
+    batch.Write(std::make_pair(DB_OBJECT_VOTE, key), vote);
+    batch.Write(std::make_pair(DB_SEQUENCE, CGovernanceVoteSequenceKey(nLastSequence + 1)), nHash);
+    batch.Write(DB_LAST_SEQUENCE, nLastSequence + 1);
+    batch.Write(DB_VOTE_COUNT, nVoteCount + 1);
+    if(!WriteBatch(batch)) {
+        return false;
+    }
+    ++nLastSequence;
+    ++nVoteCount;
+    return true;
 }
 
-bool CGovernanceObjectVoteFile::HasVote(const uint256& nHash) const
+bool CGovernanceVoteDB::HaveVote(const uint256& nHash) const
 {
-    return mapVoteIndex.find(nHash) != mapVoteIndex.end();
+    return Exists(std::make_pair(DB_VOTE, nHash));
 }
 
-bool CGovernanceObjectVoteFile::SerializeVoteToStream(const uint256& nHash, CDataStream& ss) const
+bool CGovernanceVoteDB::ReadVote(const uint256& nHash, CGovernanceVote& voteRet) const
 {
-    vote_m_cit it = mapVoteIndex.find(nHash);
-    if(it == mapVoteIndex.end()) {
+    CGovernanceVoteKey key;
+    return Read(std::make_pair(DB_VOTE, nHash), key) && Read(std::make_pair(DB_OBJECT_VOTE, key), voteRet);
+}
+
+bool CGovernanceVoteDB::EraseVoteKeys(const std::vector<CGovernanceVoteKey>& vecKeys)
+{
+    if(vecKeys.empty()) {
+        return true;
+    }
+
+    // sequence entries are left behind, they are pruned on the next start
+    CDBBatch batch(*this);
+    for(const auto& key : vecKeys) {
+        batch.Erase(std::make_pair(DB_VOTE, key.nHash));
+        batch.Erase(std::make_pair(DB_OBJECT_VOTE, key));
+    }
+    uint64_t nVoteCountNew = nVoteCount > vecKeys.size() ? nVoteCount - vecKeys.size() : 0;
+    batch.Write(DB_VOTE_COUNT, nVoteCountNew);
+    if(!WriteBatch(batch)) {
         return false;
     }
-    ss << *(it->second);
+    nVoteCount = nVoteCountNew;
     return true;
 }
 
-std::vector<CGovernanceVote> CGovernanceObjectVoteFile::GetVotes() const
+bool CGovernanceVoteDB::EraseVotes(const uint256& nParentHash, const COutPoint* pmasternodeOutpoint)
 {
-    std::vector<CGovernanceVote> vecResult;
-    for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
-        vecResult.push_back(*it);
+    LOCK(cs);
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    if(pmasternodeOutpoint) {
+        pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, std::make_pair(nParentHash, *pmasternodeOutpoint)));
+    } else {
+        pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, nParentHash));
     }
-    return vecResult;
+
+    std::vector<CGovernanceVoteKey> vecKeys;
+    while(pcursor->Valid()) {
+        std::pair<char, CGovernanceVoteKey> key;
+        if(!pcursor->GetKey(key) || key.first != DB_OBJECT_VOTE || key.second.nParentHash != nParentHash ||
+           (pmasternodeOutpoint && key.second.masternodeOutpoint != *pmasternodeOutpoint)) {
+            break;
+        }
+        vecKeys.push_back(key.second);
+        pcursor->Next();
+    }
+
+    return EraseVoteKeys(vecKeys);
 }
 
-void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const COutPoint& outpointMasternode)
+bool CGovernanceVoteDB::SyncWithObjects(uint64_t nSequence, const std::set<uint256>& setParents)
 {
-    vote_l_it it = listVotes.begin();
-    while(it != listVotes.end()) {
-        if(it->GetMasternodeOutpoint() == outpointMasternode) {
-            --nMemoryVotes;
-            mapVoteIndex.erase(it->GetHash());
-            listVotes.erase(it++);
+    LOCK(cs);
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<CGovernanceVoteKey> vecKeys;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    // Votes up to nSequence are part of the tallies, only later ones have to be dropped.
+    // Either way their sequence entries are no longer needed.
+    CDBBatch batch(*this);
+    std::set<uint256> setDiscarded;
+    pcursor->Seek(std::make_pair(DB_SEQUENCE, CGovernanceVoteSequenceKey(0)));
+    while(pcursor->Valid()) {
+        std::pair<char, CGovernanceVoteSequenceKey> key;
+        uint256 nHash;
+        if(!pcursor->GetKey(key) || key.first != DB_SEQUENCE || !pcursor->GetValue(nHash)) {
+            break;
         }
-        else {
-            ++it;
+        batch.Erase(key);
+        CGovernanceVoteKey voteKey;
+        if(key.second.nSequence > nSequence && Read(std::make_pair(DB_VOTE, nHash), voteKey)) {
+            vecKeys.push_back(voteKey);
+            setDiscarded.insert(nHash);
         }
+        pcursor->Next();
     }
-}
+    size_t nDiscarded = vecKeys.size();
 
-void CGovernanceObjectVoteFile::RebuildIndex()
-{
-    mapVoteIndex.clear();
-    nMemoryVotes = 0;
-    vote_l_it it = listVotes.begin();
-    while(it != listVotes.end()) {
-        CGovernanceVote& vote = *it;
-        uint256 nHash = vote.GetHash();
-        if(mapVoteIndex.find(nHash) == mapVoteIndex.end()) {
-            mapVoteIndex[nHash] = it;
-            ++nMemoryVotes;
-            ++it;
+    // Votes of objects that are gone, skipping over the objects that are still there
+    const COutPoint outpointLast(uint256S(std::string(64, 'f')), std::numeric_limits<uint32_t>::max());
+    uint256 nSkippedParent;
+    pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, uint256()));
+    while(pcursor->Valid()) {
+        std::pair<char, CGovernanceVoteKey> key;
+        if(!pcursor->GetKey(key) || key.first != DB_OBJECT_VOTE) {
+            break;
         }
-        else {
-            listVotes.erase(it++);
+        if(setParents.count(key.second.nParentHash)) {
+            if(key.second.nParentHash != nSkippedParent) {
+                nSkippedParent = key.second.nParentHash;
+                pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, std::make_pair(nSkippedParent, outpointLast)));
+                continue;
+            }
+        } else if(!setDiscarded.count(key.second.nHash)) {
+            vecKeys.push_back(key.second);
         }
+        pcursor->Next();
+    }
+
+    // The tallies count votes this database does not have if it was lost or
+    // wiped, nothing may get a sequence number they already cover either way
+    bool fComplete = nLastSequence >= nSequence;
+    if(!fComplete) {
+        nLastSequence = nSequence;
+        batch.Write(DB_LAST_SEQUENCE, nLastSequence);
     }
+    WriteBatch(batch);
+    EraseVoteKeys(vecKeys);
+
+    LogPrintf("Governance votes synced with objects: %d votes, dropped %d newer than the tallies and %d of removed objects  %dms\n",
+              nVoteCount, nDiscarded, vecKeys.size() - nDiscarded, GetTimeMillis() - nStart);
+    return fComplete;
+}
+
+uint64_t CGovernanceVoteDB::GetLastSequence() const
+{
+    LOCK(cs);
+    return nLastSequence;
+}
+
+int CGovernanceVoteDB::GetVoteCount() const
+{
+    LOCK(cs);
+    return (int)nVoteCount;
 }
@@ -5,88 +5,162 @@
 #ifndef GOVERNANCE_VOTEDB_H
 #define GOVERNANCE_VOTEDB_H
 
-#include <list>
-#include <map>
+#include <set>
+#include <vector>
 
+#include "dbwrapper.h"
 #include "governance-vote.h"
 #include "serialize.h"
 #include "streams.h"
+#include "sync.h"
 #include "uint256.h"
+#include "util.h"
 
-/**
- * Represents the collection of votes associated with a given CGovernanceObject
- * Recently received votes are held in memory until a maximum size is reached after
- * which older votes a flushed to a disk file.
- *
- * Note: This is a stub implementation that doesn't limit the number of votes held
- * in memory and doesn't flush to disk.
- */
-class CGovernanceObjectVoteFile
-{
-public: // Types
-    typedef std::list<CGovernanceVote> vote_l_t;
+#include <boost/thread.hpp>
 
-    typedef vote_l_t::iterator vote_l_it;
+class CGovernanceVoteDB;
 
-    typedef vote_l_t::const_iterator vote_l_cit;
+/** Governance votes on disk, the objects and their tallies stay in memory */
+extern CGovernanceVoteDB* pgovvotedb;
 
-    typedef std::map<uint256,vote_l_it> vote_m_t;
+/** Key of a vote: votes of an object, and of a masternode on it, are contiguous */
+struct CGovernanceVoteKey
+{
+    uint256 nParentHash;
+    COutPoint masternodeOutpoint;
+    uint256 nHash;
 
-    typedef vote_m_t::iterator vote_m_it;
+    CGovernanceVoteKey() {}
 
-    typedef vote_m_t::const_iterator vote_m_cit;
+    CGovernanceVoteKey(const uint256& nParentHashIn, const COutPoint& masternodeOutpointIn, const uint256& nHashIn) :
+        nParentHash(nParentHashIn),
+        masternodeOutpoint(masternodeOutpointIn),
+        nHash(nHashIn)
+        {}
 
-private:
-    static const int MAX_MEMORY_VOTES = -1;
+    ADD_SERIALIZE_METHODS;
 
-    int nMemoryVotes;
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nParentHash);
+        READWRITE(masternodeOutpoint);
+        READWRITE(nHash);
+    }
+};
 
-    vote_l_t listVotes;
+/** Order in which votes were written, big endian so that it sorts */
+struct CGovernanceVoteSequenceKey
+{
+    uint64_t nSequence;
 
-    vote_m_t mapVoteIndex;
+    CGovernanceVoteSequenceKey(uint64_t nSequenceIn = 0) : nSequence(nSequenceIn) {}
 
-public:
-    CGovernanceObjectVoteFile();
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata32be(s, nSequence >> 32);
+        ser_writedata32be(s, nSequence & 0xffffffff);
+    }
 
-    CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other);
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        nSequence = ((uint64_t)ser_readdata32be(s)) << 32;
+        nSequence |= ser_readdata32be(s);
+    }
+};
 
-    /**
-     * Add a vote to the file
-     */
-    void AddVote(const CGovernanceVote& vote);
+/**
+ * Votes of all governance objects, stored in governance/votes.
+ *
+ * Every vote written gets a sequence number. governance.dat records the last
+ * one its tallies include, so votes that were written after the last dump of
+ * governance.dat can be dropped on startup and fetched from peers again.
+ */
+class CGovernanceVoteDB : public CDBWrapper
+{
+private:
+    mutable CCriticalSection cs;
+    uint64_t nLastSequence;
+    uint64_t nVoteCount;
 
-    /**
-     * Return true if the vote with this hash is currently cached in memory
-     */
-    bool HasVote(const uint256& nHash) const;
+    CGovernanceVoteDB(const CGovernanceVoteDB&);
+    void operator=(const CGovernanceVoteDB&);
 
-    /**
-     * Retrieve a vote cached in memory
-     */
-    bool SerializeVoteToStream(const uint256& nHash, CDataStream& ss) const;
+    bool EraseVoteKeys(const std::vector<CGovernanceVoteKey>& vecKeys);
 
-    int GetVoteCount() {
-        return nMemoryVotes;
-    }
+public:
+    CGovernanceVoteDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    std::vector<CGovernanceVote> GetVotes() const;
+    bool WriteVote(const CGovernanceVote& vote);
+    bool HaveVote(const uint256& nHash) const;
+    bool ReadVote(const uint256& nHash, CGovernanceVote& voteRet) const;
 
-    void RemoveVotesFromMasternode(const COutPoint& outpointMasternode);
+    /** Erase the votes of an object, or only those of one masternode on it */
+    bool EraseVotes(const uint256& nParentHash, const COutPoint* pmasternodeOutpoint = NULL);
 
-    ADD_SERIALIZE_METHODS;
+    /**
+     * Read the votes of an object one by one, in key order. The callback
+     * returns false to stop.
+     */
+    template<typename Callback>
+    bool ForEachVote(const uint256& nParentHash, Callback callback) const
+    {
+        std::unique_ptr<CDBIterator> pcursor(const_cast<CGovernanceVoteDB*>(this)->NewIterator());
+        pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, nParentHash));
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, CGovernanceVoteKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_OBJECT_VOTE || key.second.nParentHash != nParentHash) {
+                break;
+            }
+            CGovernanceVote vote;
+            if (!pcursor->GetValue(vote)) {
+                return error("%s: failed to read vote %s", __func__, key.second.nHash.ToString());
+            }
+            if (!callback(vote)) {
+                break;
+            }
+            pcursor->Next();
+        }
+        return true;
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action)
+    /** Like ForEachVote, but only the hashes are needed and values are not read */
+    template<typename Callback>
+    void ForEachVoteHash(const uint256& nParentHash, Callback callback) const
     {
-        READWRITE(nMemoryVotes);
-        READWRITE(listVotes);
-        if(ser_action.ForRead()) {
-            RebuildIndex();
+        std::unique_ptr<CDBIterator> pcursor(const_cast<CGovernanceVoteDB*>(this)->NewIterator());
+        pcursor->Seek(std::make_pair(DB_OBJECT_VOTE, nParentHash));
+
+        while (pcursor->Valid()) {
+            std::pair<char, CGovernanceVoteKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_OBJECT_VOTE || key.second.nParentHash != nParentHash) {
+                break;
+            }
+            callback(key.second.nHash);
+            pcursor->Next();
         }
     }
-private:
-    void RebuildIndex();
 
+    /**
+     * Bring the votes in line with the objects and tallies loaded from
+     * governance.dat: drop votes written after nSequence and votes of objects
+     * that are not in setParents. Returns false if votes up to nSequence are
+     * missing, the tallies can not be trusted then.
+     */
+    bool SyncWithObjects(uint64_t nSequence, const std::set<uint256>& setParents);
+
+    uint64_t GetLastSequence() const;
+    int GetVoteCount() const;
+
+    static const char DB_VOTE = 'v';
+    static const char DB_OBJECT_VOTE = 'o';
+    static const char DB_SEQUENCE = 's';
+    static const char DB_LAST_SEQUENCE = 'S';
+    static const char DB_VOTE_COUNT = 'c';
 };
 
 #endif
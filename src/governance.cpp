@@ -8,6 +8,7 @@
 #include "governance-validators.h"
 #include "governance-vote.h"
 #include "governance-classes.h"
+#include "flat-database.h"
 #include "net_processing.h"
 #include "netmessagemaker.h"
 #include "masternode.h"
@@ -21,7 +22,7 @@ CGovernanceManager governance;
 
 int nSubmittedFinalBudget;
 
-const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-13";
+const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-14";
 const int CGovernanceManager::MAX_TIME_FUTURE_DEVIATION = 60*60;
 const int CGovernanceManager::RELIABLE_PROPAGATION_TIME = 60;
 
@@ -31,12 +32,12 @@ CGovernanceManager::CGovernanceManager()
       mapObjects(),
       mapErasedGovernanceObjects(),
       mapMasternodeOrphanObjects(),
-      cmapVoteToObject(MAX_CACHE_SIZE),
       cmapInvalidVotes(MAX_CACHE_SIZE),
       cmmapOrphanVotes(MAX_CACHE_SIZE),
       mapLastMasternodeObject(),
       setRequestedObjects(),
       fRateChecksEnabled(true),
+      nVoteSequence(0),
       cs()
 {}
 
@@ -62,24 +63,22 @@ bool CGovernanceManager::SerializeObjectForHash(const uint256& nHash, CDataStrea
 
 bool CGovernanceManager::HaveVoteForHash(const uint256& nHash) const
 {
-    LOCK(cs);
-
-    CGovernanceObject* pGovobj = NULL;
-    return cmapVoteToObject.Get(nHash, pGovobj) && pGovobj->GetVoteFile().HasVote(nHash);
+    return pgovvotedb->HaveVote(nHash);
 }
 
 int CGovernanceManager::GetVoteCount() const
 {
-    LOCK(cs);
-    return (int)cmapVoteToObject.GetSize();
+    return pgovvotedb->GetVoteCount();
 }
 
 bool CGovernanceManager::SerializeVoteForHash(const uint256& nHash, CDataStream& ss) const
 {
-    LOCK(cs);
-
-    CGovernanceObject* pGovobj = NULL;
-    return cmapVoteToObject.Get(nHash,pGovobj) && pGovobj->GetVoteFile().SerializeVoteToStream(nHash, ss);
+    CGovernanceVote vote;
+    if(!pgovvotedb->ReadVote(nHash, vote)) {
+        return false;
+    }
+    ss << vote;
+    return true;
 }
 
 void CGovernanceManager::ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman)
@@ -422,19 +421,8 @@ void CGovernanceManager::UpdateCachesAndClean()
             LogPrintf("CGovernanceManager::UpdateCachesAndClean -- erase obj %s\n", (*it).first.ToString());
             mnodeman.RemoveGovernanceObject(pObj->GetHash());
 
-            // Remove vote references
-            const object_ref_cm_t::list_t& listItems = cmapVoteToObject.GetItemList();
-            object_ref_cm_t::list_cit lit = listItems.begin();
-            while(lit != listItems.end()) {
-                if(lit->value == pObj) {
-                    uint256 nKey = lit->key;
-                    ++lit;
-                    cmapVoteToObject.Erase(nKey);
-                }
-                else {
-                    ++lit;
-                }
-            }
+            // Remove votes
+            pgovvotedb->EraseVotes(nHash);
 
             int64_t nTimeExpired{0};
 
@@ -488,15 +476,20 @@ CGovernanceObject* CGovernanceManager::FindGovernanceObject(const uint256& nHash
 
 std::vector<CGovernanceVote> CGovernanceManager::GetMatchingVotes(const uint256& nParentHash) const
 {
-    LOCK(cs);
     std::vector<CGovernanceVote> vecResult;
 
-    object_m_cit it = mapObjects.find(nParentHash);
-    if(it == mapObjects.end()) {
-        return vecResult;
+    {
+        LOCK(cs);
+        if(mapObjects.find(nParentHash) == mapObjects.end()) {
+            return vecResult;
+        }
     }
 
-    return it->second.GetVoteFile().GetVotes();
+    pgovvotedb->ForEachVote(nParentHash, [&vecResult](const CGovernanceVote& vote) {
+        vecResult.push_back(vote);
+        return true;
+    });
+    return vecResult;
 }
 
 std::vector<CGovernanceVote> CGovernanceManager::GetCurrentVotes(const uint256& nParentHash, const COutPoint& mnCollateralOutpointFilter) const
@@ -615,7 +608,7 @@ bool CGovernanceManager::ConfirmInventoryRequest(const CInv& inv)
     break;
     case MSG_GOVERNANCE_OBJECT_VOTE:
     {
-        if(cmapVoteToObject.HasKey(inv.hash)) {
+        if(pgovvotedb->HaveVote(inv.hash)) {
             LogPrint("gobject", "CGovernanceManager::ConfirmInventoryRequest already have governance vote, returning false\n");
             return false;
         }
@@ -683,11 +676,17 @@ void CGovernanceManager::SyncSingleObjAndItsVotes(CNode* pnode, const uint256& n
     LogPrint("gobject", "CGovernanceManager::%s -- syncing govobj: %s, peer=%d\n", __func__, strHash, pnode->id);
     pnode->PushInventory(CInv(MSG_GOVERNANCE_OBJECT, it->first));
 
-    auto fileVotes = govobj.GetVoteFile();
+    // Votes are read one at a time, those the peer already has are not even deserialized
+    std::vector<uint256> vecVoteHashes;
+    pgovvotedb->ForEachVoteHash(nProp, [&filter, &vecVoteHashes](const uint256& nVoteHash) {
+        if(!filter.contains(nVoteHash)) {
+            vecVoteHashes.push_back(nVoteHash);
+        }
+    });
 
-    for (const auto& vote : fileVotes.GetVotes()) {
-        uint256 nVoteHash = vote.GetHash();
-        if(filter.contains(nVoteHash) || !vote.IsValid(true)) {
+    for (const auto& nVoteHash : vecVoteHashes) {
+        CGovernanceVote vote;
+        if(!pgovvotedb->ReadVote(nVoteHash, vote) || !vote.IsValid(true)) {
             continue;
         }
         pnode->PushInventory(CInv(MSG_GOVERNANCE_OBJECT_VOTE, nVoteHash));
@@ -850,7 +849,7 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
     uint256 nHashVote = vote.GetHash();
     uint256 nHashGovobj = vote.GetParentHash();
 
-    if(cmapVoteToObject.HasKey(nHashVote)) {
+    if(pgovvotedb->HaveVote(nHashVote)) {
         LogPrint("gobject", "CGovernanceObject::ProcessVote -- skipping known valid vote %s for object %s\n", nHashVote.ToString(), nHashGovobj.ToString());
         LEAVE_CRITICAL_SECTION(cs);
         return false;
@@ -893,7 +892,7 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
         return false;
     }
 
-    bool fOk = govobj.ProcessVote(pfrom, vote, exception, connman) && cmapVoteToObject.Insert(nHashVote, &govobj);
+    bool fOk = govobj.ProcessVote(pfrom, vote, exception, connman);
     LEAVE_CRITICAL_SECTION(cs);
     return fOk;
 }
@@ -1037,11 +1036,10 @@ void CGovernanceManager::RequestGovernanceObject(CNode* pfrom, const uint256& nH
 
         if(pObj) {
             filter = CBloomFilter(Params().GetConsensus().nGovernanceFilterElements, GOVERNANCE_FILTER_FP_RATE, GetRandInt(2412699), BLOOM_UPDATE_ALL);
-            std::vector<CGovernanceVote> vecVotes = pObj->GetVoteFile().GetVotes();
-            nVoteCount = vecVotes.size();
-            for(size_t i = 0; i < vecVotes.size(); ++i) {
-                filter.insert(vecVotes[i].GetHash());
-            }
+            pgovvotedb->ForEachVoteHash(nHash, [&filter, &nVoteCount](const uint256& nVoteHash) {
+                filter.insert(nVoteHash);
+                ++nVoteCount;
+            });
         }
     }
 
@@ -1183,17 +1181,24 @@ bool CGovernanceManager::AcceptMessage(const uint256& nHash, hash_s_t& setHash)
     return true;
 }
 
-void CGovernanceManager::RebuildIndexes()
+void CGovernanceManager::SyncVotes()
 {
     LOCK(cs);
 
-    cmapVoteToObject.Clear();
+    hash_s_t setParents;
+    for(object_m_cit it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        setParents.insert(it->first);
+    }
+
+    if(pgovvotedb->SyncWithObjects(nVoteSequence, setParents)) {
+        return;
+    }
+
+    // Votes the tallies count are gone, start over and let peers send them again
+    LogPrintf("CGovernanceManager::SyncVotes -- votes database is behind governance.dat, clearing vote records\n");
     for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
-        CGovernanceObject& govobj = it->second;
-        std::vector<CGovernanceVote> vecVotes = govobj.GetVoteFile().GetVotes();
-        for(size_t i = 0; i < vecVotes.size(); ++i) {
-            cmapVoteToObject.Insert(vecVotes[i].GetHash(), &govobj);
-        }
+        pgovvotedb->EraseVotes(it->first);
+        it->second.ClearVotes();
     }
 }
 
@@ -1222,12 +1227,75 @@ void CGovernanceManager::InitOnLoad()
     LOCK(cs);
     int64_t nStart = GetTimeMillis();
     LogPrintf("Preparing masternode indexes and governance triggers...\n");
-    RebuildIndexes();
+    SyncVotes();
     AddCachedTriggers();
     LogPrintf("Masternode indexes and governance triggers prepared  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("     %s\n", ToString());
 }
 
+static const char DB_GOVERNANCE_STATE = 's';
+static const char DB_GOVERNANCE_OBJECT = 'g';
+
+struct CGovernanceManager::CStateRecord
+{
+    CGovernanceManager& governance;
+    std::string strVersion;
+
+    CStateRecord(CGovernanceManager& governanceIn) :
+        governance(governanceIn),
+        strVersion(SERIALIZATION_VERSION_STRING)
+        {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(strVersion);
+        if(ser_action.ForRead() && strVersion != SERIALIZATION_VERSION_STRING) {
+            return;
+        }
+        READWRITE(governance.mapErasedGovernanceObjects);
+        READWRITE(governance.cmapInvalidVotes);
+        READWRITE(governance.cmmapOrphanVotes);
+        READWRITE(governance.mapLastMasternodeObject);
+        READWRITE(governance.nVoteSequence);
+    }
+};
+
+void WriteFlatDBRecords(const CGovernanceManager& governance, CFlatDBWriter& writer)
+{
+    LOCK(governance.cs);
+
+    // The tallies written below include every vote stored up to now
+    const_cast<CGovernanceManager&>(governance).nVoteSequence = pgovvotedb->GetLastSequence();
+
+    // Objects which did not get new votes since the last dump are not written again
+    writer.Write(DB_GOVERNANCE_STATE, CGovernanceManager::CStateRecord(const_cast<CGovernanceManager&>(governance)));
+    for (const auto& objpair : governance.mapObjects) {
+        writer.Write(std::make_pair(DB_GOVERNANCE_OBJECT, objpair.first), objpair.second);
+    }
+}
+
+bool ReadFlatDBRecords(CGovernanceManager& governance, CFlatDBReader& reader)
+{
+    LOCK(governance.cs);
+
+    CGovernanceManager::CStateRecord state(governance);
+    if (!reader.Read(DB_GOVERNANCE_STATE, state)) {
+        return false;
+    }
+    if (state.strVersion != CGovernanceManager::SERIALIZATION_VERSION_STRING) {
+        governance.Clear();
+        return true;
+    }
+
+    reader.ReadAll<std::pair<char, uint256>, CGovernanceObject>(DB_GOVERNANCE_OBJECT,
+        [&governance](const std::pair<char, uint256>& key, const CGovernanceObject& govobj) {
+            governance.mapObjects.insert(std::make_pair(key.second, govobj));
+        });
+    return true;
+}
+
 std::string CGovernanceManager::ToString() const
 {
     LOCK(cs);
@@ -1256,7 +1324,7 @@ std::string CGovernanceManager::ToString() const
     return strprintf("Governance Objects: %d (Proposals: %d, Triggers: %d, Other: %d; Erased: %d), Votes: %d",
                     (int)mapObjects.size(),
                     nProposalCount, nTriggerCount, nOtherCount, (int)mapErasedGovernanceObjects.size(),
-                    (int)cmapVoteToObject.GetSize());
+                    pgovvotedb->GetVoteCount());
 }
 
 UniValue CGovernanceManager::ToJson() const
@@ -1287,7 +1355,7 @@ UniValue CGovernanceManager::ToJson() const
     jsonObj.push_back(Pair("triggers", nTriggerCount));
     jsonObj.push_back(Pair("other", nOtherCount));
     jsonObj.push_back(Pair("erased", (int)mapErasedGovernanceObjects.size()));
-    jsonObj.push_back(Pair("votes", (int)cmapVoteToObject.GetSize()));
+    jsonObj.push_back(Pair("votes", pgovvotedb->GetVoteCount()));
     return jsonObj;
 }
 
@@ -22,6 +22,8 @@
 #include <univalue.h>
 
 class CGovernanceManager;
+class CFlatDBReader;
+class CFlatDBWriter;
 class CGovernanceTriggerManager;
 class CGovernanceObject;
 class CGovernanceVote;
@@ -150,6 +152,8 @@ public:
 class CGovernanceManager
 {
     friend class CGovernanceObject;
+    friend void WriteFlatDBRecords(const CGovernanceManager& governance, CFlatDBWriter& writer);
+    friend bool ReadFlatDBRecords(CGovernanceManager& governance, CFlatDBReader& reader);
 
 public: // Types
     struct last_object_rec {
@@ -178,8 +182,6 @@ public: // Types
 
     typedef object_m_t::const_iterator object_m_cit;
 
-    typedef CacheMap<uint256, CGovernanceObject*> object_ref_cm_t;
-
     typedef std::map<uint256, CGovernanceVote> vote_m_t;
 
     typedef vote_m_t::iterator vote_m_it;
@@ -245,8 +247,6 @@ private:
     object_m_t mapPostponedObjects;
     hash_s_t setAdditionalRelayObjects;
 
-    object_ref_cm_t cmapVoteToObject;
-
     vote_cm_t cmapInvalidVotes;
 
     vote_cmm_t cmmapOrphanVotes;
@@ -259,6 +259,12 @@ private:
 
     bool fRateChecksEnabled;
 
+    // Last vote in pgovvotedb that the tallies in mapObjects include
+    uint64_t nVoteSequence;
+
+    // Everything but the objects, stored as one record by CFlatDB
+    struct CStateRecord;
+
     class ScopedLockBool
     {
         bool& ref;
@@ -320,10 +326,10 @@ public:
         LogPrint("gobject", "Governance object manager was cleared\n");
         mapObjects.clear();
         mapErasedGovernanceObjects.clear();
-        cmapVoteToObject.Clear();
         cmapInvalidVotes.Clear();
         cmmapOrphanVotes.Clear();
         mapLastMasternodeObject.clear();
+        nVoteSequence = 0;
     }
 
     std::string ToString() const;
@@ -436,7 +442,8 @@ private:
 
     void CheckOrphanVotes(CGovernanceObject& govobj, CGovernanceException& exception, CConnman& connman);
 
-    void RebuildIndexes();
+    /// Drop stored votes that the loaded tallies do not include
+    void SyncVotes();
 
     void AddCachedTriggers();
 
@@ -446,4 +453,8 @@ private:
 
 };
 
+/** Store every governance object as a record of its own in governance.dat */
+void WriteFlatDBRecords(const CGovernanceManager& governance, CFlatDBWriter& writer);
+bool ReadFlatDBRecords(CGovernanceManager& governance, CFlatDBReader& reader);
+
 #endif
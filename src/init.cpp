@@ -13,6 +13,7 @@
 #include "addrman.h"
 #include "amount.h"
 #include "base58.h"
+#include "blockindexer.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -50,6 +51,7 @@
 #include "dsnotificationinterface.h"
 #include "flat-database.h"
 #include "governance.h"
+#include "governance-votedb.h"
 #include "instantx.h"
 #ifdef ENABLE_WALLET
 #include "keepass.h"
@@ -130,6 +132,8 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Seconds between dumps of the masternode, payment and governance caches */
+static const int DUMP_CACHES_INTERVAL = 15 * 60;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -218,6 +222,27 @@ void Interrupt(boost::thread_group& threadGroup)
     threadGroup.interrupt_all();
 }
 
+/** Append what changed in the masternode, payment and governance caches to their files */
+static void DumpCaches()
+{
+    // periodic dumps run on the scheduler thread, the last one on shutdown
+    static CCriticalSection cs_DumpCaches;
+    LOCK(cs_DumpCaches);
+
+    CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
+    flatdb1.Dump(mnodeman);
+    CFlatDB<CFundamentalnodeMan> flatdb2("fncache.dat", "magicFundamentalnodeCache");
+    flatdb2.Dump(fnodeman);
+    CFlatDB<CMasternodePayments> flatdb3("mnpayments.dat", "magicMasternodePaymentsCache");
+    flatdb3.Dump(mnpayments);
+    CFlatDB<CFundamentalnodePayments> flatdb4("fnpayments.dat", "magicFundamentalnodePaymentsCache");
+    flatdb4.Dump(fnpayments);
+    CFlatDB<CGovernanceManager> flatdb5("governance.dat", "magicGovernanceCache");
+    flatdb5.Dump(governance);
+    CFlatDB<CNetFulfilledRequestManager> flatdb6("netfulfilled.dat", "magicFulfilledCache");
+    flatdb6.Dump(netfulfilledman);
+}
+
 /** Preparing steps before shutting down or restarting the wallet */
 void PrepareShutdown()
 {
@@ -248,19 +273,10 @@ void PrepareShutdown()
 
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
     if (!fLiteMode) {
-        CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
-        flatdb1.Dump(mnodeman);
-        CFlatDB<CFundamentalnodeMan> flatdb2("fncache.dat", "magicFundamentalnodeCache");
-        flatdb2.Dump(fnodeman);
-        CFlatDB<CMasternodePayments> flatdb3("mnpayments.dat", "magicMasternodePaymentsCache");
-        flatdb3.Dump(mnpayments);
-        CFlatDB<CFundamentalnodePayments> flatdb4("fnpayments.dat", "magicFundamentalnodePaymentsCache");
-        flatdb4.Dump(fnpayments);
-        CFlatDB<CGovernanceManager> flatdb5("governance.dat", "magicGovernanceCache");
-        flatdb5.Dump(governance);
-        CFlatDB<CNetFulfilledRequestManager> flatdb6("netfulfilled.dat", "magicFulfilledCache");
-        flatdb6.Dump(netfulfilledman);
+        DumpCaches();
     }
+    delete pgovvotedb;
+    pgovvotedb = NULL;
 
     UnregisterNodeSignals(GetNodeSignals());
     if (fDumpMempoolLater)
@@ -277,6 +293,12 @@ void PrepareShutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    if (pblockindexer) {
+        UnregisterValidationInterface(pblockindexer);
+        delete pblockindexer;
+        pblockindexer = NULL;
+    }
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -505,11 +527,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-uacomment=<cmt>", _("Append comment to the user agent string"));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-blockhashcache", strprintf("Memoize block header hashes so repeated GetHash() calls skip NeoScrypt (default: %u)", DEFAULT_BLOCK_HASH_CACHE));
         strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
         strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-checkvotetally", strprintf("Check the running governance vote tallies against a recount of the vote records on every query (default: %u)", DEFAULT_CHECK_VOTE_TALLY));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
@@ -539,7 +563,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
@@ -938,18 +962,6 @@ void InitParameterInteraction()
         LogPrintf("%s: parameter interaction: can't use -hdseed and -mnemonic/-mnemonicpassphrase together, will prefer -seed\n", __func__);
     }
 #endif // ENABLE_WALLET
-
-    // Make sure additional indexes are recalculated correctly in VerifyDB
-    // (we must reconnect blocks whenever we disconnect them for these indexes to work)
-    bool fAdditionalIndexes =
-        GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ||
-        GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) ||
-        GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
-
-    if (fAdditionalIndexes && GetArg("-checklevel", DEFAULT_CHECKLEVEL) < 4) {
-        ForceSetArg("-checklevel", "4");
-        LogPrintf("%s: parameter interaction: additional indexes -> setting -checklevel=4\n", __func__);
-    }
 }
 
 static std::string ResolveErrMsg(const char * const optname, const std::string& strBind)
@@ -1130,6 +1142,8 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCheckVoteTally = GetBoolArg("-checkvotetally", DEFAULT_CHECK_VOTE_TALLY);
+    fBlockHashCache = GetBoolArg("-blockhashcache", DEFAULT_BLOCK_HASH_CACHE);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1368,11 +1382,14 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
     InitSignatureCache();
+    InitScriptExecutionCache();
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and header verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
     }
 
     if (!sporkManager.SetSporkAddress(GetArg("-sporkaddr", Params().SporkAddress())))
@@ -1687,6 +1704,11 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // The other indexes are built by the block indexer once enabled
+                if (!EnableBlockIndexes(strLoadError)) {
+                    break;
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1807,6 +1829,14 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        pblockindexer = new CBlockIndexer();
+        if (!pblockindexer->Init())
+            return InitError(_("Error loading block indexes"));
+        RegisterValidationInterface(pblockindexer);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blockindexer", boost::function<void()>(boost::bind(&CBlockIndexer::ThreadSync, pblockindexer))));
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1943,6 +1973,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // LOAD SERIALIZED DAT FILES INTO DATA CACHES FOR INTERNAL USE
 
+    // Governance votes are kept on disk, only the objects and their tallies are loaded
+    pgovvotedb = new CGovernanceVoteDB(nMinDbCache << 20);
+
     if (!fLiteMode) {
         boost::filesystem::path pathDB = GetDataDir();
         std::string strDBName;
@@ -1986,6 +2019,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             governance.InitOnLoad();
         } else {
             uiInterface.InitMessage(_("Masternode/Fundamentalnode cache is empty, skipping payments and governance cache..."));
+            governance.InitOnLoad();
         }
 
         strDBName = "netfulfilled.dat";
@@ -1994,6 +2028,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         if(!flatdb6.Load(netfulfilledman)) {
             return InitError(_("Failed to load fulfilled requests cache from") + "\n" + (pathDB / strDBName).string());
         }
+
+        // Dumps only append what changed, keep the files close to the caches in case of a crash
+        scheduler.scheduleEvery(DumpCaches, DUMP_CACHES_INTERVAL);
     }
 
 
@@ -3,8 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 #include "db.h"
 #include "kernel.h"
+#include "crypto/common.h"
 #include "script/interpreter.h"
 #include "timedata.h"
 #include "util.h"
@@ -14,6 +16,7 @@
 #include "spork.h"
 #include "init.h"
 #include "validation.h"
+#include <atomic>
 #include <numeric>
 #include "spork.h"
 
@@ -26,6 +29,8 @@ unsigned int nForkTimestamp     = 1557068400;
 // Set to 3-hour for production network and 20-minute for test network
 unsigned int nModifierInterval = MODIFIER_INTERVAL;
 
+CStakeModifierIndex stakeModifierIndex;
+
 // Hard checkpoints of stake modifiers to ensure they are deterministic
 static std::map<int, unsigned int> mapStakeModifierCheckpoints =
         boost::assign::map_list_of
@@ -38,11 +43,79 @@ bool IsProtocolV03(unsigned int nTimeCoinStake)
     return (nTimeCoinStake >= (nForkTimestamp));
 }
 
+void CStakeModifierIndex::Sync(const CChain& chain)
+{
+    if (pindexSynced == chain.Tip())
+        return;
+
+    const CBlockIndex* pindexFork = pindexSynced ? chain.FindFork(pindexSynced) : NULL;
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+    while (!vEntries.empty() && vEntries.back().nHeight > nForkHeight)
+        vEntries.pop_back();
+
+    for (int nHeight = nForkHeight + 1; nHeight <= chain.Height(); nHeight++) {
+        const CBlockIndex* pindex = chain[nHeight];
+        if (!pindex->GeneratedStakeModifier())
+            continue;
+        Entry entry;
+        entry.nHeight = nHeight;
+        entry.nTime = pindex->GetBlockTime();
+        entry.nMaxTime = vEntries.empty() ? entry.nTime : std::max(vEntries.back().nMaxTime, entry.nTime);
+        entry.pindex = pindex;
+        vEntries.push_back(entry);
+    }
+    pindexSynced = chain.Tip();
+}
+
+void CStakeModifierIndex::Clear()
+{
+    vEntries.clear();
+    pindexSynced = NULL;
+}
+
+const CBlockIndex* CStakeModifierIndex::FindKernelModifier(const CBlockIndex* pindexFrom, int64_t nTime) const
+{
+    std::vector<Entry>::const_iterator it = std::upper_bound(vEntries.begin(), vEntries.end(), pindexFrom->nHeight,
+        [](int nHeight, const Entry& entry) { return nHeight < entry.nHeight; });
+    if (it == vEntries.end())
+        return NULL;
+
+    if (it != vEntries.begin() && (it - 1)->nMaxTime >= nTime) {
+        // Generation times went backwards at some point; fall back to a scan
+        for (; it != vEntries.end(); ++it)
+            if (it->nTime >= nTime)
+                return it->pindex;
+        return NULL;
+    }
+
+    // No earlier entry reaches nTime, so the first entry whose running
+    // maximum does is also the first one that reaches it itself
+    it = std::lower_bound(it, vEntries.end(), nTime,
+        [](const Entry& entry, int64_t nTime) { return entry.nMaxTime < nTime; });
+    return it == vEntries.end() ? NULL : it->pindex;
+}
+
+const CBlockIndex* CStakeModifierIndex::FindLastModifier(int nHeight) const
+{
+    std::vector<Entry>::const_iterator it = std::upper_bound(vEntries.begin(), vEntries.end(), nHeight,
+        [](int nHeight, const Entry& entry) { return nHeight < entry.nHeight; });
+    return it == vEntries.begin() ? NULL : (it - 1)->pindex;
+}
+
 // Get the last stake modifier and its generation time from a given block
 static bool GetLastStakeModifier(const CBlockIndex* pindex, uint64_t& nStakeModifier, int64_t& nModifierTime)
 {
     if (!pindex)
         return error("GetLastStakeModifier: null pindex");
+    if (chainActive.Contains(pindex)) {
+        stakeModifierIndex.Sync(chainActive);
+        const CBlockIndex* pindexModifier = stakeModifierIndex.FindLastModifier(pindex->nHeight);
+        if (pindexModifier) {
+            nStakeModifier = pindexModifier->nStakeModifier;
+            nModifierTime = pindexModifier->GetBlockTime();
+            return true;
+        }
+    }
     while (pindex && pindex->pprev && !pindex->GeneratedStakeModifier())
         pindex = pindex->pprev;
     if (!pindex->GeneratedStakeModifier())
@@ -228,52 +301,42 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     return true;
 }
 
-static bool GetKernlStakeModifierV03(uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernlStakeModifierV03(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
-        return error("GetKernelStakeModifier() : block not indexed");
-
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-    const CBlockIndex* pindex = pindexFrom;
-    CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
-
-    // loop to find the stake modifier later by a selection interval
-    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval) {
-        if (!pindexNext) {
-            // Should never happen
-            if(Params().NetworkIDString() == CBaseChainParams::TESTNET)
-            {
-                nStakeModifierHeight = pindexFrom->nHeight;
-                nStakeModifierTime = pindexFrom->GetBlockTime();
-                if(pindex->GeneratedStakeModifier())
-                    nStakeModifier = pindex->nStakeModifier;
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
 
-        pindex = pindexNext;
-        pindexNext = chainActive[pindexNext->nHeight + 1];
-        if (pindex->GeneratedStakeModifier()) {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
+    // find the first stake modifier generated a selection interval after pindexFrom
+    stakeModifierIndex.Sync(chainActive);
+    const CBlockIndex* pindex = stakeModifierIndex.FindKernelModifier(pindexFrom, pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval);
+    if (!pindex) {
+        // Should never happen
+        if(Params().NetworkIDString() == CBaseChainParams::TESTNET)
+        {
+            // the forward walk this replaces stopped at the tip
+            const CBlockIndex* pindexLast = chainActive.Height() > pindexFrom->nHeight ? chainActive.Tip() : pindexFrom;
+            if(pindexLast->GeneratedStakeModifier())
+                nStakeModifier = pindexLast->nStakeModifier;
+            return true;
+        }
+        else
+        {
+            return false;
         }
     }
+
+    nStakeModifierHeight = pindex->nHeight;
+    nStakeModifierTime = pindex->GetBlockTime();
     nStakeModifier = pindex->nStakeModifier;
     return true;
 }
 
 // Get the stake modifier specified by the protocol to hash for a stake kernel
-static bool GetKernelStakeModifier(uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
-    return GetKernlStakeModifierV03(hashBlockFrom, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
+    return GetKernlStakeModifierV03(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
 }
 // ppcoin kernel protocol
 // coinstake must meet hash target according to the protocol:
@@ -302,22 +365,46 @@ static bool GetKernelStakeModifier(uint256 hashBlockFrom, unsigned int nTimeTx,
 //   a proof-of-work situation.
 //
 
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake)
+void CStakeKernel::Init(const CBlockIndex* pindexFrom, unsigned int nTxPrevOffsetIn, const COutPoint& prevout, CAmount nValueInIn)
 {
+    nTimeBlockFrom = pindexFrom->GetBlockTime();
+    nTxPrevOffset = nTxPrevOffsetIn;
+    nPrevoutN = prevout.n;
+    nValueIn = nValueInIn;
 
-    auto txPrevTime = blockFrom.GetBlockTime();
-    if (nTimeTx < txPrevTime)  // Transaction timestamp violation
-        return error("CheckStakeKernelHash() : nTime violation");
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    fModifier = GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
 
-    auto nStakeMinAge = nTimeTx > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
-    auto nStakeMaxAge = Params().GetConsensus().nStakeMaxAge;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
-    if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
-        return error("CheckStakeKernelHash() : min age violation");
+    // Same layout as serializing
+    //     nStakeModifier << nTimeBlockFrom << nTxPrevOffset << txPrevTime << prevout.n
+    // with txPrevTime (the block time as int64_t) in a CDataStream; nTimeTx follows.
+    unsigned char prefix[28];
+    WriteLE64(prefix, nStakeModifier);
+    WriteLE32(prefix + 8, nTimeBlockFrom);
+    WriteLE32(prefix + 12, nTxPrevOffset);
+    WriteLE64(prefix + 16, (uint64_t)(int64_t)nTimeBlockFrom);
+    WriteLE32(prefix + 24, nPrevoutN);
+    hasherModifier.Reset().Write(prefix, sizeof(prefix));
+    hasherNoModifier.Reset().Write(prefix + 8, sizeof(prefix) - 8);
+}
+
+bool CStakeKernel::IsMature(unsigned int nTimeTx) const
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    auto nStakeMinAge = nTimeTx > consensus.nStakeMinAgeSwitchTime ? consensus.nStakeMinAge_2 : consensus.nStakeMinAge;
+    return nTimeTx >= nTimeBlockFrom && nTimeBlockFrom + nStakeMinAge <= nTimeTx;
+}
+
+bool CStakeKernel::CheckHashMature(unsigned int nBits, unsigned int nTimeTx, uint256& hashProofOfStake) const
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    auto nStakeMinAge = nTimeTx > consensus.nStakeMinAgeSwitchTime ? consensus.nStakeMinAge_2 : consensus.nStakeMinAge;
+    auto nStakeMaxAge = consensus.nStakeMaxAge;
+    int64_t txPrevTime = nTimeBlockFrom;
 
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
-    CAmount nValueIn = txPrev->vout[prevout.n].nValue;
     // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
     // this change increases active coins participating the hash and helps
     // to secure the network when proof-of-stake difficulty is low
@@ -325,19 +412,19 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
     arith_uint256 bnCoinDayWeight = nValueIn * nTimeWeight / COIN / 200;
 
     // Calculate hash
-    CDataStream ss(SER_GETHASH, 0);
-    uint64_t nStakeModifier = 0;
-    int nStakeModifierHeight = 0;
-    int64_t nStakeModifierTime = 0;
-
-    if (IsProtocolV03(nTimeTx)){
-        if (!GetKernelStakeModifier(blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+    CSHA256 hasher;
+    if (IsProtocolV03(nTimeTx)) {
+        if (!fModifier)
             return false;
-        ss << nStakeModifier;
+        hasher = hasherModifier;
+    } else {
+        hasher = hasherNoModifier;
     }
-
-    ss << nTimeBlockFrom << nTxPrevOffset << txPrevTime << prevout.n << nTimeTx;
-    hashProofOfStake = Hash(ss.begin(), ss.end());
+    unsigned char time[4];
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    WriteLE32(time, nTimeTx);
+    hasher.Write(time, sizeof(time)).Finalize(buf);
+    CSHA256().Write(buf, sizeof(buf)).Finalize(hashProofOfStake.begin());
     if (nTimeTx < 1549143000)
         return true;
 
@@ -345,10 +432,112 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
     if (UintToArith256(hashProofOfStake) > bnCoinDayWeight * bnTargetPerCoinDay)
         return false;
 
+    return true;
+}
+
+bool CStakeKernel::CheckHash(unsigned int nBits, unsigned int nTimeTx, uint256& hashProofOfStake) const
+{
+    if (nTimeTx < nTimeBlockFrom)  // Transaction timestamp violation
+        return error("CheckStakeKernelHash() : nTime violation");
+    if (!IsMature(nTimeTx)) // Min age requirement
+        return error("CheckStakeKernelHash() : min age violation");
+    return CheckHashMature(nBits, nTimeTx, hashProofOfStake);
+}
+
+bool CStakeKernel::Search(unsigned int nBits, unsigned int nTimeFrom, unsigned int nTimeTo,
+                          unsigned int& nTimeTxRet, uint256& hashProofOfStake) const
+{
+    for (unsigned int nTryTime = nTimeTo; nTryTime >= nTimeFrom && nTryTime > 0; nTryTime--) {
+        if (!IsMature(nTryTime))
+            continue;
+        if (CheckHashMature(nBits, nTryTime, hashProofOfStake)) {
+            nTimeTxRet = nTryTime;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SearchStakeKernels(const std::vector<const CStakeKernel*>& vKernels, unsigned int nBits,
+                        unsigned int nTimeFrom, unsigned int nTimeTo, int nThreads,
+                        size_t& nIndexRet, unsigned int& nTimeTxRet, uint64_t& nTriedRet)
+{
+    nTriedRet = 0;
+    if (vKernels.empty() || nTimeFrom > nTimeTo)
+        return false;
+    assert(vKernels.size() < std::numeric_limits<uint32_t>::max());
+
+    // Best hit so far as (time << 32 | ~index), so a larger key is a better hit
+    // and 0 means none found yet
+    std::atomic<uint64_t> nBestKey(0);
+    std::atomic<size_t> nNext(0);
+    std::atomic<uint64_t> nTried(0);
+    std::atomic<bool> fAbort(false);
 
+    auto worker = [&](bool fInterruptible) {
+        uint64_t nTriedLocal = 0;
+        while (!fAbort) {
+            if (fInterruptible)
+                boost::this_thread::interruption_point();
+            size_t nIndex = nNext++;
+            if (nIndex >= vKernels.size())
+                break;
+            // Timestamps below the best hit can not win anymore, and a kernel
+            // after the best one in vKernels has to beat its time outright
+            uint64_t nBest = nBestKey.load();
+            unsigned int nFrom = nTimeFrom;
+            if (nBest != 0) {
+                unsigned int nBestTime = nBest >> 32;
+                size_t nBestIndex = ~(uint32_t)nBest;
+                nFrom = std::max(nFrom, nIndex > nBestIndex ? nBestTime + 1 : nBestTime);
+                if (nFrom > nTimeTo)
+                    continue;
+            }
+            unsigned int nTime = 0;
+            uint256 hashProofOfStake;
+            if (!vKernels[nIndex]->Search(nBits, nFrom, nTimeTo, nTime, hashProofOfStake)) {
+                nTriedLocal += nTimeTo - nFrom + 1;
+                continue;
+            }
+            nTriedLocal += nTimeTo - nTime + 1;
+            uint64_t nKey = ((uint64_t)nTime << 32) | (uint32_t)~(uint32_t)nIndex;
+            while (nKey > nBest && !nBestKey.compare_exchange_weak(nBest, nKey)) {}
+        }
+        nTried += nTriedLocal;
+    };
+
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads && (size_t)i < vKernels.size(); i++)
+        threadGroup.create_thread(std::bind(worker, false));
+    try {
+        worker(true);
+    } catch (const boost::thread_interrupted&) {
+        fAbort = true;
+        threadGroup.join_all();
+        throw;
+    }
+    threadGroup.join_all();
+
+    nTriedRet = nTried;
+    uint64_t nBest = nBestKey;
+    if (nBest == 0)
+        return false;
+    nTimeTxRet = nBest >> 32;
+    nIndexRet = ~(uint32_t)nBest;
     return true;
 }
 
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake)
+{
+    BlockMap::iterator it = mapBlockIndex.find(blockFrom.GetHash());
+    if (it == mapBlockIndex.end())
+        return error("GetKernelStakeModifier() : block not indexed");
+
+    CStakeKernel kernel;
+    kernel.Init(it->second, nTxPrevOffset, prevout, txPrev->vout[prevout.n].nValue);
+    return kernel.CheckHash(nBits, nTimeTx, hashProofOfStake);
+}
+
 bool CheckKernelScript(CScript scriptVin, CScript scriptVout)
 {
     auto extractKeyID = [](CScript scriptPubKey) {
@@ -370,6 +559,27 @@ bool CheckKernelScript(CScript scriptVin, CScript scriptVout)
     };
     return extractKeyID(scriptVin) == extractKeyID(scriptVout);
 }
+// Find the staked output and the block that created it from the UTXO set and
+// the block index, without reading the previous transaction or its block
+static bool GetKernelInput(const CBlock& block, const COutPoint& prevout, CTxOut& txOutRet, const CBlockIndex*& pindexFromRet)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+    if (mi == mapBlockIndex.end())
+        return false;
+    const Coin& coin = pcoinsTip->AccessCoin(prevout);
+    if (coin.IsSpent())
+        return false;
+    // An unspent coin in pcoinsTip was created by the active chain's block at
+    // its height, which only applies if that block is also our ancestor
+    const CBlockIndex* pindexFrom = mi->second->GetAncestor(coin.nHeight);
+    if (!pindexFrom || !chainActive.Contains(pindexFrom))
+        return false;
+    txOutRet = coin.out;
+    pindexFromRet = pindexFrom;
+    return true;
+}
+
 bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake)
 {
     const CTransactionRef tx = block.vtx[1];
@@ -377,27 +587,30 @@ bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake)
         return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString().c_str());
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx->vin[0];
-    // First try finding the previous transaction in database
-    uint256 hashBlock;
-    CTransactionRef txPrev;
-    const auto &cons = Params().GetConsensus();
-    if (!GetTransaction(txin.prevout.hash, txPrev, cons, hashBlock, true))
-        return ("CheckProofOfStake() : INFO: read txPrev failed");
-    CTxOut prevTxOut = txPrev->vout[txin.prevout.n];
-    CBlockIndex* pindex = NULL;
-    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
-    if (it != mapBlockIndex.end())
-        pindex = it->second;
-    else
-        return error("CheckProofOfStake() : read block failed");
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos(), cons))
-        return error("CheckProofOfStake(): INFO: failed to find block");
+    LOCK(cs_main);
+    // The kernel only needs the staked output and the index entry of the
+    // block that created it. For an unspent output both come from the UTXO
+    // set; otherwise try finding the previous transaction in database
+    CTxOut prevTxOut;
+    const CBlockIndex* pindex = NULL;
+    if (!GetKernelInput(block, txin.prevout, prevTxOut, pindex)) {
+        uint256 hashBlock;
+        CTransactionRef txPrev;
+        const auto &cons = Params().GetConsensus();
+        if (!GetTransaction(txin.prevout.hash, txPrev, cons, hashBlock, true))
+            return ("CheckProofOfStake() : INFO: read txPrev failed");
+        prevTxOut = txPrev->vout[txin.prevout.n];
+        BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+        if (it != mapBlockIndex.end())
+            pindex = it->second;
+        else
+            return error("CheckProofOfStake() : read block failed");
+    }
     if(!CheckKernelScript(prevTxOut.scriptPubKey, tx->vout[1].scriptPubKey))
         return error("CheckProofOfStake() : INFO: check kernel script failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str());
-    unsigned int nTime = block.nTime;
-    if (!CheckStakeKernelHash(block.nBits, blockprev, sizeof(CBlock), txPrev, txin.prevout, nTime, hashProofOfStake))
+    CStakeKernel kernel;
+    kernel.Init(pindex, STAKE_KERNEL_TX_OFFSET, txin.prevout, prevTxOut.nValue);
+    if (!kernel.CheckHash(block.nBits, block.nTime, hashProofOfStake))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str()); // may occur during initial download or if behind on block chain sync
 
     return true;
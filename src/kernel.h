@@ -7,11 +7,13 @@
 #include "streams.h"
 #include "arith_uint256.h"
 #include "coins.h"
+#include "crypto/sha256.h"
 
 class CBlock;
 class CWallet;
 class COutPoint;
 class CBlockIndex;
+class CChain;
 class CTransaction;
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
 static const unsigned int MODIFIER_INTERVAL = 60;
@@ -21,6 +23,50 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // MODIFIER_INTERVAL_RATIO:
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
+// Offset of txPrev hashed into the stake kernel. This used to be passed as
+// sizeof(CBlock), i.e. 256 on 64-bit builds; it is part of the kernel hash, so
+// it is pinned here instead of following the in-memory layout of CBlock.
+static const unsigned int STAKE_KERNEL_TX_OFFSET = 256;
+
+/** Blocks of the active chain that generated a new stake modifier, in height
+ * order. The time of each generation is strictly later than the previous one,
+ * so "the first modifier generated after block B at or after time T" - the
+ * modifier a kernel hashes - is a binary search instead of a walk along
+ * chainActive. Kept in sync with chainActive by UpdateTip; a running maximum
+ * of the generation times keeps lookups correct even if that ordering is ever
+ * violated.
+ */
+class CStakeModifierIndex
+{
+private:
+    struct Entry
+    {
+        int nHeight;
+        int64_t nTime;
+        int64_t nMaxTime; //! latest generation time up to and including this entry
+        const CBlockIndex* pindex;
+    };
+
+    std::vector<Entry> vEntries;
+    const CBlockIndex* pindexSynced;
+
+public:
+    CStakeModifierIndex() : pindexSynced(NULL) {}
+
+    /** Disconnect entries past the fork with chain and append the newly connected ones. */
+    void Sync(const CChain& chain);
+    void Clear();
+
+    /** First generating block above pindexFrom's height with a time of at least nTime, or NULL. */
+    const CBlockIndex* FindKernelModifier(const CBlockIndex* pindexFrom, int64_t nTime) const;
+    /** Last generating block at or below nHeight, or NULL. */
+    const CBlockIndex* FindLastModifier(int nHeight) const;
+
+    size_t size() const { return vEntries.size(); }
+};
+
+extern CStakeModifierIndex stakeModifierIndex;
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 // Check whether stake kernel meets hash target
@@ -28,6 +74,62 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset,
                           const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx,
                           uint256& hashProofOfStake);
+
+/** Timestamp-independent state of a stake kernel.
+ *
+ * Everything the kernel hash needs from the staked output (stake modifier,
+ * block-from time, tx offset, output index and value) is resolved once by
+ * Init(), and the constant part of the hash preimage is absorbed into a
+ * SHA256 midstate. Trying a coinstake timestamp then only appends nTimeTx and
+ * finishes the double SHA256, so sweeping a range of timestamps is a tight
+ * hashing loop without index lookups or stream allocations.
+ */
+class CStakeKernel
+{
+private:
+    bool fModifier;
+    uint64_t nStakeModifier;
+    unsigned int nTimeBlockFrom;
+    unsigned int nTxPrevOffset;
+    uint32_t nPrevoutN;
+    CAmount nValueIn;
+    CSHA256 hasherModifier;  //! preimage prefix including the stake modifier (v0.3)
+    CSHA256 hasherNoModifier;
+
+    bool IsMature(unsigned int nTimeTx) const;
+    bool CheckHashMature(unsigned int nBits, unsigned int nTimeTx, uint256& hashProofOfStake) const;
+
+public:
+    CStakeKernel() : fModifier(false), nStakeModifier(0), nTimeBlockFrom(0), nTxPrevOffset(0), nPrevoutN(0), nValueIn(0) {}
+
+    /** Resolve the kernel state of prevout, created in block pindexFrom. */
+    void Init(const CBlockIndex* pindexFrom, unsigned int nTxPrevOffsetIn, const COutPoint& prevout, CAmount nValueInIn);
+
+    unsigned int GetBlockFromTime() const { return nTimeBlockFrom; }
+
+    /** Same result as CheckStakeKernelHash for the coin this kernel was initialized with. */
+    bool CheckHash(unsigned int nBits, unsigned int nTimeTx, uint256& hashProofOfStake) const;
+
+    /** Try every timestamp from nTimeTo down to nTimeFrom (inclusive) and
+     * return the first one meeting the target. Immature timestamps are skipped
+     * silently. */
+    bool Search(unsigned int nBits, unsigned int nTimeFrom, unsigned int nTimeTo,
+                unsigned int& nTimeTxRet, uint256& hashProofOfStake) const;
+};
+
+/** Search several stake kernels over the same timestamp window [nTimeFrom, nTimeTo]
+ * on nThreads threads (the calling thread included).
+ *
+ * The winner is the kernel with the latest hit timestamp, ties going to the
+ * lowest index in vKernels, so the result does not depend on the thread count
+ * or on scheduling. Once a hit at time T is known, later kernels only try
+ * timestamps that could still beat it, so the search stops early on a hit at
+ * nTimeTo. nTriedRet is the number of kernel hashes computed.
+ */
+bool SearchStakeKernels(const std::vector<const CStakeKernel*>& vKernels, unsigned int nBits,
+                        unsigned int nTimeFrom, unsigned int nTimeTo, int nThreads,
+                        size_t& nIndexRet, unsigned int& nTimeTxRet, uint64_t& nTriedRet);
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake);
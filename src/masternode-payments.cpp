@@ -6,6 +6,7 @@
 #include "activefundamentalnode.h"
 #include "activefundamentalnode.h"
 #include "consensus/validation.h"
+#include "flat-database.h"
 #include "governance-classes.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
@@ -1110,6 +1111,37 @@ void CMasternodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& co
     }
 }
 
+static const char DB_PAYMENT_VOTE = 'v';
+static const char DB_PAYMENT_BLOCK = 'b';
+
+void WriteFlatDBRecords(const CMasternodePayments& payments, CFlatDBWriter& writer)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+
+    // Votes never change once stored, only the blocks that got new ones are written again
+    for (const auto& votepair : payments.mapMasternodePaymentVotes) {
+        writer.Write(std::make_pair(DB_PAYMENT_VOTE, votepair.first), votepair.second);
+    }
+    for (const auto& blockpair : payments.mapMasternodeBlocks) {
+        writer.Write(std::make_pair(DB_PAYMENT_BLOCK, blockpair.first), blockpair.second);
+    }
+}
+
+bool ReadFlatDBRecords(CMasternodePayments& payments, CFlatDBReader& reader)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+
+    reader.ReadAll<std::pair<char, uint256>, CMasternodePaymentVote>(DB_PAYMENT_VOTE,
+        [&payments](const std::pair<char, uint256>& key, const CMasternodePaymentVote& vote) {
+            payments.mapMasternodePaymentVotes.insert(std::make_pair(key.second, vote));
+        });
+    reader.ReadAll<std::pair<char, int>, CMasternodeBlockPayees>(DB_PAYMENT_BLOCK,
+        [&payments](const std::pair<char, int>& key, const CMasternodeBlockPayees& blockPayees) {
+            payments.mapMasternodeBlocks.insert(std::make_pair(key.second, blockPayees));
+        });
+    return true;
+}
+
 std::string CMasternodePayments::ToString() const
 {
     std::ostringstream info;
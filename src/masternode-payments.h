@@ -16,6 +16,8 @@
 class CMasternodePayments;
 class CMasternodePaymentVote;
 class CMasternodeBlockPayees;
+class CFlatDBReader;
+class CFlatDBWriter;
 
 static const int MNPAYMENTS_SIGNATURES_REQUIRED         = 6;
 static const int MNPAYMENTS_SIGNATURES_TOTAL            = 10;
@@ -238,4 +240,8 @@ public:
 };
 
 
+/** Store every payment vote and payment block as a record of its own in mnpayments.dat */
+void WriteFlatDBRecords(const CMasternodePayments& payments, CFlatDBWriter& writer);
+bool ReadFlatDBRecords(CMasternodePayments& payments, CFlatDBReader& reader);
+
 #endif
@@ -12,6 +12,7 @@
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "messagesigner.h"
+#include "netmessagemaker.h"
 #include "script/standard.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
@@ -41,7 +42,8 @@ CMasternode::CMasternode(const CMasternode& other) :
     nPoSeBanScore(other.nPoSeBanScore),
     nPoSeBanHeight(other.nPoSeBanHeight),
     fAllowMixingTx(other.fAllowMixingTx),
-    fUnitTest(other.fUnitTest)
+    fUnitTest(other.fUnitTest),
+    relayCache(other.relayCache)
 {}
 
 CMasternode::CMasternode(const CMasternodeBroadcast& mnb) :
@@ -294,6 +296,39 @@ masternode_info_t CMasternode::GetInfo() const
     return info;
 }
 
+static bool IsSamePing(const CMasternodePing& a, const CMasternodePing& b)
+{
+    return a.masternodeOutpoint == b.masternodeOutpoint && a.blockHash == b.blockHash &&
+           a.sigTime == b.sigTime && a.vchSig == b.vchSig && a.fSentinelIsCurrent == b.fSentinelIsCurrent &&
+           a.nSentinelVersion == b.nSentinelVersion && a.nDaemonVersion == b.nDaemonVersion;
+}
+
+std::shared_ptr<const CMasternodeRelayCache> CMasternode::GetRelayCache() const
+{
+    bool fNewSigs = sporkManager.IsSporkActive(SPORK_6_NEW_SIGS);
+
+    LOCK(cs);
+    // A new announcement always comes with a later sigTime and its own signature
+    if (relayCache && relayCache->sigTime == sigTime && relayCache->vchSig == vchSig &&
+            relayCache->fNewSigs == fNewSigs && IsSamePing(relayCache->lastPing, lastPing))
+        return relayCache;
+
+    CMasternodeBroadcast mnb(*this);
+    std::shared_ptr<CMasternodeRelayCache> cache = std::make_shared<CMasternodeRelayCache>();
+    cache->sigTime = sigTime;
+    cache->vchSig = vchSig;
+    cache->lastPing = lastPing;
+    cache->fNewSigs = fNewSigs;
+    cache->hashBroadcast = mnb.GetHash();
+    cache->hashPing = lastPing.GetHash();
+    cache->nSendVersion = PROTOCOL_VERSION;
+    CNetMsgMaker msgMaker(cache->nSendVersion);
+    cache->msgBroadcast = CConnman::ShareMessage(msgMaker.Make(NetMsgType::MNANNOUNCE, mnb));
+    cache->msgPing = CConnman::ShareMessage(msgMaker.Make(NetMsgType::MNPING, lastPing));
+    relayCache = cache;
+    return relayCache;
+}
+
 std::string CMasternode::StateToString(int nStateIn)
 {
     switch(nStateIn) {
@@ -320,46 +355,6 @@ std::string CMasternode::GetStatus() const
     return GetStateString();
 }
 
-void CMasternode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack)
-{
-    if(!pindex) return;
-
-    const CBlockIndex *BlockReading = pindex;
-
-    CScript mnpayee = GetScriptForDestination(pubKeyCollateralAddress.GetID());
-
-    LOCK(cs_mapMasternodeBlocks);
-
-    for (int i = 0; BlockReading && BlockReading->nHeight > nBlockLastPaid && i < nMaxBlocksToScanBack; i++) {
-        if(mnpayments.mapMasternodeBlocks.count(BlockReading->nHeight) &&
-           mnpayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2))
-        {
-            CBlock block;
-            if(!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
-                continue;
-
-            const auto& coinbaseTransaction = (BlockReading->nHeight > Params().GetConsensus().nLastPoWBlock ? block.vtx[1] : block.vtx[0]);
-
-            CAmount nMasternodePayment = GetMasternodePayment(BlockReading->nHeight, BlockReading->nMint);
-
-            for(const CTxOut &txout : coinbaseTransaction->vout)
-                if(mnpayee == txout.scriptPubKey && nMasternodePayment == txout.nValue) {
-                    nBlockLastPaid = BlockReading->nHeight;
-                    nTimeLastPaid = BlockReading->nTime;
-                    LogPrint("mnpayments", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", outpoint.ToStringShort(), nBlockLastPaid);
-                    return;
-                }
-        }
-
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
-
-    // Last payment for this masternode wasn't found in latest mnpayments blocks
-    // or it was found in mnpayments blocks but wasn't found in the blockchain.
-    // LogPrint(BCLog::MASTERNODE, "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- keeping old %d\n", vin.prevout.ToString(), nBlockLastPaid);
-}
-
 #ifdef ENABLE_WALLET
 bool CMasternodeBroadcast::Create(const std::string& strService, const std::string& strKeyMasternode, const std::string& strTxHash, const std::string& strOutputIndex, std::string& strErrorRet, CMasternodeBroadcast &mnbRet, bool fOffline)
 {
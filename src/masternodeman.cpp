@@ -24,8 +24,7 @@
 /** Masternode manager */
 CMasternodeMan mnodeman;
 
-const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-8";
-const int CMasternodeMan::LAST_PAID_SCAN_BLOCKS = 100;
+const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-9";
 
 struct CompareLastPaidBlock
 {
@@ -69,6 +68,9 @@ CMasternodeMan::CMasternodeMan():
     fMasternodesRemoved(false),
     vecDirtyGovernanceObjectHashes(),
     nLastSentinelPingTime(0),
+    mapRankCache(RANK_CACHE_SIZE),
+    nRankCacheHits(0),
+    nRankCacheMisses(0),
     mapSeenMasternodeBroadcast(),
     mapSeenMasternodePing(),
     nDsqCount(0)
@@ -83,6 +85,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapMasternodes[mn.outpoint] = mn;
     fMasternodesAdded = true;
+    InvalidateRankCache();
     return true;
 }
 
@@ -205,6 +208,7 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
                 it->second.FlagGovernanceItemsAsDirty();
                 mapMasternodes.erase(it++);
                 fMasternodesRemoved = true;
+                InvalidateRankCache();
             } else {
                 bool fAsk = (nAskForMnbRecovery > 0) &&
                             masternodeSync.IsSynced() &&
@@ -360,6 +364,8 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     mapMasternodes.clear();
+    mapPayeeLastPaid.clear();
+    InvalidateRankCache();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -653,6 +659,54 @@ bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeM
     return !vecMasternodeScoresRet.empty();
 }
 
+CMasternodeMan::rank_table_ptr_t CMasternodeMan::GetRankTable(const uint256& nBlockHash, int nMinProtocol)
+{
+    AssertLockHeld(cs);
+
+    const std::pair<uint256, int> key = std::make_pair(nBlockHash, nMinProtocol);
+    rank_table_ptr_t pRankTable;
+    if (mapRankCache.Get(key, pRankTable)) {
+        // re-insert to move it to the front, so the least recently used table is evicted first
+        mapRankCache.Erase(key);
+        mapRankCache.Insert(key, pRankTable);
+        nRankCacheHits++;
+        return pRankTable;
+    }
+    nRankCacheMisses++;
+
+    score_pair_vec_t vecMasternodeScores;
+    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+        return nullptr;
+
+    std::shared_ptr<CRankTable> pNewRankTable = std::make_shared<CRankTable>();
+    pNewRankTable->vecOutpoints.reserve(vecMasternodeScores.size());
+    pNewRankTable->mapRanks.reserve(vecMasternodeScores.size());
+    int nRank = 0;
+    for (const auto& scorePair : vecMasternodeScores) {
+        nRank++;
+        pNewRankTable->vecOutpoints.push_back(scorePair.second->outpoint);
+        pNewRankTable->mapRanks.emplace(scorePair.second->outpoint, nRank);
+    }
+
+    pRankTable = pNewRankTable;
+    mapRankCache.Insert(key, pRankTable);
+    return pRankTable;
+}
+
+void CMasternodeMan::InvalidateRankCache()
+{
+    AssertLockHeld(cs);
+    mapRankCache.Clear();
+}
+
+void CMasternodeMan::GetRankCacheStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nSizeRet)
+{
+    LOCK(cs);
+    nHitsRet = nRankCacheHits;
+    nMissesRet = nRankCacheMisses;
+    nSizeRet = mapRankCache.GetSize();
+}
+
 bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet, int nBlockHeight, int nMinProtocol)
 {
     nRankRet = -1;
@@ -669,20 +723,16 @@ bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet,
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    rank_table_ptr_t pRankTable = GetRankTable(nBlockHash, nMinProtocol);
+    if (!pRankTable)
         return false;
 
-    int nRank = 0;
-    for (const auto& scorePair : vecMasternodeScores) {
-        nRank++;
-        if(scorePair.second->outpoint == outpoint) {
-            nRankRet = nRank;
-            return true;
-        }
-    }
+    auto it = pRankTable->mapRanks.find(outpoint);
+    if (it == pRankTable->mapRanks.end())
+        return false;
 
-    return false;
+    nRankRet = it->second;
+    return true;
 }
 
 bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMasternodeRanksRet, int nBlockHeight, int nMinProtocol)
@@ -701,14 +751,18 @@ bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMast
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    rank_table_ptr_t pRankTable = GetRankTable(nBlockHash, nMinProtocol);
+    if (!pRankTable)
         return false;
 
+    vecMasternodeRanksRet.reserve(pRankTable->vecOutpoints.size());
     int nRank = 0;
-    for (const auto& scorePair : vecMasternodeScores) {
+    for (const auto& outpoint : pRankTable->vecOutpoints) {
         nRank++;
-        vecMasternodeRanksRet.push_back(std::make_pair(nRank, *scorePair.second));
+        // the cache is invalidated on every list change, so every ranked outpoint is still known
+        auto it = mapMasternodes.find(outpoint);
+        assert(it != mapMasternodes.end());
+        vecMasternodeRanksRet.push_back(std::make_pair(nRank, it->second));
     }
 
     return true;
@@ -983,14 +1037,51 @@ void CMasternodeMan::PushDsegInvs(CNode* pnode, const CMasternode& mn)
 {
     AssertLockHeld(cs);
 
-    CMasternodeBroadcast mnb(mn);
-    CMasternodePing mnp = mnb.lastPing;
-    uint256 hashMNB = mnb.GetHash();
-    uint256 hashMNP = mnp.GetHash();
-    pnode->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hashMNB));
-    pnode->PushInventory(CInv(MSG_MASTERNODE_PING, hashMNP));
-    mapSeenMasternodeBroadcast.insert(std::make_pair(hashMNB, std::make_pair(GetTime(), mnb)));
-    mapSeenMasternodePing.insert(std::make_pair(hashMNP, mnp));
+    std::shared_ptr<const CMasternodeRelayCache> cache = mn.GetRelayCache();
+    pnode->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, cache->hashBroadcast));
+    pnode->PushInventory(CInv(MSG_MASTERNODE_PING, cache->hashPing));
+    // Keep both answerable by getdata; only copy them in when they are not already
+    if (!mapSeenMasternodeBroadcast.count(cache->hashBroadcast))
+        mapSeenMasternodeBroadcast.insert(std::make_pair(cache->hashBroadcast, std::make_pair(GetTime(), CMasternodeBroadcast(mn))));
+    if (!mapSeenMasternodePing.count(cache->hashPing))
+        mapSeenMasternodePing.insert(std::make_pair(cache->hashPing, mn.lastPing));
+}
+
+bool CMasternodeMan::GetRelayMessage(const CInv& inv, int nSendVersion, CSharedNetMsg& msgRet)
+{
+    LOCK(cs);
+
+    COutPoint outpoint;
+    if (inv.type == MSG_MASTERNODE_ANNOUNCE) {
+        auto it = mapSeenMasternodeBroadcast.find(inv.hash);
+        if (it == mapSeenMasternodeBroadcast.end())
+            return false;
+        outpoint = it->second.second.outpoint;
+    } else if (inv.type == MSG_MASTERNODE_PING) {
+        auto it = mapSeenMasternodePing.find(inv.hash);
+        if (it == mapSeenMasternodePing.end())
+            return false;
+        outpoint = it->second.masternodeOutpoint;
+    } else {
+        return false;
+    }
+
+    auto itMn = mapMasternodes.find(outpoint);
+    if (itMn == mapMasternodes.end())
+        return false;
+    // Only the current announcement and ping are cached, older ones are served from the seen maps
+    std::shared_ptr<const CMasternodeRelayCache> cache = itMn->second.GetRelayCache();
+    if (cache->nSendVersion != nSendVersion)
+        return false;
+    if (inv.type == MSG_MASTERNODE_ANNOUNCE && cache->hashBroadcast == inv.hash) {
+        msgRet = cache->msgBroadcast;
+        return true;
+    }
+    if (inv.type == MSG_MASTERNODE_PING && cache->hashPing == inv.hash) {
+        msgRet = cache->msgPing;
+        return true;
+    }
+    return false;
 }
 
 // Verification of masternodes via unique direct requests.
@@ -1558,7 +1649,10 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
         CMasternode* pmn = Find(mnb.outpoint);
         if(pmn) {
             CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-            if(!mnb.Update(pmn, nDos, connman)) {
+            // a newer broadcast can change the protocol version this masternode is ranked under
+            bool fUpdated = mnb.Update(pmn, nDos, connman);
+            InvalidateRankCache();
+            if(!fUpdated) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.outpoint.ToStringShort());
                 return false;
             }
@@ -1600,21 +1694,78 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
 {
     LOCK(cs);
 
-    if(fLiteMode || !masternodeSync.IsWinnersListSynced() || mapMasternodes.empty()) return;
+    if(fLiteMode || !pindex || !masternodeSync.IsWinnersListSynced() || mapMasternodes.empty()) return;
 
-    static int nLastRunBlockHeight = 0;
-    // Scan at least LAST_PAID_SCAN_BLOCKS but no more than mnpayments.GetStorageLimit()
-    int nMaxBlocksToScanBack = std::max(LAST_PAID_SCAN_BLOCKS, nCachedBlockHeight - nLastRunBlockHeight);
-    nMaxBlocksToScanBack = std::min(nMaxBlocksToScanBack, mnpayments.GetStorageLimit());
+    PruneLastPaid(pindex->nHeight);
 
-    LogPrint("masternode", "CMasternodeMan::UpdateLastPaid -- nCachedBlockHeight=%d, nLastRunBlockHeight=%d, nMaxBlocksToScanBack=%d\n",
-                            nCachedBlockHeight, nLastRunBlockHeight, nMaxBlocksToScanBack);
+    LogPrint("masternode", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, payees=%d\n", pindex->nHeight, mapPayeeLastPaid.size());
+
+    LOCK(cs_mapMasternodeBlocks);
 
     for (auto& mnpair : mapMasternodes) {
-        mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+        CScript mnpayee = GetScriptForDestination(mnpair.second.pubKeyCollateralAddress.GetID());
+        auto it = mapPayeeLastPaid.find(mnpayee);
+        if(it == mapPayeeLastPaid.end()) continue;
+        // newest payment that is still part of the chain ending at pindex
+        for (auto itPaid = it->second.rbegin(); itPaid != it->second.rend(); ++itPaid) {
+            if(itPaid->first > pindex->nHeight) continue;
+            const CBlockIndex* pindexPaid = pindex->GetAncestor(itPaid->first);
+            if(!pindexPaid || pindexPaid->GetBlockHash() != itPaid->second) continue;
+            // only count payments to the payee the network voted for at that height
+            if(!mnpayments.mapMasternodeBlocks.count(itPaid->first) ||
+               !mnpayments.mapMasternodeBlocks[itPaid->first].HasPayeeWithVotes(mnpayee, 2)) continue;
+            mnpair.second.UpdateLastPaid(pindexPaid->nHeight, pindexPaid->nTime);
+            break;
+        }
     }
+}
 
-    nLastRunBlockHeight = nCachedBlockHeight;
+void CMasternodeMan::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
+{
+    if(fLiteMode || !pindex || posInBlock == CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK) return;
+
+    // Masternodes are paid by the coinstake, or by the coinbase during PoW
+    int nPaymentPos = pindex->nHeight > Params().GetConsensus().nLastPoWBlock ? 1 : 0;
+    if(posInBlock != nPaymentPos) return;
+
+    CAmount nMasternodePayment = GetMasternodePayment(pindex->nHeight, pindex->nMint);
+
+    LOCK(cs);
+    // Record every masternode amount paid to a key, known masternode or not: the list is
+    // empty during IBD and until it syncs. UpdateLastPaid only reads the entries of
+    // listed masternodes and checks them against the payment votes.
+    for (const CTxOut& txout : tx.vout) {
+        if(txout.nValue != nMasternodePayment || !txout.scriptPubKey.IsPayToPublicKeyHash()) continue;
+        std::vector<std::pair<int, uint256> >& vecPaid = mapPayeeLastPaid[txout.scriptPubKey];
+        // anything at or above this height belongs to a disconnected block
+        while(!vecPaid.empty() && vecPaid.back().first >= pindex->nHeight) {
+            vecPaid.pop_back();
+        }
+        vecPaid.push_back(std::make_pair(pindex->nHeight, pindex->GetBlockHash()));
+        if(vecPaid.size() > LAST_PAID_HISTORY) {
+            vecPaid.erase(vecPaid.begin());
+        }
+    }
+
+    // keep the index to the payment storage window while nothing calls UpdateLastPaid
+    if(pindex->nHeight % mnpayments.GetStorageLimit() == 0) {
+        PruneLastPaid(pindex->nHeight);
+    }
+}
+
+void CMasternodeMan::PruneLastPaid(int nHeight)
+{
+    AssertLockHeld(cs);
+
+    // Forget payees that were not paid within the payment storage window
+    int nMinHeight = nHeight - mnpayments.GetStorageLimit();
+    for (auto it = mapPayeeLastPaid.begin(); it != mapPayeeLastPaid.end(); ) {
+        if(it->second.back().first < nMinHeight) {
+            mapPayeeLastPaid.erase(it++);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void CMasternodeMan::UpdateLastSentinelPingTime()
@@ -50,6 +50,7 @@
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
+CStakeMinerStats stakeMinerStats;
 
 class ScoreCompare
 {
@@ -111,7 +112,7 @@ void BlockAssembler::resetBlock()
     blockFinished = false;
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet, const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fProofOfStake)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet, const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fProofOfStake, const CStakeKernelHit* pKernelHit)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -158,33 +159,23 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
     coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
     CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nHeight, Params().GetConsensus());
     std::vector<CWalletTx*> vwtxPrev;
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime();
     if(fProofOfStake)
     {
-        assert(wallet);
+        assert(wallet && pKernelHit);
         boost::this_thread::interruption_point();
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+        // the kernel was searched for without cs_main, the tip may have moved on since
+        if (pKernelHit->hashPrevBlock != pindexPrev->GetBlockHash() || pKernelHit->nBits != pblock->nBits)
+            return nullptr;
         CMutableTransaction coinstakeTx;
-        int64_t nSearchTime = pblock->nTime; // search to current time
-        bool fStakeFound = false;
-        if (nSearchTime >= nLastCoinStakeSearchTime) {
-            unsigned int nTxNewTime = 0;
-            if (wallet->CreateCoinStake(pblock->nBits, blockReward,
-                                        coinstakeTx, nTxNewTime,
-                                        vwtxPrev))
-            {
-                pblock->nTime = nTxNewTime;
-                coinbaseTx.vout[0].SetEmpty();
-                pblock->vtx.emplace_back(MakeTransactionRef(coinstakeTx));
-                fStakeFound = true;
-            }
-
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
-        }
-
-        if (!fStakeFound)
+        unsigned int nTxNewTime = 0;
+        if (!wallet->CreateCoinStake(*pKernelHit, blockReward,
+                                     coinstakeTx, nTxNewTime,
+                                     vwtxPrev))
             return nullptr;
+        pblock->nTime = nTxNewTime;
+        coinbaseTx.vout[0].SetEmpty();
+        pblock->vtx.emplace_back(MakeTransactionRef(coinstakeTx));
     }
     else
     {
@@ -635,6 +626,7 @@ void static SecureTagMinter(const CChainParams& chainparams, CConnman& connman,
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
     RenameThread("securetag-miner");
     unsigned int nExtraNonce = 0;
+    int64_t nLastCoinStakeSearchTime = GetAdjustedTime();
     boost::shared_ptr<CReserveScript> coinbaseScript;
     GetMainSignals().ScriptForMining(coinbaseScript);
     while (true) {
@@ -675,10 +667,40 @@ void static SecureTagMinter(const CChainParams& chainparams, CConnman& connman,
             unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
             CBlockIndex* pindexPrev = chainActive.Tip();
             if(!pindexPrev) break;
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(pwallet, chainparams, coinbaseScript->reserveScript, fProofOfStake));
+            CStakeKernelHit kernelHit;
+            if(fProofOfStake)
+            {
+                //prevent staking a time that won't be accepted
+                if (GetAdjustedTime() <= pindexPrev->nTime)
+                {
+                    MilliSleep(10000);
+                    continue;
+                }
+                // Look for a kernel before assembling anything, the search runs
+                // without cs_main and the mempool lock and a block is only built on a hit
+                CBlockHeader header;
+                header.nTime = GetAdjustedTime();
+                unsigned int nBits = GetNextWorkRequired(pindexPrev, &header, chainparams.GetConsensus());
+                int64_t nSearchTime = GetAdjustedTime();
+                int64_t nSearchStart = GetTimeMicros();
+                uint64_t nKernelsTried = 0;
+                bool fKernelFound = pwallet->FindStakeKernel(pindexPrev, nBits, kernelHit, nKernelsTried);
+                stakeMinerStats.nKernelsTried += nKernelsTried;
+                stakeMinerStats.nSearchMicros += GetTimeMicros() - nSearchStart;
+                nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+                nLastCoinStakeSearchTime = nSearchTime;
+                if (!fKernelFound)
+                {
+                    LogPrintf("SecureTagMinter -- Failed to find a coinstake\n");
+                    MilliSleep(5000);
+                    continue;
+                }
+            }
+            int64_t nTemplateStart = GetTimeMicros();
+            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(pwallet, chainparams, coinbaseScript->reserveScript, fProofOfStake, fProofOfStake ? &kernelHit : nullptr));
             if (!pblocktemplate.get())
             {
-                LogPrintf("SecureTagMinter -- Failed to find a coinstake\n");
+                LogPrintf("SecureTagMinter -- Failed to create a block template\n");
                 MilliSleep(5000);
                 continue;
             }
@@ -696,6 +718,8 @@ void static SecureTagMinter(const CChainParams& chainparams, CConnman& connman,
                     throw std::runtime_error(strprintf("%s: SignBlock failed", __func__));
                 }
                 LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
+                stakeMinerStats.nTemplates++;
+                stakeMinerStats.nLastTemplateMicros = GetTimeMicros() - nTemplateStart;
             }
             // check if block is valid
             // CValidationState state;
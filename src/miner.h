@@ -9,6 +9,7 @@
 #include "primitives/block.h"
 #include "txmempool.h"
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
 #include "boost/multi_index_container.hpp"
@@ -20,11 +21,24 @@ class CConnman;
 class CReserveKey;
 class CScript;
 class CWallet;
+struct CStakeKernelHit;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
+/** Counters of the proof-of-stake minter, reported by getstakingstatus */
+struct CStakeMinerStats
+{
+    std::atomic<uint64_t> nKernelsTried;
+    std::atomic<int64_t> nSearchMicros;        //!< time spent in the lock-free kernel search
+    std::atomic<uint64_t> nTemplates;
+    std::atomic<int64_t> nLastTemplateMicros;  //!< time from the last kernel hit to a signed block
+
+    CStakeMinerStats() : nKernelsTried(0), nSearchMicros(0), nTemplates(0), nLastTemplateMicros(0) {}
+};
+extern CStakeMinerStats stakeMinerStats;
+
 struct CBlockTemplate
 {
     CBlock block;
@@ -161,8 +175,8 @@ private:
 
 public:
     BlockAssembler(const CChainParams& chainparams);
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(CWallet *wallet, const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fProofOfStake);
+    /** Construct a new block template with coinbase to scriptPubKeyIn, proof-of-stake blocks are built around pKernelHit */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(CWallet *wallet, const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fProofOfStake, const CStakeKernelHit* pKernelHit = nullptr);
 
 private:
     // utility functions
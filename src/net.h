@@ -125,6 +125,18 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** A message with its header and checksum built once, ready to be queued to
+ * any number of peers. Copies share the serialized bytes. */
+struct CSharedNetMsg
+{
+    std::string command;
+    std::shared_ptr<const std::vector<unsigned char>> header;
+    std::shared_ptr<const std::vector<unsigned char>> data; //! null for an empty payload
+
+    bool IsNull() const { return !header; }
+    size_t GetPayloadSize() const { return data ? data->size() : 0; }
+};
+
 
 class CConnman
 {
@@ -206,6 +218,42 @@ public:
     bool IsFundamentalnodeOrDisconnectRequested(const CService& addr);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
+
+    /** Build the header and checksum of msg, to push it to several nodes */
+    static CSharedNetMsg ShareMessage(CSerializedNetMsg&& msg);
+
+    /**
+     * Queue a message to every fully connected node for which cond holds.
+     * make(nVersion) builds the message for a send version; it is called
+     * once per distinct version, so the payload is serialized and
+     * checksummed once however many nodes receive it. Returns the number of
+     * nodes the message was queued to.
+     */
+    template<typename Condition, typename MakeMsg>
+    int BroadcastMessage(const Condition& cond, MakeMsg&& make)
+    {
+        std::map<int, CSharedNetMsg> mapMsgByVersion;
+        int nSent = 0;
+        LOCK(cs_vNodes);
+        for (auto&& node : vNodes) {
+            if (!NodeFullyConnected(node) || !cond(node))
+                continue;
+            int nVersion = NodeSendVersion(node);
+            auto it = mapMsgByVersion.find(nVersion);
+            if (it == mapMsgByVersion.end())
+                it = mapMsgByVersion.emplace(nVersion, ShareMessage(make(nVersion))).first;
+            PushMessage(node, it->second);
+            nSent++;
+        }
+        return nSent;
+    }
+
+    template<typename MakeMsg>
+    int BroadcastMessage(MakeMsg&& make)
+    {
+        return BroadcastMessage(AllNodes, make);
+    }
 
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func)
@@ -450,6 +498,7 @@ private:
 
     // Whether the node should be passed out in ForEach* callbacks
     static bool NodeFullyConnected(const CNode* pnode);
+    static int NodeSendVersion(const CNode* pnode);
 
     // Network usage totals
     CCriticalSection cs_totalBytesRecv;
@@ -694,7 +743,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<std::shared_ptr<const std::vector<unsigned char>>> vSendMsg; // may be shared with other nodes
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -9,6 +9,7 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "cachemap.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
@@ -138,6 +139,12 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Serialized getdata answers for objects whose content is fixed by their
+     * hash, keyed by inv and send version, so an object every peer asks for is
+     * serialized and checksummed once. Protected by cs_main. */
+    static const unsigned int RELAY_MSG_CACHE_SIZE = 512;
+    CacheMap<std::pair<CInv, int>, CSharedNetMsg> mapRelayMsgCache(RELAY_MSG_CACHE_SIZE);
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -801,8 +808,8 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_compact_block = pcmpctblock;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    CSharedNetMsg msgCmpctBlock; // serialized for the first peer, then shared
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock, &msgCmpctBlock](CNode* pnode) {
         if (pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -814,7 +821,9 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (msgCmpctBlock.IsNull())
+                msgCmpctBlock = CConnman::ShareMessage(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, msgCmpctBlock);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1022,6 +1031,25 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/** Answer a getdata for inv from mapRelayMsgCache, building the message with
+ * make(msgRet) on a miss. The caller checks that the object is still known. */
+template<typename MakeMsg>
+static bool PushRelayMessage(CConnman& connman, CNode* pfrom, const CInv& inv, MakeMsg&& make)
+{
+    AssertLockHeld(cs_main);
+    std::pair<CInv, int> key(inv, pfrom->GetSendVersion());
+    CSharedNetMsg msg;
+    if (!mapRelayMsgCache.Get(key, msg)) {
+        CSerializedNetMsg msgNew;
+        if (!make(msgNew))
+            return false;
+        msg = CConnman::ShareMessage(std::move(msgNew));
+        mapRelayMsgCache.Insert(key, msg);
+    }
+    connman.PushMessage(pfrom, msg);
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -1092,49 +1120,55 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_FILTERED_BLOCK)
-                    {
-                        bool sendMerkleBlock = false;
-                        CMerkleBlock merkleBlock;
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they won't have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    bool fFullBlock = inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK &&
+                            !(CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH));
+                    if (fFullBlock) {
+                        // Send the block as stored on disk, which is also its network serialization
+                        CSerializedNetMsg msg;
+                        msg.command = NetMsgType::BLOCK;
+                        if (!ReadRawBlockFromDisk(msg.data, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, std::move(msg));
+                    } else {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
+                        if (inv.type == MSG_FILTERED_BLOCK)
                         {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                sendMerkleBlock = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                            bool sendMerkleBlock = false;
+                            CMerkleBlock merkleBlock;
+                            {
+                                LOCK(pfrom->cs_filter);
+                                if (pfrom->pfilter) {
+                                    sendMerkleBlock = true;
+                                    merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                                }
                             }
+                            if (sendMerkleBlock) {
+                                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TX, *block.vtx[pair.first]));
+                            }
+                            // else
+                                // no response
                         }
-                        if (sendMerkleBlock) {
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TX, *block.vtx[pair.first]));
-                        }
-                        // else
-                            // no response
-                    }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they won't have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                        else if (inv.type == MSG_CMPCT_BLOCK)
+                        {
                             CBlockHeaderAndShortTxIDs cmpctblock(block);
                             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, cmpctblock));
-                        } else
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                        }
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -1175,16 +1209,20 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 if (!push && inv.type == MSG_TXLOCK_REQUEST) {
                     CTxLockRequest txLockRequest;
                     if(instantsend.GetTxLockRequest(inv.hash, txLockRequest)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TXLOCKREQUEST, txLockRequest));
-                        push = true;
+                        push = PushRelayMessage(connman, pfrom, inv, [&](CSerializedNetMsg& msgRet) {
+                            msgRet = msgMaker.Make(NetMsgType::TXLOCKREQUEST, txLockRequest);
+                            return true;
+                        });
                     }
                 }
 
                 if (!push && inv.type == MSG_TXLOCK_VOTE) {
                     CTxLockVote vote;
                     if(instantsend.GetTxLockVote(inv.hash, vote)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TXLOCKVOTE, vote));
-                        push = true;
+                        push = PushRelayMessage(connman, pfrom, inv, [&](CSerializedNetMsg& msgRet) {
+                            msgRet = msgMaker.Make(NetMsgType::TXLOCKVOTE, vote);
+                            return true;
+                        });
                     }
                 }
 
@@ -1241,6 +1279,14 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
                 }
 
+                if (!push && (inv.type == MSG_MASTERNODE_ANNOUNCE || inv.type == MSG_MASTERNODE_PING)) {
+                    CSharedNetMsg msg;
+                    if(mnodeman.GetRelayMessage(inv, pfrom->GetSendVersion(), msg)) {
+                        connman.PushMessage(pfrom, msg);
+                        push = true;
+                    }
+                }
+
                 if (!push && inv.type == MSG_MASTERNODE_ANNOUNCE) {
                     if(mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)){
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNANNOUNCE, mnodeman.mapSeenMasternodeBroadcast[inv.hash].second));
@@ -1248,6 +1294,14 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
                 }
 
+                if (!push && (inv.type == MSG_FUNDAMENTALNODE_ANNOUNCE || inv.type == MSG_FUNDAMENTALNODE_PING)) {
+                    CSharedNetMsg msg;
+                    if(fnodeman.GetRelayMessage(inv, pfrom->GetSendVersion(), msg)) {
+                        connman.PushMessage(pfrom, msg);
+                        push = true;
+                    }
+                }
+
                 if (!push && inv.type == MSG_FUNDAMENTALNODE_ANNOUNCE) {
                     if(fnodeman.mapSeenFundamentalnodeBroadcast.count(inv.hash)){
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::FNANNOUNCE, fnodeman.mapSeenFundamentalnodeBroadcast[inv.hash].second));
@@ -1297,20 +1351,18 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
 
                 if (!push && inv.type == MSG_GOVERNANCE_OBJECT_VOTE) {
-                    CDataStream ss(SER_NETWORK, pfrom->GetSendVersion());
-                    bool topush = false;
-                    {
-                        if(governance.HaveVoteForHash(inv.hash)) {
+                    if(governance.HaveVoteForHash(inv.hash)) {
+                        push = PushRelayMessage(connman, pfrom, inv, [&](CSerializedNetMsg& msgRet) {
+                            CDataStream ss(SER_NETWORK, pfrom->GetSendVersion());
                             ss.reserve(1000);
-                            if(governance.SerializeVoteForHash(inv.hash, ss)) {
-                                topush = true;
-                            }
-                        }
+                            if(!governance.SerializeVoteForHash(inv.hash, ss))
+                                return false;
+                            msgRet = msgMaker.Make(NetMsgType::MNGOVERNANCEOBJECTVOTE, ss);
+                            return true;
+                        });
                     }
-                    if(topush) {
+                    if(push) {
                         LogPrint("net", "ProcessGetData -- pushing: inv = %s\n", inv.ToString());
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNGOVERNANCEOBJECTVOTE, ss));
-                        push = true;
                     }
                 }
 
@@ -1370,10 +1422,115 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
 }
 
+namespace {
+    typedef std::function<void(CNode*, const std::string&, CDataStream&, CConnman&)> NetMsgHandler;
+
+    struct CNetMsgEntry {
+        /** SecureTag specific handlers, run in registration order. Empty for messages ProcessMessage handles itself. */
+        std::vector<NetMsgHandler> vHandlers;
+        std::atomic<uint64_t> nCount;
+        std::atomic<uint64_t> nBytes;
+        std::atomic<int64_t> nTimeMicros;
+
+        CNetMsgEntry() : nCount(0), nBytes(0), nTimeMicros(0) {}
+    };
+
+    /**
+     * Maps every known command to its handlers and counters. The map is filled
+     * once on first use and never modified afterwards, so lookups need no lock.
+     */
+    class CNetMsgTable
+    {
+    private:
+        std::unordered_map<std::string, std::unique_ptr<CNetMsgEntry> > mapEntries;
+        CNetMsgEntry entryOther;
+
+        void Register(const std::vector<std::string>& vCommands, const NetMsgHandler& handler)
+        {
+            for (const std::string& strCommand : vCommands) {
+                auto it = mapEntries.find(strCommand);
+                assert(it != mapEntries.end());
+                it->second->vHandlers.push_back(handler);
+            }
+        }
+
+    public:
+        CNetMsgTable()
+        {
+            for (const std::string& strCommand : getAllNetMessageTypes()) {
+                mapEntries.emplace(strCommand, std::unique_ptr<CNetMsgEntry>(new CNetMsgEntry()));
+            }
+
+            // keep the order the managers were historically called in, DSQUEUE goes to both PrivateSend sides
+#ifdef ENABLE_WALLET
+            Register({NetMsgType::DSQUEUE, NetMsgType::DSSTATUSUPDATE, NetMsgType::DSFINALTX, NetMsgType::DSCOMPLETE},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+#endif // ENABLE_WALLET
+            Register({NetMsgType::DSACCEPT, NetMsgType::DSQUEUE, NetMsgType::DSVIN, NetMsgType::DSSIGNFINALTX},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+            Register({NetMsgType::MNANNOUNCE, NetMsgType::MNPING, NetMsgType::DSEG, NetMsgType::MNVERIFY},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { mnodeman.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+            Register({NetMsgType::MASTERNODEPAYMENTSYNC, NetMsgType::MASTERNODEPAYMENTVOTE},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { mnpayments.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+            Register({NetMsgType::TXLOCKVOTE},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { instantsend.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+            Register({NetMsgType::SPORK, NetMsgType::GETSPORKS},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { sporkManager.ProcessSpork(pfrom, strCommand, vRecv, connman); });
+            Register({NetMsgType::SYNCSTATUSCOUNT},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { masternodeSync.ProcessMessage(pfrom, strCommand, vRecv); });
+            Register({NetMsgType::SYNCSTATUSCOUNTFN},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { fundamentalnodeSync.ProcessMessage(pfrom, strCommand, vRecv); });
+            Register({NetMsgType::MNGOVERNANCESYNC, NetMsgType::MNGOVERNANCEOBJECT, NetMsgType::MNGOVERNANCEOBJECTVOTE},
+                [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { governance.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        }
+
+        /** Return the entry of a known command or NULL */
+        CNetMsgEntry* Find(const std::string& strCommand) const
+        {
+            auto it = mapEntries.find(strCommand);
+            return it == mapEntries.end() ? NULL : it->second.get();
+        }
+
+        void RecordMessage(const std::string& strCommand, unsigned int nBytes, int64_t nTimeMicros)
+        {
+            CNetMsgEntry* pentry = Find(strCommand);
+            if (!pentry)
+                pentry = &entryOther;
+            pentry->nCount++;
+            pentry->nBytes += nBytes;
+            pentry->nTimeMicros += nTimeMicros;
+        }
+
+        std::vector<CNetMsgStats> GetStats() const
+        {
+            std::vector<CNetMsgStats> vStats;
+            for (const auto& entry : mapEntries) {
+                vStats.push_back(CNetMsgStats{entry.first, entry.second->nCount, entry.second->nBytes, entry.second->nTimeMicros});
+            }
+            vStats.push_back(CNetMsgStats{"*other*", entryOther.nCount, entryOther.nBytes, entryOther.nTimeMicros});
+            return vStats;
+        }
+    };
+
+    CNetMsgTable& GetNetMsgTable()
+    {
+        // constructed on first use, getAllNetMessageTypes() is not usable during static initialization
+        static CNetMsgTable netMsgTable;
+        return netMsgTable;
+    }
+} // anon namespace
+
+std::vector<CNetMsgStats> GetNetMsgStats()
+{
+    return GetNetMsgTable().GetStats();
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
 
+    const CNetMsgEntry* pMsgEntry = GetNetMsgTable().Find(strCommand);
+
     if (IsArgSet("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 0)) == 0)
     {
         LogPrintf("dropmessagestest DROPPING RECV MESSAGE\n");
@@ -1643,6 +1800,14 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return false;
     }
 
+    else if (pMsgEntry && !pMsgEntry->vHandlers.empty())
+    {
+        // SecureTag specific messages, dispatched without walking the rest of this chain
+        for (const NetMsgHandler& handler : pMsgEntry->vHandlers) {
+            handler(pfrom, strCommand, vRecv, connman);
+        }
+    }
+
     else if (strCommand == NetMsgType::ADDR)
     {
         std::vector<CAddress> vAddr;
@@ -2930,36 +3095,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // message would be undesirable as we transmit it ourselves.
     }
 
-    else {
-        bool found = false;
-        const std::vector<std::string> &allMessages = getAllNetMessageTypes();
-        BOOST_FOREACH(const std::string msg, allMessages) {
-            if(msg == strCommand) {
-                found = true;
-                break;
-            }
-        }
-
-        if (found)
-        {
-            //probably one the extensions
-#ifdef ENABLE_WALLET
-            privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman);
-#endif // ENABLE_WALLET
-            privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            mnodeman.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            mnpayments.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            instantsend.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            sporkManager.ProcessSpork(pfrom, strCommand, vRecv, connman);
-            masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
-            fundamentalnodeSync.ProcessMessage(pfrom, strCommand, vRecv);
-            governance.ProcessMessage(pfrom, strCommand, vRecv, connman);
-        }
-        else
-        {
-            // Ignore unknown commands for extensibility
-            LogPrint("net", "Unknown command \"%s\" from peer=%d\n", SanitizeString(strCommand), pfrom->id);
-        }
+    else if (!pMsgEntry) {
+        // Ignore unknown commands for extensibility
+        LogPrint("net", "Unknown command \"%s\" from peer=%d\n", SanitizeString(strCommand), pfrom->id);
     }
 
     return true;
@@ -3068,6 +3206,7 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
 
         // Process message
         bool fRet = false;
+        int64_t nTimeStart = GetThreadCPUTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
@@ -3105,6 +3244,8 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        GetNetMsgTable().RecordMessage(strCommand, nMessageSize, GetThreadCPUTimeMicros() - nTimeStart);
+
         if (!fRet) {
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
         }
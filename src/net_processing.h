@@ -54,6 +54,16 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
+struct CNetMsgStats {
+    std::string strCommand;
+    uint64_t nCount;
+    uint64_t nBytes;
+    int64_t nTimeMicros; //!< cumulative CPU time of the message handler thread
+};
+
+/** Get per-command message processing statistics, unknown commands are summed up under "*other*" */
+std::vector<CNetMsgStats> GetNetMsgStats();
+
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
 /**
@@ -11,15 +11,170 @@
 #include "crypto/common.h"
 #include "crypto/neoscrypt.h"
 
+#include <atomic>
+#include <string.h>
+
+bool fBlockHashCache = DEFAULT_BLOCK_HASH_CACHE;
+
+static const char* const BLOCKHASH_PATH_NAMES[BLOCKHASH_PATH_MAX] = {
+    "other",
+    "checkblockheader",
+    "acceptblockheader",
+    "readblockfromdisk",
+    "acceptproofofstakeblock",
+    "rpc",
+};
+
+static std::atomic<uint64_t> nBlockHashComputed[BLOCKHASH_PATH_MAX];
+static std::atomic<uint64_t> nBlockHashCached[BLOCKHASH_PATH_MAX];
+static std::atomic<uint64_t> nBlockHashTrusted[BLOCKHASH_PATH_MAX];
+static thread_local BlockHashPath currentBlockHashPath = BLOCKHASH_PATH_OTHER;
+
+CBlockHashScope::CBlockHashScope(BlockHashPath path) : prevPath(currentBlockHashPath)
+{
+    currentBlockHashPath = path;
+}
+
+CBlockHashScope::~CBlockHashScope()
+{
+    currentBlockHashPath = prevPath;
+}
+
+std::vector<CBlockHashPathStats> GetBlockHashStats()
+{
+    std::vector<CBlockHashPathStats> vStats;
+    for (int i = 0; i < BLOCKHASH_PATH_MAX; i++) {
+        CBlockHashPathStats stats;
+        stats.strPath = BLOCKHASH_PATH_NAMES[i];
+        stats.nComputed = nBlockHashComputed[i].load(std::memory_order_relaxed);
+        stats.nCached = nBlockHashCached[i].load(std::memory_order_relaxed);
+        stats.nTrusted = nBlockHashTrusted[i].load(std::memory_order_relaxed);
+        vStats.push_back(stats);
+    }
+    return vStats;
+}
+
+CBlockHeaderHashCache::CBlockHeaderHashCache(const CBlockHeaderHashCache& other) : nSequence(0)
+{
+    *this = other;
+}
+
+CBlockHeaderHashCache& CBlockHeaderHashCache::operator=(const CBlockHeaderHashCache& other)
+{
+    if (this == &other)
+        return *this;
+
+    unsigned char headerCopy[HEADER_SIZE];
+    uint256 hashCopy;
+    uint32_t nSeq = other.nSequence.load(std::memory_order_acquire);
+    if (nSeq == 0 || (nSeq & 1)) {
+        Clear();
+        return *this;
+    }
+    memcpy(headerCopy, other.header, HEADER_SIZE);
+    hashCopy = other.hash;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (other.nSequence.load(std::memory_order_relaxed) != nSeq) {
+        Clear();
+        return *this;
+    }
+    Set(headerCopy, hashCopy);
+    return *this;
+}
+
+bool CBlockHeaderHashCache::Get(const unsigned char* pheader, uint256& hashRet) const
+{
+    uint32_t nSeq = nSequence.load(std::memory_order_acquire);
+    if (nSeq == 0 || (nSeq & 1))
+        return false;
+    bool fMatch = memcmp(header, pheader, HEADER_SIZE) == 0;
+    uint256 hashCopy = hash;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!fMatch || nSequence.load(std::memory_order_relaxed) != nSeq)
+        return false;
+    hashRet = hashCopy;
+    return true;
+}
+
+void CBlockHeaderHashCache::Set(const unsigned char* pheader, const uint256& hashIn)
+{
+    // Only one writer at a time; a concurrent one just leaves the entry alone
+    uint32_t nSeq = nSequence.load(std::memory_order_relaxed);
+    if ((nSeq & 1) || !nSequence.compare_exchange_strong(nSeq, nSeq + 1, std::memory_order_acquire))
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header, pheader, HEADER_SIZE);
+    hash = hashIn;
+    // skip 0 on wrap-around, it marks an empty entry
+    nSequence.store(nSeq + 2 == 0 ? 2 : nSeq + 2, std::memory_order_release);
+}
+
+void CBlockHeaderHashCache::Clear()
+{
+    nSequence.store(0, std::memory_order_release);
+}
+
 uint256 CBlockHeader::GetHash() const
 {
+        // nVersion..nNonce are laid out contiguously and form the 80 byte header
+        const unsigned char* pheader = (const unsigned char *) &nVersion;
+
         uint256 thash;
+        if (fBlockHashCache && hashCache.Get(pheader, thash)) {
+            nBlockHashCached[currentBlockHashPath].fetch_add(1, std::memory_order_relaxed);
+            return thash;
+        }
+
         unsigned int profile = 0x0;
-        neoscrypt((unsigned char *) &nVersion, (unsigned char *) &thash, profile);
+        neoscrypt(pheader, (unsigned char *) &thash, profile);
+        nBlockHashComputed[currentBlockHashPath].fetch_add(1, std::memory_order_relaxed);
+
+        if (fBlockHashCache)
+            hashCache.Set(pheader, thash);
         return thash;
 
 }
 
+void CBlockHeader::SetTrustedHash(const uint256& hash) const
+{
+    nBlockHashTrusted[currentBlockHashPath].fetch_add(1, std::memory_order_relaxed);
+    if (fBlockHashCache)
+        hashCache.Set((const unsigned char *) &nVersion, hash);
+}
+
+void NeoScryptBatch(const CBlockHeader* headers, size_t n, uint256* out)
+{
+    const size_t nHeaderSize = CBlockHeaderHashCache::HEADER_SIZE;
+    std::vector<size_t> vMissing;
+    std::vector<unsigned char> vInput;
+    vMissing.reserve(n);
+    vInput.reserve(n * nHeaderSize);
+
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char* pheader = (const unsigned char *) &headers[i].nVersion;
+        if (fBlockHashCache && headers[i].hashCache.Get(pheader, out[i])) {
+            nBlockHashCached[currentBlockHashPath].fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        vMissing.push_back(i);
+        vInput.insert(vInput.end(), pheader, pheader + nHeaderSize);
+    }
+
+    if (vMissing.empty())
+        return;
+
+    std::vector<uint256> vOutput(vMissing.size());
+    neoscrypt_batch(vInput.data(), vOutput[0].begin(), vMissing.size());
+    nBlockHashComputed[currentBlockHashPath].fetch_add(vMissing.size(), std::memory_order_relaxed);
+
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        const size_t i = vMissing[j];
+        out[i] = vOutput[j];
+        if (fBlockHashCache)
+            headers[i].hashCache.Set(&vInput[j * nHeaderSize], vOutput[j]);
+    }
+}
+
 bool CBlock::IsProofOfStake() const
 {
     return (vtx.size() > 1 && vtx[1]->IsCoinStake());
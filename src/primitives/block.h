@@ -10,6 +10,76 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <atomic>
+
+/** Whether CBlockHeader::GetHash() memoizes its result (-blockhashcache). */
+extern bool fBlockHashCache;
+static const bool DEFAULT_BLOCK_HASH_CACHE = true;
+
+/** Code paths that NeoScrypt header hash evaluations are attributed to. */
+enum BlockHashPath
+{
+    BLOCKHASH_PATH_OTHER,
+    BLOCKHASH_PATH_CHECKHEADER,
+    BLOCKHASH_PATH_ACCEPTHEADER,
+    BLOCKHASH_PATH_READBLOCK,
+    BLOCKHASH_PATH_ACCEPTPOS,
+    BLOCKHASH_PATH_RPC,
+    BLOCKHASH_PATH_MAX
+};
+
+/** RAII helper that attributes every GetHash() call made by the current
+ * thread while it is alive to the given path. Scopes nest; the innermost wins.
+ */
+class CBlockHashScope
+{
+private:
+    BlockHashPath prevPath;
+
+public:
+    explicit CBlockHashScope(BlockHashPath path);
+    ~CBlockHashScope();
+};
+
+struct CBlockHashPathStats
+{
+    std::string strPath;
+    uint64_t nComputed; //! full NeoScrypt evaluations
+    uint64_t nCached;   //! answered from the memoized hash
+    uint64_t nTrusted;  //! skipped because the caller already knew the hash
+};
+
+/** Snapshot of the per-path GetHash() counters, one entry per BlockHashPath. */
+std::vector<CBlockHashPathStats> GetBlockHashStats();
+
+/** Memoized header hash. The hash is stored together with the serialized
+ * header it was computed from, so assigning to any header field invalidates
+ * it without the field having to know about the cache.
+ *
+ * nSequence is odd while a writer fills in the entry and 0 while it is
+ * empty. Readers take the entry only if nSequence is the same even, non-zero
+ * value before and after copying it, so GetHash() never takes a lock.
+ */
+class CBlockHeaderHashCache
+{
+public:
+    static const size_t HEADER_SIZE = 80;
+
+private:
+    std::atomic<uint32_t> nSequence;
+    unsigned char header[HEADER_SIZE];
+    uint256 hash;
+
+public:
+    CBlockHeaderHashCache() : nSequence(0) {}
+    CBlockHeaderHashCache(const CBlockHeaderHashCache& other);
+    CBlockHeaderHashCache& operator=(const CBlockHeaderHashCache& other);
+
+    bool Get(const unsigned char* pheader, uint256& hashRet) const;
+    void Set(const unsigned char* pheader, const uint256& hashIn);
+    void Clear();
+};
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -28,6 +98,9 @@ public:
     uint32_t nBits;
     uint32_t nNonce;
 
+    // memory only
+    mutable CBlockHeaderHashCache hashCache;
+
     CBlockHeader()
     {
         SetNull();
@@ -55,7 +128,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
-
+        hashCache.Clear();
     }
 
     bool IsNull() const
@@ -65,6 +138,9 @@ public:
 
     uint256 GetHash() const;
 
+    /** Seed the memoized hash with a value the caller has already validated
+     * (e.g. the hash stored in the block index), avoiding a NeoScrypt pass. */
+    void SetTrustedHash(const uint256& hash) const;
 
     int64_t GetBlockTime() const
     {
@@ -128,14 +204,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        return block;
+        // Slicing copy, so the memoized hash travels with the header
+        return *static_cast<const CBlockHeader*>(this);
     }
     bool IsProofOfStake() const;
     bool IsProofOfWork() const;
@@ -144,6 +214,12 @@ public:
 };
 
 
+/** Hash n headers at once, using the widest NeoScrypt kernel the CPU supports.
+ * Headers whose hash is already memoized are served from their cache; the
+ * others get it filled in, so later GetHash() calls on them are free.
+ */
+void NeoScryptBatch(const CBlockHeader* headers, size_t n, uint256* out);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
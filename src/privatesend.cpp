@@ -113,10 +113,10 @@ bool CDarksendQueue::CheckSignature(const CPubKey& pubKeyMasternode) const
 
 bool CDarksendQueue::Relay(CConnman& connman)
 {
-    connman.ForEachNode([&connman, this](CNode* pnode) {
-        CNetMsgMaker msgMaker(pnode->GetSendVersion());
-        if (pnode->nVersion >= MIN_PRIVATESEND_PEER_PROTO_VERSION)
-            connman.PushMessage(pnode, msgMaker.Make(NetMsgType::DSQUEUE, (*this)));
+    connman.BroadcastMessage([](CNode* pnode) {
+        return pnode->nVersion >= MIN_PRIVATESEND_PEER_PROTO_VERSION;
+    }, [this](int nVersion) {
+        return CNetMsgMaker(nVersion).Make(NetMsgType::DSQUEUE, (*this));
     });
     return true;
 }
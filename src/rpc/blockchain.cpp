@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockindexer.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -615,6 +616,16 @@ UniValue getmempoolentry(const JSONRPCRequest& request)
     return info;
 }
 
+/** Throw unless the address, spent and timestamp indexes cover the active chain,
+ *  waiting a bit for the block indexer to catch up with the last blocks */
+void EnsureBlockIndexesSynced()
+{
+    static const int64_t BLOCK_INDEXES_SYNC_TIMEOUT = 10 * 1000;
+
+    if (pblockindexer && !pblockindexer->BlockUntilSynced(BLOCK_INDEXES_SYNC_TIMEOUT))
+        throw JSONRPCError(RPC_IN_WARMUP, strprintf("Block indexes are still being built (height %d)", pblockindexer->GetHeight()));
+}
+
 UniValue getblockhashes(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 2)
@@ -637,6 +648,7 @@ UniValue getblockhashes(const JSONRPCRequest& request)
     unsigned int low = request.params[1].get_int();
     std::vector<uint256> blockHashes;
 
+    EnsureBlockIndexesSynced();
     if (!GetTimestampIndex(high, low, blockHashes)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for block hashes");
     }
@@ -1449,6 +1461,14 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    GetScriptExecutionCacheStats(nHits, nMisses);
+    UniValue scriptcache(UniValue::VOBJ);
+    scriptcache.push_back(Pair("hits", nHits));
+    scriptcache.push_back(Pair("misses", nMisses));
+    ret.push_back(Pair("scriptcache", scriptcache));
+
     return ret;
 }
 
@@ -1464,7 +1484,11 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"scriptcache\": {             (json object) Script execution cache lookups while connecting blocks\n"
+            "    \"hits\": xxxxx,             (numeric) Transactions whose scripts were validated on mempool acceptance\n"
+            "    \"misses\": xxxxx            (numeric) Transactions whose scripts had to be executed\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1474,6 +1498,57 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getblockhashstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getblockhashstats\n"
+            "\nReturns how many block header hashes each code path requested, split into\n"
+            "full NeoScrypt evaluations, answers served from the memoized hash and\n"
+            "evaluations avoided because the hash was already known from the block index.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,       (boolean) Whether -blockhashcache is active\n"
+            "  \"paths\": {\n"
+            "    \"path\": {                  (string) Code path name\n"
+            "      \"computed\": xxxxx,       (numeric) NeoScrypt evaluations\n"
+            "      \"cached\": xxxxx,         (numeric) Hashes served from the cache\n"
+            "      \"trusted\": xxxxx         (numeric) Evaluations avoided by trusted block reads\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"computed\": xxxxx,           (numeric) Total NeoScrypt evaluations\n"
+            "  \"cached\": xxxxx,             (numeric) Total hashes served from the cache\n"
+            "  \"trusted\": xxxxx             (numeric) Total evaluations avoided by trusted block reads\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashstats", "")
+            + HelpExampleRpc("getblockhashstats", "")
+        );
+
+    uint64_t nComputed = 0;
+    uint64_t nCached = 0;
+    uint64_t nTrusted = 0;
+    UniValue paths(UniValue::VOBJ);
+    for (const CBlockHashPathStats& stats : GetBlockHashStats()) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("computed", stats.nComputed));
+        entry.push_back(Pair("cached", stats.nCached));
+        entry.push_back(Pair("trusted", stats.nTrusted));
+        paths.push_back(Pair(stats.strPath, entry));
+        nComputed += stats.nComputed;
+        nCached += stats.nCached;
+        nTrusted += stats.nTrusted;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("enabled", fBlockHashCache));
+    ret.push_back(Pair("paths", paths));
+    ret.push_back(Pair("computed", nComputed));
+    ret.push_back(Pair("cached", nCached));
+    ret.push_back(Pair("trusted", nTrusted));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1596,6 +1671,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockhashes",         &getblockhashes,         true,  {"high","low"} },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
+    { "blockchain",         "getblockhashstats",      &getblockhashstats,      true,  {} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockheaders",        &getblockheaders,        true,  {"blockhash","count","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {"count","branchlen"} },
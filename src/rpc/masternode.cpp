@@ -142,7 +142,7 @@ UniValue masternode(const JSONRPCRequest& request)
 #endif // ENABLE_WALLET
          strCommand != "list" && strCommand != "list-conf" && strCommand != "count" &&
          strCommand != "debug" && strCommand != "current" && strCommand != "winner" && strCommand != "winners" && strCommand != "genkey" &&
-         strCommand != "connect" && strCommand != "status"))
+         strCommand != "connect" && strCommand != "status" && strCommand != "rankcache"))
             throw std::runtime_error(
                 "masternode \"command\"...\n"
                 "Set of commands to execute masternode related actions\n"
@@ -160,6 +160,7 @@ UniValue masternode(const JSONRPCRequest& request)
                 "  status       - Print masternode status information\n"
                 "  list         - Print list of all known masternodes (see masternodelist for more info)\n"
                 "  list-conf    - Print masternode.conf in JSON format\n"
+                "  rankcache    - Print masternode rank cache statistics\n"
                 "  winner       - Print info on next masternode winner to vote for\n"
                 "  winners      - Print list of masternode winners\n"
                 );
@@ -194,6 +195,19 @@ UniValue masternode(const JSONRPCRequest& request)
         return "successfully connected";
     }
 
+    if (strCommand == "rankcache")
+    {
+        uint64_t nHits, nMisses;
+        size_t nSize;
+        mnodeman.GetRankCacheStats(nHits, nMisses, nSize);
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("hits", nHits));
+        obj.push_back(Pair("misses", nMisses));
+        obj.push_back(Pair("size", (uint64_t)nSize));
+        return obj;
+    }
+
     if (strCommand == "count")
     {
         if (request.params.size() > 2)
@@ -954,7 +968,7 @@ UniValue fundamentalnode(const JSONRPCRequest& request)
 #endif // ENABLE_WALLET
          strCommand != "list" && strCommand != "list-conf" && strCommand != "count" &&
          strCommand != "debug" && strCommand != "current" && strCommand != "winner" && strCommand != "winners" && strCommand != "genkey" &&
-         strCommand != "connect" && strCommand != "status"))
+         strCommand != "connect" && strCommand != "status" && strCommand != "rankcache"))
             throw std::runtime_error(
                 "fundamentalnode \"command\"...\n"
                 "Set of commands to execute fundamentalnode related actions\n"
@@ -972,6 +986,7 @@ UniValue fundamentalnode(const JSONRPCRequest& request)
                 "  status       - Print fundamentalnode status information\n"
                 "  list         - Print list of all known fundamentalnodes (see fundamentalnodelist for more info)\n"
                 "  list-conf    - Print fundamentalnode.conf in JSON format\n"
+                "  rankcache    - Print fundamentalnode rank cache statistics\n"
                 "  winner       - Print info on next fundamentalnode winner to vote for\n"
                 "  winners      - Print list of fundamentalnode winners\n"
                 );
@@ -1006,6 +1021,19 @@ UniValue fundamentalnode(const JSONRPCRequest& request)
         return "successfully connected";
     }
 
+    if (strCommand == "rankcache")
+    {
+        uint64_t nHits, nMisses;
+        size_t nSize;
+        fnodeman.GetRankCacheStats(nHits, nMisses, nSize);
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("hits", nHits));
+        obj.push_back(Pair("misses", nMisses));
+        obj.push_back(Pair("size", (uint64_t)nSize));
+        return obj;
+    }
+
     if (strCommand == "count")
     {
         if (request.params.size() > 2)
@@ -7,6 +7,7 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "miner.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
@@ -810,6 +811,8 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    EnsureBlockIndexesSynced();
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -894,6 +897,8 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    EnsureBlockIndexesSynced();
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -959,22 +964,18 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
+    EnsureBlockIndexesSynced();
 
     CAmount balance = 0;
     CAmount received = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance((*it).first, (*it).second, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += value.balance;
+        received += value.received;
     }
 
     UniValue result(UniValue::VOBJ);
@@ -1017,6 +1018,8 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    EnsureBlockIndexesSynced();
+
     int start = 0;
     int end = 0;
     if (request.params[0].isObject()) {
@@ -1100,6 +1103,8 @@ UniValue getspentinfo(const JSONRPCRequest& request)
     uint256 txid = ParseHashV(txidValue, "txid");
     int outputIndex = indexValue.get_int();
 
+    EnsureBlockIndexesSynced();
+
     CSpentIndexKey key(txid, outputIndex);
     CSpentIndexValue value;
 
@@ -1187,6 +1192,10 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
                 "  \"fnsync\": true|false,             (boolean) if fundamentalnode data is synced\n"
                 "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
                 "  \"staking tpos txid\" ,             (string)  if the wallet is tposing or not\n"
+                "  \"kernelstried\": n,                (numeric) number of stake kernels hashed since startup\n"
+                "  \"kernelspersecond\": n,            (numeric) kernel hashing rate while searching\n"
+                "  \"templates\": n,                   (numeric) number of blocks built around a kernel hit\n"
+                "  \"lasttemplatetime\": n,            (numeric) milliseconds from the last kernel hit to a signed block\n"
                 "}\n"
                 "\nExamples:\n" +
                 HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -1204,6 +1213,12 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
     if (nLastCoinStakeSearchInterval > 0)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
+    uint64_t nKernelsTried = stakeMinerStats.nKernelsTried;
+    int64_t nSearchMicros = stakeMinerStats.nSearchMicros;
+    obj.push_back(Pair("kernelstried", nKernelsTried));
+    obj.push_back(Pair("kernelspersecond", nSearchMicros > 0 ? (double)nKernelsTried * 1000000 / nSearchMicros : 0.0));
+    obj.push_back(Pair("templates", (uint64_t)stakeMinerStats.nTemplates));
+    obj.push_back(Pair("lasttemplatetime", 0.001 * stakeMinerStats.nLastTemplateMicros));
     uint256 txId;
     return obj;
 }
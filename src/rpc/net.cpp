@@ -390,6 +390,43 @@ static UniValue GetNetworksInfo()
     return networks;
 }
 
+UniValue getmessagestats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getmessagestats\n"
+            "\nReturns per-command statistics of the messages processed by the message handler thread.\n"
+            "Only commands received at least once are listed, unknown commands are summed up under \"*other*\".\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {           (json object) The message command\n"
+            "    \"count\": n,          (numeric) Number of messages processed\n"
+            "    \"bytes\": n,          (numeric) Total payload size in bytes\n"
+            "    \"cputime\": n         (numeric) Total CPU time spent processing them, in microseconds\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmessagestats", "")
+            + HelpExampleRpc("getmessagestats", "")
+        );
+
+    std::vector<CNetMsgStats> vStats = GetNetMsgStats();
+    std::sort(vStats.begin(), vStats.end(), [](const CNetMsgStats& a, const CNetMsgStats& b) { return a.strCommand < b.strCommand; });
+
+    UniValue obj(UniValue::VOBJ);
+    for (const CNetMsgStats& stats : vStats) {
+        if (stats.nCount == 0)
+            continue;
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("count", stats.nCount));
+        entry.push_back(Pair("bytes", stats.nBytes));
+        entry.push_back(Pair("cputime", stats.nTimeMicros));
+        obj.push_back(Pair(stats.strCommand, entry));
+    }
+    return obj;
+}
+
 UniValue getnetworkinfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -611,6 +648,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true,  {"address"} },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
+    { "network",            "getmessagestats",        &getmessagestats,        true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
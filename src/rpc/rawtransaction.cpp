@@ -208,8 +208,6 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", true")
         );
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
     // Accept either a bool (true) or a num (>=1) to indicate verbose output.
@@ -230,6 +228,12 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
         }
     }
 
+    // the verbose result carries spent index information
+    if (fVerbose && fSpentIndex)
+        EnsureBlockIndexesSynced();
+
+    LOCK(cs_main);
+
     CTransactionRef tx;
     uint256 hashBlock;
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
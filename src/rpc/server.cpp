@@ -480,6 +480,7 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    CBlockHashScope hashScope(BLOCKHASH_PATH_RPC);
     try
     {
         // Execute, convert arguments to array if necessary
@@ -0,0 +1,143 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexer.h"
+#include "chain.h"
+#include "txdb.h"
+#include "undo.h"
+#include "validation.h"
+
+#include "test/test_securetag.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(address_balance_connect_disconnect)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashAddress;
+    *hashAddress.begin() = 1;
+    uint256 txid1 = uint256S("0x11");
+    uint256 txid2 = uint256S("0x12");
+
+    // block 1 pays the address twice in one transaction
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block1;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, hashAddress, 1, 0, txid1, 0, false), 10 * COIN));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, hashAddress, 1, 0, txid1, 1, false), 5 * COIN));
+    // block 2 spends one of the outputs
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block2;
+    block2.push_back(std::make_pair(CAddressIndexKey(1, hashAddress, 2, 1, txid2, 0, true), -10 * COIN));
+
+    BOOST_CHECK(db.WriteAddressIndex(block1));
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+
+    CAddressBalanceValue value;
+    BOOST_CHECK(db.ReadAddressBalance(hashAddress, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 5 * COIN);
+    BOOST_CHECK_EQUAL(value.received, 15 * COIN);
+    BOOST_CHECK_EQUAL(value.txCount, 2U);
+
+    // connecting the same block again, e.g. after an unclean shutdown, changes nothing
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+    BOOST_CHECK(db.ReadAddressBalance(hashAddress, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 5 * COIN);
+    BOOST_CHECK_EQUAL(value.txCount, 2U);
+
+    // the migration arrives at the same record
+    BOOST_CHECK(db.BuildAddressBalanceIndex());
+    BOOST_CHECK(db.ReadAddressBalance(hashAddress, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 5 * COIN);
+    BOOST_CHECK_EQUAL(value.received, 15 * COIN);
+    BOOST_CHECK_EQUAL(value.txCount, 2U);
+
+    BOOST_CHECK(db.EraseAddressIndex(block2));
+    BOOST_CHECK(db.ReadAddressBalance(hashAddress, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 15 * COIN);
+    BOOST_CHECK_EQUAL(value.txCount, 1U);
+
+    BOOST_CHECK(db.EraseAddressIndex(block1));
+    BOOST_CHECK(!db.ReadAddressBalance(hashAddress, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 0);
+}
+
+static CScript GetScriptForKeyID(const uint160& hash)
+{
+    return CScript() << OP_DUP << OP_HASH160 << ToByteVector(hash) << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+BOOST_AUTO_TEST_CASE(block_index_entries_connect_disconnect)
+{
+    uint160 hashA, hashB;
+    *hashA.begin() = 1;
+    *hashB.begin() = 2;
+    COutPoint outpointPrev(uint256S("0x21"), 0);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(50 * COIN, GetScriptForKeyID(hashA)));
+    // pays A from an output of B
+    CMutableTransaction tx1;
+    tx1.vin.push_back(CTxIn(outpointPrev));
+    tx1.vout.push_back(CTxOut(9 * COIN, GetScriptForKeyID(hashA)));
+    // spends that output within the same block
+    CMutableTransaction tx2;
+    tx2.vin.push_back(CTxIn(COutPoint(tx1.GetHash(), 0)));
+    tx2.vout.push_back(CTxOut(8 * COIN, GetScriptForKeyID(hashB)));
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(tx1));
+    block.vtx.push_back(MakeTransactionRef(tx2));
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(2);
+    blockundo.vtxundo[0].vprevout.push_back(Coin(CTxOut(10 * COIN, GetScriptForKeyID(hashB)), 5, false, false));
+    blockundo.vtxundo[1].vprevout.push_back(Coin(CTxOut(9 * COIN, GetScriptForKeyID(hashA)), 7, false, false));
+    CBlockIndex index;
+    index.nHeight = 7;
+
+    bool fAddressIndexOld = fAddressIndex, fSpentIndexOld = fSpentIndex;
+    fAddressIndex = fSpentIndex = true;
+    CBlockIndexEntries connect, disconnect;
+    BOOST_CHECK(GetBlockIndexEntries(block, blockundo, &index, true, connect));
+    BOOST_CHECK(GetBlockIndexEntries(block, blockundo, &index, false, disconnect));
+    fAddressIndex = fAddressIndexOld;
+    fSpentIndex = fSpentIndexOld;
+
+    // 3 outputs and 2 spends, both ways
+    BOOST_CHECK_EQUAL(connect.addressIndex.size(), 5U);
+    BOOST_CHECK_EQUAL(disconnect.addressIndex.size(), 5U);
+    BOOST_CHECK_EQUAL(connect.spentIndex.size(), 2U);
+    BOOST_CHECK(connect.spentIndex[0].second.txid == tx1.GetHash());
+    BOOST_CHECK(connect.spentIndex[0].second.addressHash == hashB);
+    BOOST_CHECK(disconnect.spentIndex[0].second.IsNull());
+
+    // the unspent index only keeps what is left unspent after the block,
+    // and is back to the output of B after disconnecting it
+    std::map<std::pair<uint256, size_t>, CAddressUnspentValue> unspent;
+    std::pair<uint256, size_t> keyPrev(outpointPrev.hash, outpointPrev.n);
+    unspent[keyPrev] = CAddressUnspentValue(10 * COIN, GetScriptForKeyID(hashB), 5);
+    for (const auto& entry : connect.addressUnspentIndex) {
+        if (entry.second.IsNull()) {
+            unspent.erase(std::make_pair(entry.first.txhash, entry.first.index));
+        } else {
+            unspent[std::make_pair(entry.first.txhash, entry.first.index)] = entry.second;
+        }
+    }
+    BOOST_CHECK_EQUAL(unspent.size(), 2U);
+    BOOST_CHECK(!unspent.count(keyPrev));
+    BOOST_CHECK(unspent.count(std::make_pair(tx2.GetHash(), (size_t)0)));
+    for (const auto& entry : disconnect.addressUnspentIndex) {
+        if (entry.second.IsNull()) {
+            unspent.erase(std::make_pair(entry.first.txhash, entry.first.index));
+        } else {
+            unspent[std::make_pair(entry.first.txhash, entry.first.index)] = entry.second;
+        }
+    }
+    BOOST_CHECK_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK_EQUAL(unspent[keyPrev].satoshis, 10 * COIN);
+    BOOST_CHECK_EQUAL(unspent[keyPrev].blockHeight, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/block.h"
+#include "random.h"
+#include "test/test_securetag.h"
+#include "test/test_random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockhash_tests, BasicTestingSetup)
+
+static uint64_t CountComputed(BlockHashPath path)
+{
+    return GetBlockHashStats()[path].nComputed;
+}
+
+static uint64_t CountCached(BlockHashPath path)
+{
+    return GetBlockHashStats()[path].nCached;
+}
+
+static CBlockHeader RandomHeader()
+{
+    CBlockHeader header;
+    header.nVersion = insecure_rand();
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = insecure_rand();
+    header.nBits = insecure_rand();
+    header.nNonce = insecure_rand();
+    return header;
+}
+
+BOOST_AUTO_TEST_CASE(blockhash_cache_hit)
+{
+    CBlockHashScope scope(BLOCKHASH_PATH_CHECKHEADER);
+    CBlockHeader header = RandomHeader();
+
+    uint64_t nComputed = CountComputed(BLOCKHASH_PATH_CHECKHEADER);
+    uint64_t nCached = CountCached(BLOCKHASH_PATH_CHECKHEADER);
+    uint256 hash = header.GetHash();
+    BOOST_CHECK(header.GetHash() == hash);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_CHECKHEADER), nComputed + 1);
+    BOOST_CHECK_EQUAL(CountCached(BLOCKHASH_PATH_CHECKHEADER), nCached + 1);
+
+    // Copies carry the memoized hash along
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == hash);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_CHECKHEADER), nComputed + 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockhash_cache_invalidation)
+{
+    CBlockHeader header = RandomHeader();
+    uint256 hash = header.GetHash();
+
+    header.nNonce++;
+    uint256 hashNonce = header.GetHash();
+    BOOST_CHECK(hashNonce != hash);
+
+    fBlockHashCache = false;
+    BOOST_CHECK(header.GetHash() == hashNonce);
+    header.nNonce--;
+    BOOST_CHECK(header.GetHash() == hash);
+    fBlockHashCache = true;
+
+    // The cache still holds the hash of the incremented nonce
+    BOOST_CHECK(header.GetHash() == hash);
+    header.hashMerkleRoot = GetRandHash();
+    BOOST_CHECK(header.GetHash() != hash);
+}
+
+BOOST_AUTO_TEST_CASE(blockhash_scope_nesting)
+{
+    CBlockHeader header = RandomHeader();
+    uint64_t nOuter = CountComputed(BLOCKHASH_PATH_ACCEPTHEADER);
+    uint64_t nInner = CountComputed(BLOCKHASH_PATH_CHECKHEADER);
+    {
+        CBlockHashScope outer(BLOCKHASH_PATH_ACCEPTHEADER);
+        {
+            CBlockHashScope inner(BLOCKHASH_PATH_CHECKHEADER);
+            header.GetHash();
+        }
+        header.nNonce++;
+        header.GetHash();
+    }
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_ACCEPTHEADER), nOuter + 1);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_CHECKHEADER), nInner + 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockhash_batch)
+{
+    // Not a multiple of the 4-way width, with one header already memoized
+    std::vector<CBlockHeader> headers;
+    for (int i = 0; i < 11; i++)
+        headers.push_back(RandomHeader());
+    uint256 hashKnown = headers[5].GetHash();
+
+    std::vector<uint256> hashes(headers.size());
+    NeoScryptBatch(headers.data(), headers.size(), hashes.data());
+    BOOST_CHECK(hashes[5] == hashKnown);
+
+    fBlockHashCache = false;
+    for (size_t i = 0; i < headers.size(); i++)
+        BOOST_CHECK(headers[i].GetHash() == hashes[i]);
+    fBlockHashCache = true;
+
+    // Every header now has its hash memoized
+    uint64_t nComputed = CountComputed(BLOCKHASH_PATH_OTHER);
+    for (size_t i = 0; i < headers.size(); i++)
+        BOOST_CHECK(headers[i].GetHash() == hashes[i]);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_OTHER), nComputed);
+}
+
+BOOST_AUTO_TEST_CASE(blockhash_trusted)
+{
+    CBlockHashScope scope(BLOCKHASH_PATH_READBLOCK);
+    CBlockHeader header = RandomHeader();
+    uint256 hashKnown = GetRandHash();
+
+    uint64_t nComputed = CountComputed(BLOCKHASH_PATH_READBLOCK);
+    uint64_t nTrusted = GetBlockHashStats()[BLOCKHASH_PATH_READBLOCK].nTrusted;
+    header.SetTrustedHash(hashKnown);
+    BOOST_CHECK(header.GetHash() == hashKnown);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_READBLOCK), nComputed);
+    BOOST_CHECK_EQUAL(GetBlockHashStats()[BLOCKHASH_PATH_READBLOCK].nTrusted, nTrusted + 1);
+
+    // A trusted hash only holds for the header it was given for
+    header.nTime++;
+    BOOST_CHECK(header.GetHash() != hashKnown);
+    BOOST_CHECK_EQUAL(CountComputed(BLOCKHASH_PATH_READBLOCK), nComputed + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flat-database.h"
+
+#include "test/test_securetag.h"
+
+#include <boost/test/unit_test.hpp>
+
+// Stands in for a manager whose items are stored as records of their own
+struct CFlatDBTestCache
+{
+    std::map<int, std::string> mapItems;
+    int nCheckAndRemove = 0;
+
+    void Clear() { mapItems.clear(); }
+    void CheckAndRemove() { nCheckAndRemove++; }
+    std::string ToString() const { return strprintf("Items: %d", (int)mapItems.size()); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(mapItems);
+    }
+};
+
+void WriteFlatDBRecords(const CFlatDBTestCache& cache, CFlatDBWriter& writer)
+{
+    for (const auto& item : cache.mapItems) {
+        writer.Write(std::make_pair('i', item.first), item.second);
+    }
+}
+
+bool ReadFlatDBRecords(CFlatDBTestCache& cache, CFlatDBReader& reader)
+{
+    reader.ReadAll<std::pair<char, int>, std::string>('i', [&cache](const std::pair<char, int>& key, const std::string& str) {
+        cache.mapItems[key.second] = str;
+    });
+    return true;
+}
+
+static CFlatDBTestCache LoadCache(const std::string& strFilename)
+{
+    CFlatDBTestCache cache;
+    CFlatDB<CFlatDBTestCache> flatdb(strFilename, "magicTestCache");
+    BOOST_CHECK(flatdb.Load(cache));
+    BOOST_CHECK_EQUAL(cache.nCheckAndRemove, 1);
+    return cache;
+}
+
+static uint64_t FileSize(const std::string& strFilename)
+{
+    return boost::filesystem::file_size(GetDataDir() / strFilename);
+}
+
+BOOST_FIXTURE_TEST_SUITE(flatdb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatdb_incremental_dump)
+{
+    CFlatDBTestCache cache;
+    for (int i = 0; i < 100; i++) {
+        cache.mapItems[i] = std::string(100, 'a' + i % 26);
+    }
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    uint64_t nSize = FileSize("test.dat");
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+
+    // Nothing changed, nothing written
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    BOOST_CHECK_EQUAL(FileSize("test.dat"), nSize);
+
+    // One changed and one new item are appended, an erased one leaves a small marker
+    cache.mapItems[5] = "changed";
+    cache.mapItems[1000] = "new";
+    cache.mapItems.erase(7);
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    uint64_t nGrowth = FileSize("test.dat") - nSize;
+    BOOST_CHECK(nGrowth > 0 && nGrowth < 3 * (36 + 20));
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+
+    // A different kind of cache must not be read from this file
+    CFlatDBTestCache cacheOther;
+    BOOST_CHECK(!CFlatDB<CFlatDBTestCache>("test.dat", "magicOtherCache").Load(cacheOther));
+    BOOST_CHECK(!CFlatDB<CFlatDBTestCache>("test.dat", "magicOtherCache").Dump(cacheOther));
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_torn_tail)
+{
+    CFlatDBTestCache cache;
+    cache.mapItems[1] = "one";
+    cache.mapItems[2] = "two";
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    uint64_t nSize = FileSize("test.dat");
+
+    CFlatDBTestCache cacheNew = cache;
+    cacheNew.mapItems[3] = "three";
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cacheNew));
+
+    // Cut the last record short as if the node crashed while appending it
+    boost::filesystem::resize_file(GetDataDir() / "test.dat", FileSize("test.dat") - 3);
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+    BOOST_CHECK_EQUAL(FileSize("test.dat"), nSize);
+
+    // A corrupted record is dropped together with everything after it
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cacheNew));
+    FILE* file = fopen((GetDataDir() / "test.dat").string().c_str(), "rb+");
+    fseek(file, -1, SEEK_END);
+    fputc('x', file);
+    fclose(file);
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cacheNew));
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cacheNew.mapItems);
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_legacy_file)
+{
+    CFlatDBTestCache cache;
+    cache.mapItems[1] = "one";
+    cache.mapItems[42] = "forty-two";
+
+    // Whole object in one blob, as written before the record log
+    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+    ssObj << std::string("magicTestCache") << FLATDATA(Params().MessageStart()) << cache;
+    uint256 hash = Hash(ssObj.begin(), ssObj.end());
+    ssObj << hash;
+    FILE* file = fopen((GetDataDir() / "test.dat").string().c_str(), "wb");
+    fwrite(&ssObj[0], 1, ssObj.size(), file);
+    fclose(file);
+
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+
+    // The next dump converts the file, which then reads the same
+    cache.mapItems[2] = "two";
+    BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_compaction)
+{
+    // Rewriting every item over and over must not let the file grow without bound
+    CFlatDBTestCache cache;
+    for (int nRound = 0; nRound < 8; nRound++) {
+        for (int i = 0; i < 64; i++) {
+            cache.mapItems[i] = std::string(16 * 1024, 'a' + nRound);
+        }
+        BOOST_CHECK(CFlatDB<CFlatDBTestCache>("test.dat", "magicTestCache").Dump(cache));
+    }
+    BOOST_CHECK(FileSize("test.dat") < 3 * 64 * 16 * 1024);
+    BOOST_CHECK(LoadCache("test.dat").mapItems == cache.mapItems);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
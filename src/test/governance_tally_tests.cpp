@@ -0,0 +1,91 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "governance-object.h"
+#include "governance-votedb.h"
+#include "masternodeman.h"
+
+#include "test/test_securetag.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(governance_tally_tests, TestingSetup)
+
+class TestGovernanceObject
+{
+public:
+    static bool ProcessVote(CGovernanceObject& govobj, const CGovernanceVote& vote, CConnman& connman)
+    {
+        CGovernanceException exception;
+        return govobj.ProcessVote(NULL, vote, exception, connman);
+    }
+
+    static void ClearMasternodeVotes(CGovernanceObject& govobj)
+    {
+        govobj.ClearMasternodeVotes();
+    }
+
+    static bool CheckVoteTally(const CGovernanceObject& govobj)
+    {
+        return govobj.CheckVoteTally();
+    }
+};
+
+static CMasternode AddMasternode(uint32_t n, CKey& keyMasternodeRet)
+{
+    CKey keyCollateral;
+    keyCollateral.MakeNewKey(true);
+    keyMasternodeRet.MakeNewKey(true);
+    CMasternode mn(CService(), COutPoint(uint256S("0x0101"), n), keyCollateral.GetPubKey(), keyMasternodeRet.GetPubKey(), PROTOCOL_VERSION);
+    BOOST_CHECK(mnodeman.Add(mn));
+    return mn;
+}
+
+static bool Vote(CGovernanceObject& govobj, const CMasternode& mn, const CKey& keyMasternode, vote_outcome_enum_t eOutcome, CConnman& connman)
+{
+    CGovernanceVote vote(mn.outpoint, govobj.GetHash(), VOTE_SIGNAL_FUNDING, eOutcome);
+    BOOST_CHECK(vote.Sign(keyMasternode, keyMasternode.GetPubKey()));
+    return TestGovernanceObject::ProcessVote(govobj, vote, connman);
+}
+
+BOOST_AUTO_TEST_CASE(vote_tally_matches_recount)
+{
+    CGovernanceVoteDB* pgovvotedbOld = pgovvotedb;
+    pgovvotedb = new CGovernanceVoteDB(1 << 20, true);
+    bool fCheckVoteTallyOld = fCheckVoteTally;
+    fCheckVoteTally = true;
+
+    CGovernanceObject govobj(uint256(), 1, GetAdjustedTime(), uint256S("0x02"), "");
+    CKey key1, key2;
+    CMasternode mn1 = AddMasternode(1, key1);
+    CMasternode mn2 = AddMasternode(2, key2);
+
+    // new votes
+    BOOST_CHECK(Vote(govobj, mn1, key1, VOTE_OUTCOME_YES, *connman));
+    BOOST_CHECK(Vote(govobj, mn2, key2, VOTE_OUTCOME_YES, *connman));
+    BOOST_CHECK(TestGovernanceObject::CheckVoteTally(govobj));
+    BOOST_CHECK_EQUAL(govobj.GetAbsoluteYesCount(VOTE_SIGNAL_FUNDING), 2);
+
+    // a masternode changes its mind
+    BOOST_CHECK(Vote(govobj, mn2, key2, VOTE_OUTCOME_NO, *connman));
+    BOOST_CHECK(TestGovernanceObject::CheckVoteTally(govobj));
+    BOOST_CHECK_EQUAL(govobj.GetYesCount(VOTE_SIGNAL_FUNDING), 1);
+    BOOST_CHECK_EQUAL(govobj.GetNoCount(VOTE_SIGNAL_FUNDING), 1);
+    BOOST_CHECK_EQUAL(govobj.GetAbsoluteYesCount(VOTE_SIGNAL_FUNDING), 0);
+
+    // the votes of a removed masternode are dropped
+    mnodeman.Clear();
+    BOOST_CHECK(mnodeman.Add(mn2));
+    TestGovernanceObject::ClearMasternodeVotes(govobj);
+    BOOST_CHECK(TestGovernanceObject::CheckVoteTally(govobj));
+    BOOST_CHECK_EQUAL(govobj.GetYesCount(VOTE_SIGNAL_FUNDING), 0);
+    BOOST_CHECK_EQUAL(govobj.GetNoCount(VOTE_SIGNAL_FUNDING), 1);
+
+    mnodeman.Clear();
+    fCheckVoteTally = fCheckVoteTallyOld;
+    delete pgovvotedb;
+    pgovvotedb = pgovvotedbOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
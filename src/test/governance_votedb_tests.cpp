@@ -0,0 +1,88 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "governance-votedb.h"
+
+#include "test/test_securetag.h"
+
+#include <boost/test/unit_test.hpp>
+
+static CGovernanceVote MakeVote(const uint256& nParentHash, uint32_t n)
+{
+    COutPoint outpoint(uint256S("0x0101"), n);
+    return CGovernanceVote(outpoint, nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+}
+
+static std::vector<uint256> GetVoteHashes(const CGovernanceVoteDB& db, const uint256& nParentHash)
+{
+    std::vector<uint256> vecHashes;
+    db.ForEachVoteHash(nParentHash, [&vecHashes](const uint256& nHash) { vecHashes.push_back(nHash); });
+    return vecHashes;
+}
+
+BOOST_FIXTURE_TEST_SUITE(governance_votedb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(votedb_read_write_erase)
+{
+    CGovernanceVoteDB db(1 << 20, true);
+    uint256 nParent1 = uint256S("0x01");
+    uint256 nParent2 = uint256S("0x02");
+
+    CGovernanceVote vote1 = MakeVote(nParent1, 1);
+    CGovernanceVote vote2 = MakeVote(nParent1, 2);
+    CGovernanceVote vote3 = MakeVote(nParent2, 1);
+    BOOST_CHECK(db.WriteVote(vote1));
+    BOOST_CHECK(db.WriteVote(vote2));
+    BOOST_CHECK(db.WriteVote(vote3));
+    // known votes are not written twice
+    BOOST_CHECK(db.WriteVote(vote1));
+    BOOST_CHECK_EQUAL(db.GetVoteCount(), 3);
+    BOOST_CHECK_EQUAL(db.GetLastSequence(), 3U);
+
+    CGovernanceVote voteRead;
+    BOOST_CHECK(db.ReadVote(vote2.GetHash(), voteRead));
+    BOOST_CHECK(voteRead.GetHash() == vote2.GetHash());
+    BOOST_CHECK_EQUAL(GetVoteHashes(db, nParent1).size(), 2U);
+    BOOST_CHECK_EQUAL(GetVoteHashes(db, nParent2).size(), 1U);
+
+    // only the votes of one masternode on one object
+    BOOST_CHECK(db.EraseVotes(nParent1, &vote1.GetMasternodeOutpoint()));
+    BOOST_CHECK(!db.HaveVote(vote1.GetHash()));
+    BOOST_CHECK(db.HaveVote(vote2.GetHash()));
+    BOOST_CHECK(db.HaveVote(vote3.GetHash()));
+
+    BOOST_CHECK(db.EraseVotes(nParent1));
+    BOOST_CHECK(GetVoteHashes(db, nParent1).empty());
+    BOOST_CHECK_EQUAL(db.GetVoteCount(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(votedb_sync_with_objects)
+{
+    CGovernanceVoteDB db(1 << 20, true);
+    uint256 nParent1 = uint256S("0x01");
+    uint256 nParent2 = uint256S("0x02");
+
+    CGovernanceVote vote1 = MakeVote(nParent1, 1);
+    CGovernanceVote vote2 = MakeVote(nParent2, 1);
+    CGovernanceVote vote3 = MakeVote(nParent1, 2);
+    BOOST_CHECK(db.WriteVote(vote1));
+    BOOST_CHECK(db.WriteVote(vote2));
+    BOOST_CHECK(db.WriteVote(vote3));
+
+    // tallies include the first two votes and nParent2 is gone
+    std::set<uint256> setParents;
+    setParents.insert(nParent1);
+    BOOST_CHECK(db.SyncWithObjects(2, setParents));
+    BOOST_CHECK(db.HaveVote(vote1.GetHash()));
+    BOOST_CHECK(!db.HaveVote(vote2.GetHash()));
+    BOOST_CHECK(!db.HaveVote(vote3.GetHash()));
+    BOOST_CHECK_EQUAL(db.GetVoteCount(), 1);
+
+    // tallies ahead of the database can not be trusted
+    BOOST_CHECK(!db.SyncWithObjects(10, setParents));
+    BOOST_CHECK(db.WriteVote(vote3));
+    BOOST_CHECK_EQUAL(db.GetLastSequence(), 11U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
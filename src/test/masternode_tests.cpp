@@ -0,0 +1,161 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "netbase.h"
+#include "netmessagemaker.h"
+#include "script/standard.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include "test/test_securetag.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternode_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(last_paid_recorded_before_list_sync)
+{
+    const int nBlocks = 10;
+    std::vector<uint256> vHashes(nBlocks);
+    std::vector<CBlockIndex> vBlocks(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vHashes[i] = ArithToUint256(arith_uint256(i + 1));
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].nHeight = i;
+        vBlocks[i].nTime = 1500000000 + i * 60;
+        vBlocks[i].BuildSkip();
+    }
+
+    CKey keyCollateral, keyMasternode, keyOther;
+    keyCollateral.MakeNewKey(true);
+    keyMasternode.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CScript payee = GetScriptForDestination(keyCollateral.GetPubKey().GetID());
+    CScript payeeOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    // connect blocks paying the masternode at 3 and 7 and someone else at 5,
+    // while the list is still empty and not synced
+    mnodeman.Clear();
+    masternodeSync.Reset();
+    for (int i = 0; i < nBlocks; i++) {
+        CMutableTransaction tx;
+        tx.vout.resize(1);
+        if (i == 3 || i == 7) {
+            tx.vout[0].scriptPubKey = payee;
+        } else if (i == 5) {
+            tx.vout[0].scriptPubKey = payeeOther;
+        } else {
+            continue;
+        }
+        tx.vout[0].nValue = GetMasternodePayment(i, vBlocks[i].nMint);
+        int nPaymentPos = i > Params().GetConsensus().nLastPoWBlock ? 1 : 0;
+        mnodeman.SyncTransaction(tx, &vBlocks[i], nPaymentPos);
+    }
+
+    // the network only voted for the payment at 3
+    {
+        LOCK(cs_mapMasternodeBlocks);
+        CMasternodePayee mnpayee(payee, uint256S("0x01"));
+        mnpayee.AddVoteHash(uint256S("0x02"));
+        mnpayments.mapMasternodeBlocks[3] = CMasternodeBlockPayees(3);
+        mnpayments.mapMasternodeBlocks[3].vecPayees.push_back(mnpayee);
+    }
+    // the masternode arrives with the list, last paid waits for the winners list
+    // the list syncs
+    COutPoint outpoint(uint256S("0x0101"), 0);
+    CMasternode mn(CService(), outpoint, keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+    BOOST_CHECK(mnodeman.Add(mn));
+    mnodeman.UpdateLastPaid(&vBlocks[nBlocks - 1]);
+    BOOST_CHECK(mnodeman.Get(outpoint, mn));
+    BOOST_CHECK_EQUAL(mn.GetLastPaidBlock(), 0);
+
+    for (int i = 0; i < 4; i++) {
+        masternodeSync.SwitchToNextAsset(*connman);
+    }
+    BOOST_CHECK(masternodeSync.IsWinnersListSynced());
+
+    mnodeman.UpdateLastPaid(&vBlocks[nBlocks - 1]);
+    BOOST_CHECK(mnodeman.Get(outpoint, mn));
+    BOOST_CHECK_EQUAL(mn.GetLastPaidBlock(), 3);
+
+    // and the payment at 7 counts once it has its votes
+    {
+        LOCK(cs_mapMasternodeBlocks);
+        CMasternodePayee mnpayee(payee, uint256S("0x03"));
+        mnpayee.AddVoteHash(uint256S("0x04"));
+        mnpayments.mapMasternodeBlocks[7] = CMasternodeBlockPayees(7);
+        mnpayments.mapMasternodeBlocks[7].vecPayees.push_back(mnpayee);
+    }
+    mnodeman.UpdateLastPaid(&vBlocks[nBlocks - 1]);
+    BOOST_CHECK(mnodeman.Get(outpoint, mn));
+    BOOST_CHECK_EQUAL(mn.GetLastPaidBlock(), 7);
+
+    {
+        LOCK(cs_mapMasternodeBlocks);
+        mnpayments.mapMasternodeBlocks.erase(3);
+        mnpayments.mapMasternodeBlocks.erase(7);
+    }
+    masternodeSync.Reset();
+    mnodeman.Clear();
+}
+
+static bool RelayMessageMatches(int nType, const uint256& hash, const CSerializedNetMsg& msgExpected)
+{
+    CSharedNetMsg msg;
+    if (!mnodeman.GetRelayMessage(CInv(nType, hash), PROTOCOL_VERSION, msg))
+        return false;
+    return msg.command == msgExpected.command && msg.data && *msg.data == msgExpected.data;
+}
+
+BOOST_AUTO_TEST_CASE(relay_cache_follows_updates)
+{
+    CKey keyCollateral, keyMasternode;
+    keyCollateral.MakeNewKey(true);
+    keyMasternode.MakeNewKey(true);
+    CService addr = LookupNumeric("1.2.3.4", Params().GetDefaultPort());
+    COutPoint outpoint(uint256S("0x0202"), 0);
+    CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+
+    mnodeman.Clear();
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    CMasternodeBroadcast mnb(addr, outpoint, keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+    BOOST_CHECK(mnb.Sign(keyCollateral));
+    uint256 hashOld = mnb.GetHash();
+    BOOST_CHECK(mnodeman.Add(mnb));
+    mnodeman.mapSeenMasternodeBroadcast.insert(std::make_pair(hashOld, std::make_pair(GetTime(), mnb)));
+    BOOST_CHECK(RelayMessageMatches(MSG_MASTERNODE_ANNOUNCE, hashOld, msgMaker.Make(NetMsgType::MNANNOUNCE, mnb)));
+
+    // a new ping changes the announcement form but not its hash
+    CMasternodePing mnp;
+    mnp.masternodeOutpoint = outpoint;
+    mnp.blockHash = uint256S("0x03");
+    mnp.sigTime = nTime;
+    mnp.nDaemonVersion = CLIENT_VERSION;
+    mnodeman.SetMasternodeLastPing(outpoint, mnp);
+    mnb.lastPing = mnp;
+    BOOST_CHECK(RelayMessageMatches(MSG_MASTERNODE_PING, mnp.GetHash(), msgMaker.Make(NetMsgType::MNPING, mnp)));
+    BOOST_CHECK(RelayMessageMatches(MSG_MASTERNODE_ANNOUNCE, hashOld, msgMaker.Make(NetMsgType::MNANNOUNCE, mnb)));
+
+    // a new announcement replaces the cached one
+    SetMockTime(nTime + 60 * 60);
+    CMasternodeBroadcast mnbNew(addr, outpoint, keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+    BOOST_CHECK(mnbNew.Sign(keyCollateral));
+    uint256 hashNew = mnbNew.GetHash();
+    BOOST_CHECK(hashNew != hashOld);
+    int nDos = 0;
+    BOOST_CHECK(mnodeman.CheckMnbAndUpdateMasternodeList(NULL, mnbNew, nDos, *connman));
+    BOOST_CHECK(RelayMessageMatches(MSG_MASTERNODE_ANNOUNCE, hashNew, msgMaker.Make(NetMsgType::MNANNOUNCE, mnbNew)));
+    BOOST_CHECK(!RelayMessageMatches(MSG_MASTERNODE_ANNOUNCE, hashOld, msgMaker.Make(NetMsgType::MNANNOUNCE, mnb)));
+
+    SetMockTime(0);
+    mnodeman.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "netmessagemaker.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -172,4 +173,38 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(shared_msg_push)
+{
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    std::vector<std::unique_ptr<CNode>> vNodes;
+    for (NodeId id = 0; id < 3; id++)
+        vNodes.emplace_back(new CNode(id, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", false));
+
+    CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+    CSharedNetMsg msg = CConnman::ShareMessage(msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+    BOOST_CHECK(!msg.IsNull());
+    BOOST_CHECK_EQUAL(msg.GetPayloadSize(), 8U);
+    connman.PushMessage(vNodes[0].get(), msg);
+    connman.PushMessage(vNodes[1].get(), msg);
+    connman.PushMessage(vNodes[2].get(), msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+
+    // Nothing can be sent without a socket, so every message is still queued
+    for (const auto& pnode : vNodes) {
+        LOCK(pnode->cs_vSend);
+        BOOST_CHECK_EQUAL(pnode->vSendMsg.size(), 2U);
+        BOOST_CHECK_EQUAL(pnode->nSendSize, CMessageHeader::HEADER_SIZE + 8U);
+        BOOST_CHECK(*pnode->vSendMsg[0] == *vNodes[2]->vSendMsg[0]);
+        BOOST_CHECK(*pnode->vSendMsg[1] == *vNodes[2]->vSendMsg[1]);
+    }
+    // The shared message is queued without copies
+    BOOST_CHECK(vNodes[0]->vSendMsg[0] == vNodes[1]->vSendMsg[0]);
+    BOOST_CHECK(vNodes[0]->vSendMsg[1] == vNodes[1]->vSendMsg[1]);
+    BOOST_CHECK(vNodes[0]->vSendMsg[1] != vNodes[2]->vSendMsg[1]);
+
+    // An empty payload only queues the header
+    connman.PushMessage(vNodes[0].get(), CConnman::ShareMessage(msgMaker.Make(NetMsgType::VERACK)));
+    BOOST_CHECK_EQUAL(vNodes[0]->vSendMsg.size(), 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+// Copyright (c) 2018-2019 The SecureTag Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "kernel.h"
+#include "test/test_securetag.h"
+#include "test/test_random.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakemodifier_tests, BasicTestingSetup)
+
+// The forward walk along the chain that CStakeModifierIndex replaces
+static const CBlockIndex* WalkKernelModifier(const CChain& chain, const CBlockIndex* pindexFrom, int64_t nTime)
+{
+    int64_t nModifierTime = pindexFrom->GetBlockTime();
+    const CBlockIndex* pindex = pindexFrom;
+    while (nModifierTime < nTime) {
+        pindex = chain[pindex->nHeight + 1];
+        if (!pindex)
+            return NULL;
+        if (pindex->GeneratedStakeModifier())
+            nModifierTime = pindex->GetBlockTime();
+    }
+    return pindex;
+}
+
+static const CBlockIndex* WalkLastModifier(const CBlockIndex* pindex)
+{
+    while (pindex && !pindex->GeneratedStakeModifier())
+        pindex = pindex->pprev;
+    return pindex;
+}
+
+static void BuildChain(std::vector<CBlockIndex>& vBlocks, CBlockIndex* pindexFork, bool fMonotonic)
+{
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlockIndex& block = vBlocks[i];
+        block.pprev = i ? &vBlocks[i - 1] : pindexFork;
+        block.nHeight = block.pprev ? block.pprev->nHeight + 1 : 0;
+        int64_t nTimePrev = block.pprev ? block.pprev->nTime : 1500000000;
+        // Mostly increasing timestamps, occasionally going backwards
+        block.nTime = nTimePrev + 60 - (fMonotonic ? 0 : 40) + insecure_rand() % 80;
+        block.nStakeModifier = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+        if (!block.pprev || insecure_rand() % 3 == 0)
+            block.SetStakeModifier(block.nStakeModifier, true);
+        block.BuildSkip();
+    }
+}
+
+static void CheckIndex(const CStakeModifierIndex& index, const CChain& chain)
+{
+    for (int i = 0; i < 500; i++) {
+        const CBlockIndex* pindexFrom = chain[insecure_rand() % (chain.Height() + 1)];
+        int64_t nTime = pindexFrom->GetBlockTime() + 1 + insecure_rand() % 3000;
+        BOOST_CHECK(index.FindKernelModifier(pindexFrom, nTime) == WalkKernelModifier(chain, pindexFrom, nTime));
+        BOOST_CHECK(index.FindLastModifier(pindexFrom->nHeight) == WalkLastModifier(pindexFrom));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stakemodifier_index_lookup)
+{
+    for (int nMonotonic = 0; nMonotonic < 2; nMonotonic++) {
+        std::vector<CBlockIndex> vBlocks(1000);
+        BuildChain(vBlocks, NULL, nMonotonic);
+        CChain chain;
+        chain.SetTip(&vBlocks.back());
+
+        CStakeModifierIndex index;
+        index.Sync(chain);
+        CheckIndex(index, chain);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stakemodifier_index_reorg)
+{
+    std::vector<CBlockIndex> vBlocks(1000);
+    BuildChain(vBlocks, NULL, false);
+    CChain chain;
+    CStakeModifierIndex index;
+
+    // Connect one block at a time
+    for (size_t i = 0; i < 700; i++) {
+        chain.SetTip(&vBlocks[i]);
+        index.Sync(chain);
+    }
+    CheckIndex(index, chain);
+
+    // Disconnect back to the fork point, then switch to a longer branch
+    chain.SetTip(&vBlocks[599]);
+    index.Sync(chain);
+    CheckIndex(index, chain);
+
+    std::vector<CBlockIndex> vBranch(200);
+    BuildChain(vBranch, &vBlocks[599], false);
+    chain.SetTip(&vBranch.back());
+    index.Sync(chain);
+    CheckIndex(index, chain);
+
+    size_t nEntries = 0;
+    for (int nHeight = 0; nHeight <= chain.Height(); nHeight++)
+        nEntries += chain[nHeight]->GeneratedStakeModifier();
+    BOOST_CHECK_EQUAL(index.size(), nEntries);
+
+    index.Clear();
+    BOOST_CHECK_EQUAL(index.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(stakekernel_search_threads)
+{
+    // Without a chain only testnet falls back to an empty stake modifier
+    SelectParams(CBaseChainParams::TESTNET);
+    const unsigned int nTimeFrom = 1560000000, nTimeTo = nTimeFrom + 44;
+    arith_uint256 bnTarget = ~arith_uint256(0);
+    bnTarget >>= 28; // a hit every few hundred hashes at this coin weight
+    const unsigned int nBits = bnTarget.GetCompact();
+
+    std::vector<CBlockIndex> vBlocks(500);
+    std::vector<CStakeKernel> vKernels(vBlocks.size());
+    std::vector<const CStakeKernel*> vpKernels;
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].nTime = nTimeFrom - 2 * 24 * 60 * 60 + insecure_rand() % 3600;
+        COutPoint prevout(ArithToUint256(arith_uint256(insecure_rand())), insecure_rand() % 4);
+        vKernels[i].Init(&vBlocks[i], STAKE_KERNEL_TX_OFFSET, prevout, 1000 * COIN);
+        vpKernels.push_back(&vKernels[i]);
+    }
+    // Every kernel again in reverse order, so each hit is tied with a later one
+    vpKernels.insert(vpKernels.end(), vpKernels.rbegin(), vpKernels.rend());
+
+    // Latest hit wins, ties going to the lowest index
+    bool fExpected = false;
+    size_t nExpectedIndex = 0;
+    unsigned int nExpectedTime = 0;
+    for (size_t i = 0; i < vpKernels.size(); i++) {
+        for (unsigned int nTime = nTimeTo; nTime >= nTimeFrom; nTime--) {
+            uint256 hashProofOfStake;
+            if (vpKernels[i]->CheckHash(nBits, nTime, hashProofOfStake)) {
+                if (!fExpected || nTime > nExpectedTime) {
+                    fExpected = true;
+                    nExpectedIndex = i;
+                    nExpectedTime = nTime;
+                }
+                break;
+            }
+        }
+    }
+    BOOST_CHECK(fExpected);
+    BOOST_CHECK(nExpectedIndex < vBlocks.size());
+
+    for (int nThreads = 1; nThreads <= 8; nThreads *= 2) {
+        size_t nIndex = 0;
+        unsigned int nTime = 0;
+        uint64_t nTried = 0;
+        BOOST_CHECK(SearchStakeKernels(vpKernels, nBits, nTimeFrom, nTimeTo, nThreads, nIndex, nTime, nTried));
+        BOOST_CHECK_EQUAL(nIndex, nExpectedIndex);
+        BOOST_CHECK_EQUAL(nTime, nExpectedTime);
+        BOOST_CHECK(nTried > 0 && nTried <= vpKernels.size() * (nTimeTo - nTimeFrom + 1));
+    }
+
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -84,4 +84,43 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_block_script_cache, TestChain100Setup)
+{
+    // Scripts that passed on mempool acceptance are not executed again when
+    // the transaction is connected in a block.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CMutableTransaction> spends;
+    spends.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout.hash = coinbaseTxns[i].GetHash();
+        spends[i].vin[0].prevout.n = 0;
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = 11*CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    uint64_t nHits, nMisses, nHitsBefore, nMissesBefore;
+    GetScriptExecutionCacheStats(nHitsBefore, nMissesBefore);
+
+    // spends[0] went through the mempool, spends[1] did not
+    BOOST_CHECK(ToMemPool(spends[0]));
+    CBlock block = CreateAndProcessBlock(spends, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    GetScriptExecutionCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 1U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 1U);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
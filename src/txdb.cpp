@@ -24,6 +24,8 @@ static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_ADDRESSBALANCE = 'A';
+static const char DB_BEST_INDEXED_BLOCK = 'I';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -258,20 +260,190 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
     return true;
 }
 
+namespace {
+
+typedef std::pair<unsigned int, uint160> address_t;
+
+/**
+ * Balance records touched by one batch of address index changes. Every change
+ * is checked against the index, so that a block connected again after an
+ * unclean shutdown or entries that were never written are not counted twice.
+ */
+class CAddressBalanceUpdate
+{
+private:
+    const CBlockTreeDB& db;
+    std::map<address_t, CAddressBalanceValue> mapBalances;
+    std::set<std::pair<address_t, uint256> > setTxAdded;
+    std::set<std::pair<address_t, uint256> > setTxKept;
+    std::set<std::pair<address_t, uint256> > setTxRemoved;
+
+    CAddressBalanceValue& GetBalance(const address_t& address)
+    {
+        auto it = mapBalances.find(address);
+        if (it == mapBalances.end()) {
+            it = mapBalances.emplace(address, CAddressBalanceValue()).first;
+            db.Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(address.first, address.second)), it->second);
+        }
+        return it->second;
+    }
+
+    void AddAmount(const address_t& address, CAmount nValue, int nSign)
+    {
+        CAddressBalanceValue& value = GetBalance(address);
+        value.balance += nSign * nValue;
+        if (nValue > 0) {
+            value.received += nSign * nValue;
+        }
+    }
+
+public:
+    CAddressBalanceUpdate(const CBlockTreeDB& dbIn) : db(dbIn) {}
+
+    void Add(const CAddressIndexKey& key, CAmount nValue)
+    {
+        address_t address(key.type, key.hashBytes);
+        CAmount nOldValue;
+        if (db.Read(std::make_pair(DB_ADDRESSINDEX, key), nOldValue)) {
+            AddAmount(address, nOldValue, -1);
+            setTxKept.insert(std::make_pair(address, key.txhash));
+        } else {
+            setTxAdded.insert(std::make_pair(address, key.txhash));
+        }
+        AddAmount(address, nValue, 1);
+    }
+
+    void Remove(const CAddressIndexKey& key)
+    {
+        address_t address(key.type, key.hashBytes);
+        CAmount nOldValue;
+        if (db.Read(std::make_pair(DB_ADDRESSINDEX, key), nOldValue)) {
+            AddAmount(address, nOldValue, -1);
+            // all entries of a transaction go away with its block
+            setTxRemoved.insert(std::make_pair(address, key.txhash));
+        }
+    }
+
+    void Write(CDBBatch& batch)
+    {
+        for (const auto& txpair : setTxAdded) {
+            if (!setTxKept.count(txpair)) {
+                GetBalance(txpair.first).txCount++;
+            }
+        }
+        for (const auto& txpair : setTxRemoved) {
+            unsigned int& txCount = GetBalance(txpair.first).txCount;
+            txCount = txCount > 0 ? txCount - 1 : 0;
+        }
+        for (const auto& balancepair : mapBalances) {
+            auto key = std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(balancepair.first.first, balancepair.first.second));
+            if (balancepair.second.IsNull()) {
+                batch.Erase(key);
+            } else {
+                batch.Write(key, balancepair.second);
+            }
+        }
+    }
+};
+
+}
+
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+    CAddressBalanceUpdate balances(*this);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        balances.Add(it->first, it->second);
         batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    }
+    balances.Write(batch);
     return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+    CAddressBalanceUpdate balances(*this);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        balances.Remove(it->first);
         batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
+    }
+    balances.Write(batch);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    value.SetNull();
+    return Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+}
+
+bool CBlockTreeDB::BuildAddressBalanceIndex() {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey()));
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nAddresses = 0;
+    LogPrintf("Building address balance index...\n");
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(*this);
+    uiInterface.SetProgressBreakAction(StartShutdown);
+
+    // entries are sorted by address, then by height and position in the block
+    CAddressIndexIteratorKey addressKey;
+    CAddressBalanceValue value;
+    uint256 txhashLast;
+    std::pair<char, CAddressIndexKey> key;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX) {
+            break;
+        }
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue)) {
+            return error("%s: failed to get address index value", __func__);
+        }
+        if (key.second.type != addressKey.type || key.second.hashBytes != addressKey.hashBytes) {
+            if (!value.IsNull()) {
+                batch.Write(std::make_pair(DB_ADDRESSBALANCE, addressKey), value);
+            }
+            addressKey = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            txhashLast.SetNull();
+            if (++nAddresses % 10000 == 0) {
+                uiInterface.ShowProgress(_("Building address balance index") + "\n" + _("(press q to shutdown and continue later)") + "\n",
+                                         (addressKey.type > 1 ? 50 : 0) + *addressKey.hashBytes.begin() * 50 / 256);
+            }
+        }
+        value.balance += nValue;
+        if (nValue > 0) {
+            value.received += nValue;
+        }
+        if (key.second.txhash != txhashLast) {
+            value.txCount++;
+            txhashLast = key.second.txhash;
+        }
+        if (batch.SizeEstimate() > batch_size) {
+            WriteBatch(batch);
+            batch.Clear();
+        }
+        pcursor->Next();
+    }
+    if (!value.IsNull()) {
+        batch.Write(std::make_pair(DB_ADDRESSBALANCE, addressKey), value);
+    }
+    WriteBatch(batch);
+    uiInterface.SetProgressBreakAction(std::function<void(void)>());
+    uiInterface.ShowProgress("", 100);
+
+    if (ShutdownRequested()) {
+        LogPrintf("Building address balance index cancelled\n");
+        return false;
+    }
+    LogPrintf("Address balance index built for %d addresses  %dms\n", nAddresses, GetTimeMillis() - nStart);
+    return true;
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
@@ -306,9 +478,17 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+bool CBlockTreeDB::WriteTimestampIndex(const std::vector<CTimestampIndexKey> &vect) {
     CDBBatch batch(*this);
-    batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
+    for (std::vector<CTimestampIndexKey>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(std::make_pair(DB_TIMESTAMPINDEX, *it), 0);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseTimestampIndex(const std::vector<CTimestampIndexKey> &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<CTimestampIndexKey>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(std::make_pair(DB_TIMESTAMPINDEX, *it));
     return WriteBatch(batch);
 }
 
@@ -332,6 +512,14 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
+bool CBlockTreeDB::WriteBestIndexedBlock(const CBlockLocator &locator) {
+    return Write(DB_BEST_INDEXED_BLOCK, locator);
+}
+
+bool CBlockTreeDB::ReadBestIndexedBlock(CBlockLocator &locator) {
+    return Read(DB_BEST_INDEXED_BLOCK, locator);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -134,8 +134,15 @@ public:
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    //! Sum up the address index into per-address balance records, for indexes built before they existed
+    bool BuildAddressBalanceIndex();
+    bool WriteTimestampIndex(const std::vector<CTimestampIndexKey> &vect);
+    bool EraseTimestampIndex(const std::vector<CTimestampIndexKey> &vect);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    //! Progress of the background indexer (see blockindexer.h), an empty locator rebuilds from genesis
+    bool WriteBestIndexedBlock(const CBlockLocator &locator);
+    bool ReadBestIndexedBlock(CBlockLocator &locator);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
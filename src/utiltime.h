@@ -24,6 +24,7 @@ int64_t GetTimeMillis();
 int64_t GetTimeMicros();
 int64_t GetSystemTimeInSeconds(); // Like GetTime(), but not mockable
 int64_t GetLogTimeMicros();
+int64_t GetThreadCPUTimeMicros(); // CPU time used by the calling thread, wall clock where unsupported
 void SetMockTime(int64_t nMockTimeIn);
 void MilliSleep(int64_t n);
 
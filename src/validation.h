@@ -36,6 +36,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CCoinsViewDB;
@@ -173,6 +174,9 @@ extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -215,6 +219,10 @@ extern uint64_t nPruneTarget;
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
+/** Number of headers one header verification job hashes (a 4-way NeoScrypt pass) */
+static const unsigned int HEADER_CHECK_BATCH = 4;
+/** Number of blocks -reindex and -loadblock read ahead to hash their headers as one batch */
+static const unsigned int BLOCK_IMPORT_HASH_BATCH = 8;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
 
 // Require that user allocate at least 945MB for block & undo files (blk???.dat and rev???.dat)
@@ -278,6 +286,8 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header verification thread */
+void ThreadHeaderCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -381,10 +391,17 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. Transactions whose scripts already passed under the same
+ * flags are taken from the script execution cache; cacheFullScriptStore adds them to it.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck> *pvChecks = NULL);
+
+/** Initializes the script-execution cache */
+void InitScriptExecutionCache();
+
+/** Lookups of the script-execution cache made while connecting blocks */
+void GetScriptExecutionCacheStats(uint64_t& nHitsRet, uint64_t& nMissesRet);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -478,6 +495,33 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure hashing a run of consecutive headers from a HEADERS message and
+ * checking the proof of work of the PoW-era ones. The hashes end up in each
+ * header's memoized hash; a failure is reported again, with the proper DoS
+ * score, by CheckBlockHeader when the headers are accepted under cs_main.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader* pheaders;
+    size_t nCount;
+    const Consensus::Params* pconsensusParams;
+
+public:
+    CHeaderCheck(): pheaders(NULL), nCount(0), pconsensusParams(NULL) {}
+    CHeaderCheck(const CBlockHeader* pheadersIn, size_t nCountIn, const Consensus::Params& consensusParams) :
+        pheaders(pheadersIn), nCount(nCountIn), pconsensusParams(&consensusParams) { }
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nCount, check.nCount);
+        std::swap(pconsensusParams, check.pconsensusParams);
+    }
+};
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
@@ -485,11 +529,19 @@ bool GetAddressIndex(uint160 addressHash, int type,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized bytes of the block at pos as they are stored, which is
+ * also their network serialization, without deserializing the block */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Same, checking that the stored header matches pindex */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the undo data at pos, checked against the hash of the block's parent */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
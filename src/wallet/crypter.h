@@ -186,7 +186,7 @@ public:
         return result;
     }
 
-    bool Lock(bool fAllowMixing = false);
+    virtual bool Lock(bool fAllowMixing = false);
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
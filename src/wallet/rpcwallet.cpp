@@ -2388,6 +2388,12 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
             "  \"keys_left\": xxxx,          (numeric) how many new keys are left since last automatic backup\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
+            "  \"scanning\":                 (json object) current scanning details, or false if no scan is in progress\n"
+            "    {\n"
+            "      \"duration\" : xxxx,       (numeric) elapsed seconds since scan start\n"
+            "      \"progress\" : x.xxxx,     (numeric) scanning progress percentage [0.0, 1.0]\n"
+            "      \"eta\" : xxxx             (numeric) estimated seconds until the scan completes\n"
+            "    }\n"
             "  \"hdchainid\": \"<hash>\",      (string) the ID of the HD chain\n"
             "  \"hdaccountcount\": xxx,      (numeric) how many accounts of the HD chain are in this wallet\n"
             "    [\n"
@@ -2425,6 +2431,18 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
     if (pwalletMain->IsCrypted())
         obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
+    if (pwalletMain->IsScanning()) {
+        UniValue scanning(UniValue::VOBJ);
+        int64_t nDuration = pwalletMain->ScanningDuration() / 1000;
+        double dProgress = pwalletMain->ScanningProgress();
+        scanning.push_back(Pair("duration", nDuration));
+        scanning.push_back(Pair("progress", dProgress));
+        if (dProgress > 0)
+            scanning.push_back(Pair("eta", (int64_t)(nDuration * (1 - dProgress) / dProgress)));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     if (fHDEnabled) {
         obj.push_back(Pair("hdchainid", hdChainCurrent.GetID().GetHex()));
         obj.push_back(Pair("hdaccountcount", (int64_t)hdChainCurrent.CountAccounts()));
@@ -9,6 +9,7 @@
 #include <utility>
 #include <vector>
 
+#include "consensus/consensus.h"
 #include "rpc/server.h"
 #include "test/test_securetag.h"
 #include "validation.h"
@@ -428,6 +429,77 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
     }
 }
 
+// Verify a rescan spanning several batches of blocks adds the transactions of
+// every block and reports the start of the range it scanned.
+BOOST_FIXTURE_TEST_CASE(rescan_batches, TestChain100Setup)
+{
+    LOCK(cs_main);
+
+    for (int i = 0; i < 150; i++)
+        coinbaseTxns.emplace_back(*CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey())).vtx[0]);
+
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    BOOST_CHECK(!wallet.IsScanning());
+    BOOST_CHECK_EQUAL(chainActive.Genesis(), wallet.ScanForWalletTransactions(chainActive.Genesis()));
+    BOOST_CHECK(!wallet.IsScanning());
+
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), coinbaseTxns.size());
+    for (size_t i = 0; i < coinbaseTxns.size(); ++i) {
+        const CWalletTx* wtx = wallet.GetWalletTx(coinbaseTxns[i].GetHash());
+        BOOST_CHECK(wtx && wtx->hashBlock == chainActive[i + 1]->GetBlockHash());
+    }
+}
+
+// Verify the running balances follow new blocks, maturing coinbases and
+// spends, with every call checked against a recount of the wallet.
+BOOST_FIXTURE_TEST_CASE(running_balances, TestChain100Setup)
+{
+    LOCK(cs_main);
+    bool fCheckBalancesOld = fCheckBalances;
+    fCheckBalances = true;
+
+    {
+        CWallet wallet;
+        LOCK(wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+        wallet.ScanForWalletTransactions(chainActive.Genesis());
+
+        CWalletBalances balances = wallet.GetBalances();
+        BOOST_CHECK(balances.nBalance > 0);
+        BOOST_CHECK(balances.nImmature > 0);
+        BOOST_CHECK_EQUAL(balances.nBalance, wallet.GetBalance());
+        BOOST_CHECK_EQUAL(balances.nImmature, wallet.GetImmatureBalance());
+
+        // each block adds an immature coinbase and matures an older one
+        for (int i = 0; i < COINBASE_MATURITY + 2; i++) {
+            CBlock block = CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+            wallet.SyncTransaction(*block.vtx[0], chainActive.Tip(), 0);
+            CWalletBalances balancesNew = wallet.GetBalances();
+            BOOST_CHECK_EQUAL(balancesNew.nBalance + balancesNew.nImmature,
+                              balances.nBalance + balances.nImmature + wallet.GetCredit(*block.vtx[0], ISMINE_SPENDABLE));
+            BOOST_CHECK(balancesNew.nBalance > balances.nBalance);
+            balances = balancesNew;
+        }
+
+        // an unconfirmed spend outside the mempool takes the coins off the balance
+        CMutableTransaction spend;
+        spend.vin.push_back(CTxIn(COutPoint(coinbaseTxns[0].GetHash(), 0)));
+        spend.vout.push_back(CTxOut(coinbaseTxns[0].vout[0].nValue, CScript() << OP_TRUE));
+        CAmount nSpent = wallet.GetCredit(coinbaseTxns[0], ISMINE_SPENDABLE);
+        wallet.SyncTransaction(spend, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), balances.nBalance - nSpent);
+        BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+
+        // and abandoning it gives them back
+        BOOST_CHECK(wallet.AbandonTransaction(spend.GetHash()));
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), balances.nBalance);
+    }
+
+    fCheckBalances = fCheckBalancesOld;
+}
+
 // Verify importwallet RPC starts rescan at earliest block with timestamp
 // greater or equal than key birthday. Previously there was a bug where
 // importwallet RPC would start the scan at the latest block with timestamp less
@@ -489,4 +561,46 @@ BOOST_FIXTURE_TEST_CASE(importwallet_rescan, TestChain100Setup)
     ::pwalletMain = pwalletMainBackup;
 }
 
+BOOST_AUTO_TEST_CASE(hd_key_cache_wiped_on_lock)
+{
+    CHDChain chain;
+    BOOST_CHECK(chain.SetSeed(SecureVector(32, 0x5e), true));
+    CExtKey extkey;
+    chain.DeriveChildExtKey(0, false, 0, extkey);
+    CKeyID keyID = extkey.key.GetPubKey().GetID();
+
+    CWallet hdwallet("wallet_hdkeys_test.dat");
+    bool fFirstRun;
+    hdwallet.LoadWallet(fFirstRun);
+    {
+        LOCK(hdwallet.cs_wallet);
+        BOOST_CHECK(hdwallet.SetHDChain(chain, false));
+    }
+
+    // EncryptWallet leaves the wallet locked, with the first keypool keys
+    // derived from the chain
+    SecureString strPassphrase("hdkeys");
+    BOOST_CHECK(hdwallet.EncryptWallet(strPassphrase));
+    BOOST_CHECK(hdwallet.IsCrypted());
+    BOOST_CHECK(hdwallet.IsLocked());
+
+    CKey key;
+    BOOST_CHECK_THROW(hdwallet.GetKey(keyID, key), std::runtime_error);
+
+    // derived once, then served from the cache
+    BOOST_CHECK(hdwallet.Unlock(strPassphrase));
+    BOOST_CHECK(hdwallet.GetKey(keyID, key));
+    BOOST_CHECK(key == extkey.key);
+    BOOST_CHECK(hdwallet.GetKey(keyID, key));
+    BOOST_CHECK(key == extkey.key);
+
+    // Lock wipes the cache, so the key can not be had without the seed
+    BOOST_CHECK(hdwallet.Lock());
+    BOOST_CHECK_THROW(hdwallet.GetKey(keyID, key), std::runtime_error);
+
+    BOOST_CHECK(hdwallet.Unlock(strPassphrase));
+    BOOST_CHECK(hdwallet.GetKey(keyID, key));
+    BOOST_CHECK(key == extkey.key);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -45,12 +45,15 @@
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+#include <thread>
+
 CWallet* pwalletMain = NULL;
 /** Transaction fee set by the user */
 CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+bool fCheckBalances = DEFAULT_CHECK_BALANCES;
 bool bBIP69Enabled = true;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
@@ -204,42 +207,23 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
         throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
 }
 
-CAmount GetStakeReward(CAmount blockReward, unsigned int percentage)
+static int64_t GetStakeMinAge(int64_t nTxTime)
 {
-    return (blockReward / 100) * percentage;
+    return nTxTime > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
 }
-bool CWallet::CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript,
-                                    unsigned int nBits, const CBlock &blockFrom,
-                                    unsigned int nTxPrevOffset, const CTransactionRef &txPrev,
-                                    const COutPoint &prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const
-{
-    unsigned int nTryTime = 0;
-    uint256 hashProofOfStake;
 
-    auto nStakeMinAge = blockFrom.GetBlockTime() > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
+static int GetStakeMinDepth(const CWalletTx& wtx)
+{
+    if (wtx.tx->IsCoinStake())
+        return COINBASE_MATURITY;
+    if (wtx.IsCoinBase())
+        return std::max(10, COINBASE_MATURITY + 1);
+    return 10;
+}
 
-    if (blockFrom.GetBlockTime() + nStakeMinAge + nHashDrift > nTimeTx) // Min age requirement
-        return false;
-    for(unsigned int i = 0; i < nHashDrift; ++i)
-    {
-        nTryTime = nTimeTx + nHashDrift - i;
-        if (CheckStakeKernelHash(nBits, blockFrom, nTxPrevOffset, txPrev, prevout, nTryTime, hashProofOfStake))
-        {
-            //Double check that this will pass time requirements
-            if (nTryTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStakeKernel() : kernel found, but it is too far in the past \n");
-                continue;
-            }
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStakeKernel : kernel found\n");
-            kernelScript.clear();
-            kernelScript = stakeScript;
-            nTimeTx = nTryTime;
-            return true;
-        }
-    }
-    return false;
+CAmount GetStakeReward(CAmount blockReward, unsigned int percentage)
+{
+    return (blockReward / 100) * percentage;
 }
 void CWallet::FillCoinStakePayments(CMutableTransaction &transaction,
                                     const CScript &scriptPubKeyOut,
@@ -287,6 +271,15 @@ bool CWallet::GetKey(const CKeyID &address, CKey& keyOut) const
     std::map<CKeyID, CHDPubKey>::const_iterator mi = mapHdPubKeys.find(address);
     if (mi != mapHdPubKeys.end())
     {
+        {
+            LOCK(cs_KeyStore);
+            HDKeyMap::const_iterator it = mapHDKeyCache.find(address);
+            if (it != mapHDKeyCache.end()) {
+                keyOut = it->second;
+                return true;
+            }
+        }
+
         // if the key has been found in mapHdPubKeys, derive it on the fly
         const CHDPubKey &hdPubKey = (*mi).second;
         CHDChain hdChainCurrent;
@@ -302,6 +295,16 @@ bool CWallet::GetKey(const CKeyID &address, CKey& keyOut) const
         hdChainCurrent.DeriveChildExtKey(hdPubKey.nAccountIndex, hdPubKey.nChangeIndex != 0, hdPubKey.extPubKey.nChild, extkey);
         keyOut = extkey.key;
 
+        {
+            LOCK(cs_KeyStore);
+            // the wallet may have been locked meanwhile
+            if (!IsLocked(true)) {
+                if (mapHDKeyCache.size() >= MAX_HD_KEY_CACHE_SIZE)
+                    mapHDKeyCache.erase(mapHDKeyCache.begin());
+                mapHDKeyCache.insert(std::make_pair(address, keyOut));
+            }
+        }
+
         return true;
     }
     else {
@@ -309,6 +312,16 @@ bool CWallet::GetKey(const CKeyID &address, CKey& keyOut) const
     }
 }
 
+bool CWallet::Lock(bool fAllowMixing)
+{
+    bool fLocked = CCryptoKeyStore::Lock(fAllowMixing);
+    {
+        LOCK(cs_KeyStore);
+        mapHDKeyCache.clear();
+    }
+    return fLocked;
+}
+
 bool CWallet::HaveKey(const CKeyID &address) const
 {
     LOCK(cs_wallet);
@@ -800,6 +813,11 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
     setWalletUTXO.erase(outpoint);
 
+    // the spent transaction has less left to spend now
+    std::map<uint256, CWalletTx>::iterator it = mapWallet.find(outpoint.hash);
+    if (it != mapWallet.end())
+        it->second.MarkDirty();
+
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData(range);
@@ -1113,6 +1131,7 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        fBalancesDirtyAll = true;
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
     }
@@ -1121,6 +1140,13 @@ void CWallet::MarkDirty()
     fAnonymizableTallyCachedNonDenom = false;
 }
 
+void CWallet::MarkBalancesDirty(const uint256& hashTx) const
+{
+    LOCK(cs_wallet);
+    if (!fBalancesDirtyAll)
+        setBalancesDirty.insert(hashTx);
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 {
     LOCK(cs_wallet);
@@ -1219,6 +1245,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         }
     }
 
+    // Its own outputs may have been confirmed, the ones it spends are no longer stakeable
+    UpdateStakeCandidates(hash);
+    for (const CTxIn& txin : wtx.tx->vin) {
+        if (mapWallet.count(txin.prevout.hash))
+            UpdateStakeCandidates(txin.prevout.hash);
+    }
+
     //// debug print
     LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1257,9 +1290,11 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
+    UpdateStakeCandidates(hash);
     BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
+            UpdateStakeCandidates(txin.prevout.hash);
             if (prevtx.nIndex == -1 && !prevtx.hashUnset()) {
                 MarkConflicted(prevtx.hashBlock, wtx.GetHash());
             }
@@ -1351,6 +1386,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.setAbandoned();
             wtx.MarkDirty();
             walletdb.WriteTx(wtx);
+            UpdateStakeCandidates(now);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(hashTx, 0));
@@ -1364,8 +1400,10 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateStakeCandidates(txin.prevout.hash);
+                }
             }
         }
     }
@@ -1416,6 +1454,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
             walletdb.WriteTx(wtx);
+            UpdateStakeCandidates(now);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
             while (iter != mapTxSpends.end() && iter->first.hash == now) {
@@ -1428,8 +1467,10 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateStakeCandidates(txin.prevout.hash);
+                }
             }
         }
     }
@@ -1952,13 +1993,149 @@ void CWalletTx::GetAccountAmounts(const std::string& strAccount, CAmount& nRecei
  * successfully scanned.
  *
  */
+/**
+ * What outputs paying to a wallet can look like: its key IDs, redeem script IDs
+ * and watch-only scripts. Matches every output IsMine() accepts and a few it
+ * does not, like partially owned multisig, without taking the wallet's locks.
+ */
+struct CWalletScanFilter
+{
+    std::set<CKeyID> setKeyIDs;
+    std::set<CScriptID> setScriptIDs;
+    std::set<CScript> setWatchOnly;
+
+    size_t size() const
+    {
+        return setKeyIDs.size() + setScriptIDs.size() + setWatchOnly.size();
+    }
+
+    bool Matches(const CScript& scriptPubKey) const
+    {
+        if (setWatchOnly.count(scriptPubKey))
+            return true;
+
+        std::vector<std::vector<unsigned char> > vSolutions;
+        txnouttype whichType;
+        if (!Solver(scriptPubKey, whichType, vSolutions))
+            return false;
+
+        switch (whichType)
+        {
+        case TX_PUBKEY:
+            return setKeyIDs.count(CPubKey(vSolutions[0]).GetID()) > 0;
+        case TX_PUBKEYHASH:
+            return setKeyIDs.count(CKeyID(uint160(vSolutions[0]))) > 0;
+        case TX_SCRIPTHASH:
+            return setScriptIDs.count(CScriptID(uint160(vSolutions[0]))) > 0;
+        case TX_MULTISIG:
+            for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+                if (setKeyIDs.count(CPubKey(vSolutions[i]).GetID()))
+                    return true;
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+};
+
+void CWallet::GetScanFilter(CWalletScanFilter& filter) const
+{
+    AssertLockHeld(cs_wallet);
+
+    GetKeys(filter.setKeyIDs);
+    for (const auto& hdPubKey : mapHdPubKeys)
+        filter.setKeyIDs.insert(hdPubKey.first);
+
+    LOCK(cs_KeyStore);
+    for (const auto& script : mapScripts)
+        filter.setScriptIDs.insert(script.first);
+    filter.setWatchOnly = setWatchOnly;
+}
+
+namespace {
+
+/** Blocks of a rescan, read from disk and matched against a wallet's scripts ahead of adding them */
+struct CWalletScanBatch
+{
+    static const size_t MAX_BLOCKS = 100;
+
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CBlock> vBlocks;
+    //! per block whether it could be read, and per transaction whether it pays to the filter
+    std::vector<char> vRead;
+    std::vector<std::vector<char> > vMatches;
+    CWalletScanFilter filter;
+
+    void Read(int nThreads)
+    {
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        vBlocks.assign(vIndex.size(), CBlock());
+        vRead.assign(vIndex.size(), 0);
+        vMatches.assign(vIndex.size(), std::vector<char>());
+
+        std::atomic<size_t> nNext(0);
+        auto worker = [&]() {
+            size_t i;
+            while ((i = nNext++) < vIndex.size()) {
+                if (!ReadBlockFromDisk(vBlocks[i], vIndex[i], consensusParams))
+                    continue;
+                vMatches[i].assign(vBlocks[i].vtx.size(), 0);
+                for (size_t posInBlock = 0; posInBlock < vBlocks[i].vtx.size(); posInBlock++) {
+                    for (const CTxOut& txout : vBlocks[i].vtx[posInBlock]->vout) {
+                        if (filter.Matches(txout.scriptPubKey)) {
+                            vMatches[i][posInBlock] = 1;
+                            break;
+                        }
+                    }
+                }
+                vRead[i] = 1;
+            }
+        };
+
+        std::vector<std::thread> vThreads;
+        for (int n = 1; n < nThreads; n++)
+            vThreads.emplace_back(worker);
+        worker();
+        for (auto& thread : vThreads)
+            thread.join();
+    }
+};
+
+/** Reads the next batch while the current one is being added */
+struct CWalletScanReadAhead
+{
+    std::thread thread;
+
+    ~CWalletScanReadAhead()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+}
+
 CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    static const int MAX_SCAN_THREADS = 8;
+
     CBlockIndex* ret = nullptr;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_SCAN_THREADS));
+
+    // the first rescan running reports its progress
+    bool fScanning = false;
+    bool fReportProgress = fScanningWallet.compare_exchange_strong(fScanning, true);
+    if (fReportProgress) {
+        nScanningStartTime = GetTimeMillis();
+        dScanningProgress = 0;
+    }
 
+    CWalletScanBatch batch, batchNext;
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1968,32 +2145,85 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
-        double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
-            }
+        dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
+        dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
-                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+        for (; pindex && batch.vIndex.size() < CWalletScanBatch::MAX_BLOCKS; pindex = chainActive.Next(pindex))
+            batch.vIndex.push_back(pindex);
+        GetScanFilter(batch.filter);
+    }
+    batch.Read(nThreads);
+
+    while (!batch.vIndex.empty())
+    {
+        CWalletScanReadAhead readAhead;
+        {
+            LOCK2(cs_main, cs_wallet);
+
+            // Carry on after the last block of the batch, or where the chain forked off if it left the chain
+            CBlockIndex* pindexLast = batch.vIndex.back();
+            pindex = chainActive.Contains(pindexLast) ? chainActive.Next(pindexLast) : chainActive.Next(chainActive.FindFork(pindexLast));
+            batchNext.vIndex.clear();
+            for (; pindex && batchNext.vIndex.size() < CWalletScanBatch::MAX_BLOCKS; pindex = chainActive.Next(pindex))
+                batchNext.vIndex.push_back(pindex);
+            batchNext.filter = CWalletScanFilter();
+            GetScanFilter(batchNext.filter);
+            if (!batchNext.vIndex.empty())
+                readAhead.thread = std::thread(&CWalletScanBatch::Read, &batchNext, nThreads);
+
+            // Keys added since the batch was matched are only known to the full check
+            bool fFilterStale = batchNext.filter.size() != batch.filter.size();
+
+            for (size_t i = 0; i < batch.vIndex.size(); i++)
+            {
+                pindex = batch.vIndex[i];
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                    double dProgress = (GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart);
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dProgress * 100))));
+                    if (fReportProgress)
+                        dScanningProgress = std::max(0.0, std::min(1.0, dProgress));
                 }
-                if (!ret) {
-                    ret = pindex;
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
+                }
+
+                // a reorg took the block out of the chain while it was being read
+                if (!chainActive.Contains(pindex))
+                    continue;
+
+                if (batch.vRead[i]) {
+                    const CBlock& block = batch.vBlocks[i];
+                    for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
+                        const CTransaction& tx = *block.vtx[posInBlock];
+                        // Paying to us is what the filter can tell, spending from or
+                        // conflicting with our transactions needs the current wallet
+                        bool fRelevant = fFilterStale || batch.vMatches[i][posInBlock] || mapWallet.count(tx.GetHash());
+                        for (size_t j = 0; !fRelevant && j < tx.vin.size(); j++) {
+                            const COutPoint& prevout = tx.vin[j].prevout;
+                            fRelevant = mapWallet.count(prevout.hash) || mapTxSpends.count(prevout);
+                        }
+                        if (fRelevant)
+                            AddToWalletIfInvolvingMe(tx, pindex, posInBlock, fUpdate);
+                    }
+                    if (!ret) {
+                        ret = pindex;
+                    }
+                } else {
+                    ret = nullptr;
                 }
-            } else {
-                ret = nullptr;
             }
-            pindex = chainActive.Next(pindex);
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        // the locks are released while the next batch finishes reading
+        if (readAhead.thread.joinable())
+            readAhead.thread.join();
+        std::swap(batch, batchNext);
     }
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    if (fReportProgress)
+        fScanningWallet = false;
     return ret;
 }
 
@@ -2133,6 +2363,25 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter) const
     return credit;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fAnonymizedCreditCached = false;
+    fDenomUnconfCreditCached = false;
+    fDenomConfCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+
+    if (pwallet)
+        pwallet->MarkBalancesDirty(GetHash());
+}
+
 CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const
 {
     if (IsCoinBase() && GetBlocksToMaturity() > 0 && IsInMainChain())
@@ -2415,38 +2664,222 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+CWalletBalances& CWalletBalances::operator+=(const CWalletBalances& b)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    nBalance += b.nBalance;
+    nUnconfirmed += b.nUnconfirmed;
+    nImmature += b.nImmature;
+    nWatchOnly += b.nWatchOnly;
+    nUnconfirmedWatchOnly += b.nUnconfirmedWatchOnly;
+    nImmatureWatchOnly += b.nImmatureWatchOnly;
+    nAnonymized += b.nAnonymized;
+    nDenominated += b.nDenominated;
+    nDenominatedUnconfirmed += b.nDenominatedUnconfirmed;
+    nStake += b.nStake;
+    return *this;
+}
+
+CWalletBalances& CWalletBalances::operator-=(const CWalletBalances& b)
+{
+    nBalance -= b.nBalance;
+    nUnconfirmed -= b.nUnconfirmed;
+    nImmature -= b.nImmature;
+    nWatchOnly -= b.nWatchOnly;
+    nUnconfirmedWatchOnly -= b.nUnconfirmedWatchOnly;
+    nImmatureWatchOnly -= b.nImmatureWatchOnly;
+    nAnonymized -= b.nAnonymized;
+    nDenominated -= b.nDenominated;
+    nDenominatedUnconfirmed -= b.nDenominatedUnconfirmed;
+    nStake -= b.nStake;
+    return *this;
+}
+
+bool operator==(const CWalletBalances& a, const CWalletBalances& b)
+{
+    return a.nBalance == b.nBalance && a.nUnconfirmed == b.nUnconfirmed && a.nImmature == b.nImmature &&
+           a.nWatchOnly == b.nWatchOnly && a.nUnconfirmedWatchOnly == b.nUnconfirmedWatchOnly && a.nImmatureWatchOnly == b.nImmatureWatchOnly &&
+           a.nAnonymized == b.nAnonymized && a.nDenominated == b.nDenominated && a.nDenominatedUnconfirmed == b.nDenominatedUnconfirmed &&
+           a.nStake == b.nStake;
+}
+
+std::string CWalletBalances::ToString() const
+{
+    return strprintf("CWalletBalances(balance=%s, unconfirmed=%s, immature=%s, watchonly=%s/%s/%s, anonymized=%s, denominated=%s/%s, stake=%s)",
+        FormatMoney(nBalance), FormatMoney(nUnconfirmed), FormatMoney(nImmature),
+        FormatMoney(nWatchOnly), FormatMoney(nUnconfirmedWatchOnly), FormatMoney(nImmatureWatchOnly),
+        FormatMoney(nAnonymized), FormatMoney(nDenominated), FormatMoney(nDenominatedUnconfirmed), FormatMoney(nStake));
+}
+
+CWalletBalances CWallet::GetTxBalances(const CWalletTx& wtx, int64_t& nStakeTimeRet) const
+{
+    CWalletBalances balances;
+    const uint256& hashTx = wtx.GetHash();
+    bool fTrusted = wtx.IsTrusted();
+
+    if (fTrusted) {
+        balances.nBalance = wtx.GetAvailableCredit();
+        balances.nWatchOnly = wtx.GetAvailableWatchOnlyCredit();
+    } else if (wtx.GetDepthInMainChain() == 0 && wtx.InMempool()) {
+        balances.nUnconfirmed = wtx.GetAvailableCredit();
+        balances.nUnconfirmedWatchOnly = wtx.GetAvailableWatchOnlyCredit();
+    }
+    balances.nImmature = wtx.GetImmatureCredit();
+    balances.nImmatureWatchOnly = wtx.GetImmatureWatchOnlyCredit();
+
+    if (!fLiteMode) {
+        balances.nDenominated = wtx.GetDenominatedCredit(false);
+        balances.nDenominatedUnconfirmed = wtx.GetDenominatedCredit(true);
+        if (fTrusted) {
+            std::set<COutPoint>::const_iterator it = setWalletUTXO.lower_bound(COutPoint(hashTx, 0));
+            if (it != setWalletUTXO.end() && it->hash == hashTx)
+                balances.nAnonymized = wtx.GetAnonymizedCredit();
         }
     }
 
-    return nTotal;
+    // ppcoin: coins staked are non-spendable until maturity
+    if (fTrusted && wtx.GetBlocksToMaturity() < (wtx.tx->IsCoinStake() ? COINBASE_MATURITY : 10))
+        balances.nStake = wtx.GetAvailableCredit();
+    nStakeTimeRet = wtx.GetTxTime() + GetStakeMinAge(wtx.GetTxTime());
+
+    return balances;
 }
 
-// ppcoin: total coins staked (non-spendable until maturity)
-CAmount CWallet::GetStake() const
+void CWallet::TallyTxBalances(const uint256& hashTx) const
 {
+    AssertLockHeld(cs_wallet);
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            auto nStakeMinAge = pcoin->GetTxTime() > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
-            if (pcoin->IsTrusted() && GetTime() - pcoin->GetTxTime() > nStakeMinAge && pcoin->GetBlocksToMaturity() < (pcoin->tx->IsCoinStake() ? COINBASE_MATURITY : 10))
-                nTotal += pcoin->GetAvailableCredit();
+    std::map<uint256, CTxBalances>::iterator itTally = mapTxBalances.find(hashTx);
+    if (itTally != mapTxBalances.end()) {
+        const CTxBalances& tally = itTally->second;
+        balancesTally -= tally.balances;
+        if (tally.nStakeTime >= nBalancesStakeTime) {
+            // its stake amount was not counted yet
+            balancesTally.nStake += tally.balances.nStake;
+            CAmount& nPending = mapBalancesStakePending[tally.nStakeTime];
+            nPending -= tally.balances.nStake;
+            if (nPending == 0)
+                mapBalancesStakePending.erase(tally.nStakeTime);
         }
+        mapTxBalances.erase(itTally);
+    }
+    setBalancesImmature.erase(hashTx);
+    setBalancesMempool.erase(hashTx);
+
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hashTx);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = it->second;
+
+    int nDepth = wtx.GetDepthInMainChain(false);
+    if (nDepth == 0 && wtx.InMempool()) {
+        setBalancesMempool.insert(hashTx);
+        return;
+    }
+    if (nDepth > 0 && wtx.GetBlocksToMaturity() > 0)
+        setBalancesImmature.insert(hashTx);
+
+    CTxBalances tally;
+    tally.balances = GetTxBalances(wtx, tally.nStakeTime);
+    if (tally.balances.IsNull())
+        return;
+    balancesTally += tally.balances;
+    if (tally.nStakeTime >= nBalancesStakeTime) {
+        balancesTally.nStake -= tally.balances.nStake;
+        mapBalancesStakePending[tally.nStakeTime] += tally.balances.nStake;
+    }
+    mapTxBalances.insert(std::make_pair(hashTx, tally));
+}
+
+void CWallet::UpdateBalances(int64_t nTime) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (fBalancesDirtyAll || nTime < nBalancesStakeTime || nBalancesPrivateSendRounds != privateSendClient.nPrivateSendRounds ||
+        (pindexBalances && !chainActive.Contains(pindexBalances))) {
+        // count everything again, e.g. after a reorg changed the depth of any transaction
+        balancesTally.SetNull();
+        mapTxBalances.clear();
+        mapBalancesStakePending.clear();
+        setBalancesImmature.clear();
+        setBalancesMempool.clear();
+        setBalancesDirty.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet)
+            setBalancesDirty.insert(item.first);
+        nBalancesStakeTime = nTime;
+        nBalancesPrivateSendRounds = privateSendClient.nPrivateSendRounds;
+        fBalancesDirtyAll = false;
+    } else if (pindexBalances != pindexTip) {
+        // the new blocks only matured coinbases
+        setBalancesDirty.insert(setBalancesImmature.begin(), setBalancesImmature.end());
+    }
+    pindexBalances = pindexTip;
+
+    // transactions which left the mempool are counted with the confirmed ones
+    for (const uint256& hashTx : setBalancesMempool) {
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hashTx);
+        if (it == mapWallet.end() || it->second.GetDepthInMainChain(false) != 0 || !it->second.InMempool())
+            setBalancesDirty.insert(hashTx);
+    }
+
+    std::set<uint256> setDirty;
+    setDirty.swap(setBalancesDirty);
+    for (const uint256& hashTx : setDirty)
+        TallyTxBalances(hashTx);
+
+    // stake amounts count once the coins are old enough
+    std::map<int64_t, CAmount>::iterator it = mapBalancesStakePending.begin();
+    while (it != mapBalancesStakePending.end() && it->first < nTime) {
+        balancesTally.nStake += it->second;
+        it = mapBalancesStakePending.erase(it);
+    }
+    nBalancesStakeTime = nTime;
+}
+
+CWalletBalances CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+
+    int64_t nTime = GetTime();
+    UpdateBalances(nTime);
+
+    CWalletBalances balances = balancesTally;
+    for (const uint256& hashTx : setBalancesMempool) {
+        int64_t nStakeTime;
+        CWalletBalances balancesTx = GetTxBalances(mapWallet.at(hashTx), nStakeTime);
+        if (nStakeTime >= nTime)
+            balancesTx.nStake = 0;
+        balances += balancesTx;
     }
 
+    if (fCheckBalances) {
+        CWalletBalances balancesCheck;
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+            int64_t nStakeTime;
+            CWalletBalances balancesTx = GetTxBalances(item.second, nStakeTime);
+            if (nStakeTime >= nTime)
+                balancesTx.nStake = 0;
+            balancesCheck += balancesTx;
+        }
+        if (balances != balancesCheck) {
+            LogPrintf("%s: %s does not match the recount %s\n", __func__, balances.ToString(), balancesCheck.ToString());
+            assert(balances == balancesCheck);
+        }
+    }
+
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nBalance;
+}
+
+// ppcoin: total coins staked (non-spendable until maturity)
+CAmount CWallet::GetStake() const
+{
+    CAmount nTotal = GetBalances().nStake;
     nTotal = nTotal - ((masternodeConfig.getCount() * 5000) - ((fundamentalnodeConfig.getCount() * 10000)));
     return nTotal;
 }
@@ -2485,23 +2918,7 @@ CAmount CWallet::GetAnonymizedBalance() const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-
-    LOCK2(cs_main, cs_wallet);
-
-    std::set<uint256> setWalletTxesCounted;
-    for (const auto& outpoint : setWalletUTXO) {
-
-        if (setWalletTxesCounted.find(outpoint.hash) != setWalletTxesCounted.end()) continue;
-        setWalletTxesCounted.insert(outpoint.hash);
-
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash); it != mapWallet.end() && it->first == outpoint.hash; ++it) {
-            if (it->second.IsTrusted())
-                nTotal += it->second.GetAnonymizedCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -2577,92 +2994,33 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-        }
-    }
-
-    return nTotal;
+    CWalletBalances balances = GetBalances();
+    return unconfirmed ? balances.nDenominatedUnconfirmed : balances.nDenominated;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmatureWatchOnly;
 }
 
 void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, AvailableCoinsType nCoinType, bool fUseInstantSend) const
@@ -2940,55 +3298,73 @@ bool CWallet::MintableCoins()
     //        return error("MintableCoins() : invalid reserve balance amount");
     //    if (nBalance <= nReserveBalance)
     //        return false;
-    std::vector<COutput> vCoins;
     LOCK2(cs_main, cs_wallet);
-    AvailableCoins(vCoins, true);
-    for (const COutput& out : vCoins)
+    int64_t nTime = GetTime();
+    for (const std::pair<int64_t, COutPoint>& candidate : setStakeCandidates)
     {
-        auto nStakeMinAge = out.tx->GetTxTime() > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
-
-        if (GetTime() - out.tx->GetTxTime() > nStakeMinAge)
-        {
+        if (candidate.first >= nTime)
+            break;
+        if (!IsSpent(candidate.second.hash, candidate.second.n) && !IsLockedCoin(candidate.second.hash, candidate.second.n))
             return true;
-        }
     }
     return false;
 }
+
+void CWallet::UpdateStakeCandidates(const uint256& hashTx)
+{
+    AssertLockHeld(cs_wallet);
+
+    auto itTime = mapStakeCandidateTimes.lower_bound(COutPoint(hashTx, 0));
+    while (itTime != mapStakeCandidateTimes.end() && itTime->first.hash == hashTx) {
+        setStakeCandidates.erase(std::make_pair(itTime->second, itTime->first));
+        itTime = mapStakeCandidateTimes.erase(itTime);
+    }
+
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hashTx);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = it->second;
+    // only transactions in a block can be staked, the depth is checked on selection
+    if (wtx.hashUnset() || wtx.nIndex < 0)
+        return;
+
+    int64_t nTimeEligible = wtx.GetTxTime() + GetStakeMinAge(wtx.GetTxTime());
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        const CTxOut& txout = wtx.tx->vout[i];
+        if (txout.nValue <= 0 || txout.scriptPubKey.IsPayToScriptHash())
+            continue;
+        if (!(IsMine(txout) & ISMINE_SPENDABLE) || IsSpent(hashTx, i))
+            continue;
+        COutPoint outpoint(hashTx, i);
+        setStakeCandidates.insert(std::make_pair(nTimeEligible, outpoint));
+        mapStakeCandidateTimes.insert(std::make_pair(outpoint, nTimeEligible));
+    }
+}
+
 bool CWallet::SelectStakeCoins(StakeCoinsSet &setCoins, CAmount nTargetAmount, const CScript &scriptFilterPubKey) const
 {
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, scriptFilterPubKey.empty());
+    LOCK2(cs_main, cs_wallet);
+    int64_t nTime = GetTime();
     CAmount nAmountSelected = 0;
-    std::set<CScript> rejectCache;
-    for (const COutput& out : vCoins) {
-        //make sure not to outrun target amount
-        CScript scriptPubKeyKernel;
-        scriptPubKeyKernel = out.tx->tx->vout[out.i].scriptPubKey;
-        if(scriptPubKeyKernel.IsPayToScriptHash())
+    for (const std::pair<int64_t, COutPoint>& candidate : setStakeCandidates) {
+        //check for min age, candidates are ordered by the time they reach it
+        if (candidate.first > nTime)
+            break;
+        const COutPoint& outpoint = candidate.second;
+        const CWalletTx* pcoin = GetWalletTx(outpoint.hash);
+        if (!pcoin || IsSpent(outpoint.hash, outpoint.n) || IsLockedCoin(outpoint.hash, outpoint.n))
             continue;
-        //     LogPrintf("scriptPubKeyKernel is good\n");
+        //make sure not to outrun target amount
         //for now we will comment this out
-        //        if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+        //        if (nAmountSelected + pcoin->tx->vout[outpoint.n].nValue > nTargetAmount)
         //            continue;
-        //        LogPrintf("amount is good\n");
-        //check for min age
-        auto nStakeMinAge = out.tx->GetTxTime() > Params().GetConsensus().nStakeMinAgeSwitchTime ? Params().GetConsensus().nStakeMinAge_2 : Params().GetConsensus().nStakeMinAge;
-        if (GetTime() - out.tx->GetTxTime() < nStakeMinAge)
-            continue;
-        //  LogPrintf("min age is good\n");
         //check that it is matured
-        if (out.nDepth < (out.tx->tx->IsCoinStake() ? COINBASE_MATURITY : 10))
-            continue;
-        //  LogPrintf("maturity is good\n");
-        auto scriptPubKeyCoin = out.tx->tx->vout[out.i].scriptPubKey;
-        if(!scriptFilterPubKey.empty() && scriptPubKeyCoin != scriptFilterPubKey)
+        if (pcoin->GetDepthInMainChain(false) < GetStakeMinDepth(*pcoin))
             continue;
-        //   LogPrintf("filtering is good\n");
-        if(rejectCache.count(scriptPubKeyCoin))
+        if(!scriptFilterPubKey.empty() && pcoin->tx->vout[outpoint.n].scriptPubKey != scriptFilterPubKey)
             continue;
-        //    LogPrintf("reject is good\n");
-        nAmountSelected += out.tx->tx->vout[out.i].nValue; //maybe change here for tpos
-        setCoins.insert(std::make_pair(out.tx, out.i));
+        nAmountSelected += pcoin->tx->vout[outpoint.n].nValue; //maybe change here for tpos
+        setCoins.insert(std::make_pair(pcoin, outpoint.n));
     }
     return true;
 }
@@ -4106,80 +4482,135 @@ void CWallet::ListAccountCreditDebit(const std::string& strAccount, std::list<CA
     return walletdb.ListAccountCreditDebit(strAccount, entries);
 }
 
-bool CWallet::CreateCoinStake(unsigned int nBits,
-                              CAmount blockReward,
-                              CMutableTransaction &txNew,
-                              unsigned int &nTxNewTime,
-                              std::vector<CWalletTx*> &vwtxPrev)
+/** Number of stake kernel search threads from -stakethreads, 0 meaning all cores and
+ * a negative value leaving that many cores free */
+static int GetStakeThreads()
 {
-    // The following split & combine thresholds are important to security
-    // Should not be adjusted if you don't understand the consequences
-    //int64_t nCombineThreshold = 0;
-    CBlockIndex* pindexPrev = pindexBestHeader;
-    txNew.vin.clear();
-    txNew.vout.clear();
-    // Mark coin stake transaction
-    CScript scriptEmpty;
-    scriptEmpty.clear();
-    txNew.vout.emplace_back(CTxOut(0, scriptEmpty));
-    // Choose coins to use
-    CAmount nBalance = GetBalance();
-    //    if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-    //        return error("CreateCoinStake : invalid reserve balance amount");
-    //    if (nBalance <= nReserveBalance)
-    //        return false;
-    //  presstab HyperStake - Initialize as static and don't update the set on every run of CreateCoinStake() in order to lighten resource use
-    static StakeCoinsSet setStakeCoins;
-    static int nLastStakeSetUpdate = 0;
-    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
-        setStakeCoins.clear();
+    int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    return std::max(1, std::min(nThreads, MAX_STAKE_THREADS));
+}
+
+bool CWallet::FindStakeKernel(const CBlockIndex* pindexPrev, unsigned int nBits,
+                              CStakeKernelHit& kernelHitRet, uint64_t& nKernelsTriedRet)
+{
+    nKernelsTriedRet = 0;
+
+    // The kernel state of a coin only changes with the chain, so resolve it
+    // once per coin and tip and reuse it for every search on that tip
+    static std::map<COutPoint, CStakeKernel> mapStakeKernels;
+    static uint256 hashStakeKernelTip;
+
+    struct CStakeCandidate
+    {
+        COutPoint prevout;
         CScript scriptPubKey;
-        if (!SelectStakeCoins(setStakeCoins, nBalance /*- nReserveBalance*/, scriptPubKey)) {
+        CStakeKernel kernel;
+    };
+    std::vector<CStakeCandidate> vCandidates;
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (chainActive.Tip() != pindexPrev)
+            return false;
+
+        // cheap now that stake candidates are maintained incrementally, so select on every search
+        StakeCoinsSet setStakeCoins;
+        if (!SelectStakeCoins(setStakeCoins, MAX_MONEY /*- nReserveBalance*/)) {
             return error("Failed to select coins for staking");
         }
-        LogPrintf("Selected %d coins for staking\n", setStakeCoins.size());
-        nLastStakeSetUpdate = GetTime();
-    }
-    if (setStakeCoins.empty())
-        return error("CreateCoinStake() : No Coins to stake");
-    //prevent staking a time that won't be accepted
-    if (GetAdjustedTime() <= chainActive.Tip()->nTime)
-        MilliSleep(10000);
-    bool fKernelFound = false;
-    CAmount nCredit = 0;
+        if (setStakeCoins.empty())
+            return error("FindStakeKernel() : No Coins to stake");
 
-    for(const std::pair<const CWalletTx*, unsigned int> &pcoin : setStakeCoins)
-    {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
-            LogPrintf("failed to find block index ");
-            continue;
+        if (hashStakeKernelTip != pindexPrev->GetBlockHash()) {
+            mapStakeKernels.clear();
+            hashStakeKernelTip = pindexPrev->GetBlockHash();
         }
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
-        //iterates each utxo inside of CheckStakeKernelHash()
-        CScript kernelScript;
-        auto stakeScript = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
-        fKernelFound = CreateCoinStakeKernel(kernelScript, stakeScript, nBits,
-                                             block, sizeof(CBlock), pcoin.first->tx,
-                                             prevoutStake, nTxNewTime, false);
-        if(fKernelFound)
+
+        vCandidates.reserve(setStakeCoins.size());
+        for (const std::pair<const CWalletTx*, unsigned int> &pcoin : setStakeCoins)
         {
-            FillCoinStakePayments(txNew, kernelScript, prevoutStake, blockReward);
-            break;
+            //make sure that enough time has elapsed between
+            BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
+            if (it == mapBlockIndex.end()) {
+                LogPrintf("failed to find block index ");
+                continue;
+            }
+            COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+            auto itKernel = mapStakeKernels.find(prevoutStake);
+            if (itKernel == mapStakeKernels.end()) {
+                itKernel = mapStakeKernels.emplace(prevoutStake, CStakeKernel()).first;
+                itKernel->second.Init(it->second, STAKE_KERNEL_TX_OFFSET, prevoutStake, pcoin.first->tx->vout[pcoin.second].nValue);
+            }
+            vCandidates.push_back(CStakeCandidate{prevoutStake, pcoin.first->tx->vout[pcoin.second].scriptPubKey, itKernel->second});
         }
     }
-    if(!fKernelFound)
-    {
-        LogPrintf("Failed to find coinstake kernel");
+
+    // Only hashing from here on, validation and the mempool are not held up by
+    // the search. All coins share one timestamp window, so the outcome only
+    // depends on the coin set and not on how the search is split up.
+    unsigned int nTimeTx = GetAdjustedTime();
+    // A kernel at or before the median time past would not pass time requirements
+    int64_t nTimeFrom = std::max<int64_t>(nTimeTx + 1, pindexPrev->GetMedianTimePast() + 1);
+    unsigned int nTimeTo = nTimeTx + nHashDrift;
+    if (nTimeFrom > nTimeTo)
         return false;
+
+    std::sort(vCandidates.begin(), vCandidates.end(), [](const CStakeCandidate& a, const CStakeCandidate& b) {
+        return a.prevout < b.prevout;
+    });
+    std::vector<const CStakeKernel*> vKernels;
+    std::vector<const CStakeCandidate*> vKernelCandidates;
+    vKernels.reserve(vCandidates.size());
+    vKernelCandidates.reserve(vCandidates.size());
+    for (const CStakeCandidate& candidate : vCandidates)
+    {
+        unsigned int nTimeBlockFrom = candidate.kernel.GetBlockFromTime();
+        if (nTimeBlockFrom + GetStakeMinAge(nTimeBlockFrom) + nHashDrift > nTimeTx) // Min age requirement
+            continue;
+        vKernels.push_back(&candidate.kernel);
+        vKernelCandidates.push_back(&candidate);
     }
+
+    size_t nIndex = 0;
+    unsigned int nTimeHit = 0;
+    if (!SearchStakeKernels(vKernels, nBits, nTimeFrom, nTimeTo, GetStakeThreads(), nIndex, nTimeHit, nKernelsTriedRet))
+        return false;
+
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("FindStakeKernel : kernel found\n");
+    const CStakeCandidate& candidate = *vKernelCandidates[nIndex];
+    kernelHitRet.hashPrevBlock = pindexPrev->GetBlockHash();
+    kernelHitRet.nBits = nBits;
+    kernelHitRet.nTime = nTimeHit;
+    kernelHitRet.prevout = candidate.prevout;
+    kernelHitRet.scriptPubKey = candidate.scriptPubKey;
+    return true;
+}
+
+bool CWallet::CreateCoinStake(const CStakeKernelHit& kernelHit,
+                              CAmount blockReward,
+                              CMutableTransaction &txNew,
+                              unsigned int &nTxNewTime,
+                              std::vector<CWalletTx*> &vwtxPrev)
+{
+    AssertLockHeld(cs_main);
+    if (kernelHit.hashPrevBlock != chainActive.Tip()->GetBlockHash())
+        return error("CreateCoinStake() : kernel was found on an old tip");
+    {
+        LOCK(cs_wallet);
+        if (!GetWalletTx(kernelHit.prevout.hash) || IsSpent(kernelHit.prevout.hash, kernelHit.prevout.n))
+            return error("CreateCoinStake() : kernel input %s is not spendable anymore", kernelHit.prevout.ToStringShort());
+    }
+
+    txNew.vin.clear();
+    txNew.vout.clear();
+    // Mark coin stake transaction
+    CScript scriptEmpty;
+    scriptEmpty.clear();
+    txNew.vout.emplace_back(CTxOut(0, scriptEmpty));
+    FillCoinStakePayments(txNew, kernelHit.scriptPubKey, kernelHit.prevout, blockReward);
+    nTxNewTime = kernelHit.nTime;
     // Limit size
     unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
     //    if (nBytes >= DEFAULT_BLOCK_MAX_SIZE / 5){
@@ -4195,7 +4626,6 @@ bool CWallet::CreateCoinStake(unsigned int nBits,
     AdjustMasternodePayment(txNew, txoutMasternode, txoutFundamentalnode);
     LogPrintf("CreateCoinStake -- nBlockHeight %d blockReward %lld txoutMasternode %s txoutFundamentalnode %s txNew %s",
               nHeight, blockReward, txoutMasternode.ToString(), txoutFundamentalnode.ToString(), txNew.ToString());
-    nLastStakeSetUpdate = 0; //this will trigger stake set to repopulate next round
     return true;
 }
 
@@ -5073,6 +5503,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     if (showDebug)
         strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Set the number of stake kernel search threads (%u to %d, 0 = all cores, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_STAKE_THREADS, DEFAULT_STAKE_THREADS));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-usehd", _("Use hierarchical deterministic key generation (HD) after BIP39/BIP44. Only has effect during wallet creation/first start") + " " + strprintf(_("(default: %u)"), DEFAULT_USE_HD_WALLET));
@@ -5097,6 +5529,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     {
         strUsage += HelpMessageGroup(_("Wallet debugging/testing options:"));
 
+        strUsage += HelpMessageOpt("-checkbalances", strprintf("Check the running wallet balances against a recount of all wallet transactions on every query (default: %u)", DEFAULT_CHECK_BALANCES));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
@@ -5429,6 +5862,7 @@ bool CWallet::ParameterInteraction()
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    fCheckBalances = GetBoolArg("-checkbalances", DEFAULT_CHECK_BALANCES);
 
     if (fSendFreeTransactions && GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) <= 0)
         return InitError("Creation of free transactions with their relay disabled is not supported.");
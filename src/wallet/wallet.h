@@ -43,9 +43,12 @@ extern CFeeRate payTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
+extern bool fCheckBalances;
 extern bool bBIP69Enabled;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 1000;
+//! Most HD keys kept derived in memory while the wallet is unlocked
+static const unsigned int MAX_HD_KEY_CACHE_SIZE = 10000;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -fallbackfee default
@@ -64,10 +67,16 @@ static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 static const bool DEFAULT_SEND_FREE_TRANSACTIONS = false;
 //! Default for -walletrejectlongchains
 static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
+//! Default for -checkbalances
+static const bool DEFAULT_CHECK_BALANCES = false;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! -stakethreads default
+static const int DEFAULT_STAKE_THREADS = 1;
+//! Maximum number of stake kernel search threads
+static const int MAX_STAKE_THREADS = 16;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
 
@@ -83,8 +92,10 @@ class CCoinControl;
 class COutput;
 class CReserveKey;
 class CScript;
+class CStakeKernel;
 class CTxMemPool;
 class CWalletTx;
+struct CWalletScanFilter;
 
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
@@ -120,6 +131,58 @@ struct CompactTallyItem
     }
 };
 
+/** The wallet balance of each kind, or what one transaction adds to them */
+struct CWalletBalances
+{
+    CAmount nBalance;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnly;
+    CAmount nUnconfirmedWatchOnly;
+    CAmount nImmatureWatchOnly;
+    CAmount nAnonymized;
+    CAmount nDenominated;
+    CAmount nDenominatedUnconfirmed;
+    CAmount nStake;
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nBalance = nUnconfirmed = nImmature = 0;
+        nWatchOnly = nUnconfirmedWatchOnly = nImmatureWatchOnly = 0;
+        nAnonymized = nDenominated = nDenominatedUnconfirmed = 0;
+        nStake = 0;
+    }
+
+    bool IsNull() const
+    {
+        return *this == CWalletBalances();
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b);
+    CWalletBalances& operator-=(const CWalletBalances& b);
+    friend bool operator==(const CWalletBalances& a, const CWalletBalances& b);
+    friend bool operator!=(const CWalletBalances& a, const CWalletBalances& b) { return !(a == b); }
+
+    std::string ToString() const;
+};
+
+/** A proof-of-stake kernel found by CWallet::FindStakeKernel, only valid on top of hashPrevBlock */
+struct CStakeKernelHit
+{
+    uint256 hashPrevBlock;
+    unsigned int nBits;
+    unsigned int nTime;
+    COutPoint prevout;
+    CScript scriptPubKey;
+
+    CStakeKernelHit() : nBits(0), nTime(0) {}
+};
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -430,21 +493,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fAnonymizedCreditCached = false;
-        fDenomUnconfCreditCached = false;
-        fDenomConfCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -655,7 +704,6 @@ private:
     // Stake Settings
     unsigned int nHashDrift;
     unsigned int nHashInterval;
-    int nStakeSetUpdateTime;
     mutable bool fAnonymizableTallyCached;
     mutable std::vector<CompactTallyItem> vecAnonymizableTallyCached;
     mutable bool fAnonymizableTallyCachedNonDenom;
@@ -673,6 +721,45 @@ private:
 
     std::set<COutPoint> setWalletUTXO;
 
+    /**
+     * Confirmed, spendable, non-P2SH outputs of ours that can become stake
+     * inputs, ordered by the time they reach the stake min age. Depth, locks
+     * and spends are checked again when stake coins are selected.
+     */
+    std::set<std::pair<int64_t, COutPoint> > setStakeCandidates;
+    std::map<COutPoint, int64_t> mapStakeCandidateTimes;
+    /** Refresh the stake candidates of one wallet transaction */
+    void UpdateStakeCandidates(const uint256& hashTx);
+
+    /**
+     * Running totals behind GetBalances. Confirmed transactions are counted
+     * once and again only after MarkDirty on them, immature coinbases also
+     * whenever the tip moved and everything after a reorg. Transactions in
+     * the mempool are counted on every call, as they may leave it unnoticed.
+     * Stake amounts wait in mapBalancesStakePending, keyed by the time they
+     * reach the stake min age, until they count.
+     */
+    struct CTxBalances
+    {
+        CWalletBalances balances;
+        int64_t nStakeTime;
+    };
+    mutable CWalletBalances balancesTally;
+    mutable std::map<uint256, CTxBalances> mapTxBalances;
+    mutable std::map<int64_t, CAmount> mapBalancesStakePending;
+    mutable int64_t nBalancesStakeTime;
+    mutable std::set<uint256> setBalancesDirty;
+    mutable std::set<uint256> setBalancesImmature;
+    mutable std::set<uint256> setBalancesMempool;
+    mutable const CBlockIndex* pindexBalances;
+    mutable int nBalancesPrivateSendRounds;
+    mutable bool fBalancesDirtyAll;
+
+    /** What one transaction adds to the balances, its stake amount counts after nStakeTimeRet */
+    CWalletBalances GetTxBalances(const CWalletTx& wtx, int64_t& nStakeTimeRet) const;
+    void TallyTxBalances(const uint256& hashTx) const;
+    void UpdateBalances(int64_t nTime) const;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -681,10 +768,6 @@ private:
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
-    bool CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript,
-                               unsigned int nBits, const CBlock& blockFrom,
-                               unsigned int nTxPrevOffset, const CTransactionRef &txPrev,
-                               const COutPoint& prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const;
     void FillCoinStakePayments(CMutableTransaction &transaction,
                                const CScript &kernelScript,
                                const COutPoint &stakePrevout, CAmount blockReward) const;
@@ -706,6 +789,23 @@ private:
      */
     bool AddWatchOnly(const CScript& dest) override;
 
+    /** Progress of the running rescan, for getwalletinfo */
+    std::atomic<bool> fScanningWallet;
+    std::atomic<int64_t> nScanningStartTime;
+    std::atomic<double> dScanningProgress;
+
+    /** Collect what outputs paying to this wallet can look like, see CWalletScanFilter */
+    void GetScanFilter(CWalletScanFilter& filter) const;
+
+    /**
+     * Private keys GetKey derived from the HD chain, so signing does not
+     * decrypt the seed and derive them again for every input. Only filled
+     * while the wallet is unlocked and wiped by Lock, guarded by cs_KeyStore
+     * like the master key.
+     */
+    typedef std::map<CKeyID, CKey, std::less<CKeyID>, secure_allocator<std::pair<const CKeyID, CKey> > > HDKeyMap;
+    mutable HDKeyMap mapHDKeyCache;
+
 public:
     /*
      * Main wallet lock.
@@ -772,17 +872,23 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fScanningWallet = false;
+        nScanningStartTime = 0;
+        dScanningProgress = 0;
         fBroadcastTransactions = false;
         fAnonymizableTallyCached = false;
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        nBalancesStakeTime = 0;
+        pindexBalances = NULL;
+        nBalancesPrivateSendRounds = 0;
+        fBalancesDirtyAll = true;
 
         // Stake Settings
         nHashDrift = 45;
         nStakeSplitThreshold = 2000;
         nHashInterval = 22;
-        nStakeSetUpdateTime = 300; // 5 minutes
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -868,6 +974,7 @@ public:
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const override;
     //! GetKey implementation that can derive a HD private key on the fly
     bool GetKey(const CKeyID &address, CKey& keyOut) const override;
+    bool Lock(bool fAllowMixing = false) override;
     //! Adds a HDPubKey into the wallet(database)
     bool AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal);
     //! loads a HDPubKey into the wallets memory
@@ -921,14 +1028,27 @@ public:
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    /** Count a transaction again towards the balances, see GetBalances */
+    void MarkBalancesDirty(const uint256& hashTx) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     bool LoadToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
+    /**
+     * Scan the active chain from pindexStart for transactions of this wallet.
+     * Blocks are read and matched against the wallet's scripts in batches on
+     * a few threads without holding any lock, then added in order under
+     * cs_main and cs_wallet, which are released between the batches.
+     */
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    bool IsScanning() const { return fScanningWallet; }
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nScanningStartTime : 0; }
+    double ScanningProgress() const { return fScanningWallet ? (double)dScanningProgress : 0; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
+    /** All balances at once, kept up to date as transactions change instead of recounted */
+    CWalletBalances GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -962,7 +1082,17 @@ public:
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosInOut,
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true, AvailableCoinsType nCoinType=ALL_COINS, bool fUseInstantSend=false, bool IsFundamentalNodePayment = false);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state, const std::string& strCommand="tx");
-    bool CreateCoinStake(unsigned int nBits, CAmount blockReward,
+    /**
+     * Search the stake coins for a kernel on top of pindexPrev. Only the
+     * coin set and kernel state are resolved under cs_main/cs_wallet, the
+     * hashing itself runs without holding any lock, on -stakethreads threads.
+     * The hit with the latest timestamp wins, ties going to the lowest
+     * outpoint, whatever the number of threads.
+     */
+    bool FindStakeKernel(const CBlockIndex* pindexPrev, unsigned int nBits,
+                         CStakeKernelHit& kernelHitRet, uint64_t& nKernelsTriedRet);
+    /** Build the coinstake transaction for a kernel found by FindStakeKernel */
+    bool CreateCoinStake(const CStakeKernelHit& kernelHit, CAmount blockReward,
                          CMutableTransaction& txNew, unsigned int& nTxNewTime,
                          std::vector<CWalletTx *> &vwtxPrev);
     bool CreateCollateralTransaction(CMutableTransaction& txCollateral, std::string& strReason);